@@ -0,0 +1,474 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include "assembler.h"
+
+// Assembles the text qcc emits straight into a program image for the simulator.
+// There is no binary encoding, instructions are kept decoded and only occupy
+// address space, sized as if each was an opcode byte followed by its operands.
+
+char* opcode_names[] = {"mov", "push", "pop", "add", "sub", "and", "or", "cmp", "inc", "dec", "rol", "lde", "ldc", "jmp", "je", "jne", "jc", "jnc", "call", "ret", "add16", "sub16"};
+
+static char* register_names[] = {"a", "b", "c", "d", "e", "bc", "de", "sp"};
+
+struct Label {
+    char* name;
+    int address;
+};
+
+static char* current_filename;
+static int current_line;
+static int pass;
+static int address;
+static char global_label[64];
+
+static struct Label* labels = NULL;
+static int label_count = 0;
+static int label_capacity = 0;
+
+static void asm_error(const char* format, ...) {
+    fprintf(stderr, "%s:%d: error: ", current_filename, current_line);
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+
+    fprintf(stderr, "\n");
+    exit(255);
+}
+
+int register_size(int reg) {
+    if ((reg == R_BC) || (reg == R_DE) || (reg == R_SP)) return 2;
+    return 1;
+}
+
+static char* trim(char* s) {
+    while (isspace(*s)) s++;
+    char* end = s + strlen(s);
+    while ((end > s) && isspace(end[-1])) end--;
+    *end = '\0';
+    return s;
+}
+
+// Local labels start with '.' and belong to the last global label
+static void full_label_name(char* name, char* full_name) {
+    if (name[0] == '.') sprintf(full_name, "%s%s", global_label, name);
+    else strcpy(full_name, name);
+}
+
+static struct Label* find_label(char* name) {
+    for (int i = 0; i < label_count; i++) {
+        if (strcmp(labels[i].name, name) == 0) return &labels[i];
+    }
+    return NULL;
+}
+
+static void define_label(char* name) {
+    char full_name[128];
+    full_label_name(name, full_name);
+    if (name[0] != '.') strcpy(global_label, name);
+
+    if (pass == 2) return;
+    if (find_label(full_name) != NULL) asm_error("label '%s' already defined", full_name);
+
+    if (label_count >= label_capacity) {
+        label_capacity = (label_capacity == 0) ? 256 : label_capacity*2;
+        labels = realloc(labels, label_capacity*sizeof(struct Label));
+    }
+    labels[label_count].name = strdup(full_name);
+    labels[label_count].address = address;
+    label_count++;
+}
+
+// Decode one character of a string literal, returns number of source characters used
+static int string_char(char* s, int* value) {
+    if (s[0] != '\\') {
+        *value = (unsigned char)s[0];
+        return 1;
+    }
+    switch (s[1]) {
+        case 'n': *value = '\n'; break;
+        case 'r': *value = '\r'; break;
+        case 't': *value = '\t'; break;
+        case '0': *value = '\0'; break;
+        default: *value = (unsigned char)s[1]; break;
+    }
+    return 2;
+}
+
+static int evaluate_term(char* term) {
+    term = trim(term);
+
+    if (strcmp(term, "$") == 0) return address;
+
+    if ((term[0] == '\"') || (term[0] == '\'')) {
+        int value;
+        string_char(&term[1], &value);
+        return value;
+    }
+
+    if (isdigit(term[0])) {
+        char* end;
+        long value;
+        if ((term[0] == '0') && ((term[1] == 'b') || (term[1] == 'B'))) value = strtol(&term[2], &end, 2);
+        else value = strtol(term, &end, 0);
+        if (*end != '\0') asm_error("invalid number '%s'", term);
+        return value;
+    }
+
+    char full_name[128];
+    full_label_name(term, full_name);
+    struct Label* label = find_label(full_name);
+    if (label != NULL) return label->address;
+
+    // Forward references are fine on the first pass
+    if (pass == 1) return 0;
+    asm_error("undefined label '%s'", full_name);
+    return 0;
+}
+
+// Expressions are terms joined with + and -
+static int evaluate(char* expression) {
+    char buffer[128];
+    int value = 0;
+    int sign = 1;
+    int length = 0;
+    int in_quotes = 0;
+
+    for (char* p = expression;; p++) {
+        if (((*p == '\"') || (*p == '\'')) && ((p == expression) || (p[-1] != '\\'))) in_quotes = !in_quotes;
+
+        if ((*p == '\0') || (!in_quotes && ((*p == '+') || (*p == '-')) && (length > 0))) {
+            buffer[length] = '\0';
+            value += sign * evaluate_term(buffer);
+            if (*p == '\0') break;
+            sign = (*p == '+') ? 1 : -1;
+            length = 0;
+        } else if (!in_quotes && ((*p == '+') || (*p == '-')) && (length == 0)) {
+            if (*p == '-') sign = -sign;
+        } else {
+            if (length >= sizeof(buffer)-1) asm_error("expression too long");
+            buffer[length++] = *p;
+        }
+    }
+
+    return value;
+}
+
+static int parse_register(char* s) {
+    for (int i = 0; i < sizeof(register_names)/sizeof(register_names[0]); i++) {
+        if (strcmp(s, register_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+static void parse_operand(char* s, struct Operand* operand) {
+    s = trim(s);
+    int length = strlen(s);
+
+    if ((s[0] == '[') && (s[length-1] == ']')) {
+        s[length-1] = '\0';
+        operand->kind = OPERAND_INDIRECT;
+        operand->reg = parse_register(trim(&s[1]));
+        if ((operand->reg < 0) || (register_size(operand->reg) != 2) || (operand->reg == R_SP)) asm_error("indirect access must use bc or de");
+        return;
+    }
+
+    int reg = parse_register(s);
+    if (reg >= 0) {
+        operand->kind = OPERAND_REGISTER;
+        operand->reg = reg;
+        return;
+    }
+
+    if ((strncmp(s, "sp", 2) == 0) && ((s[2] == '+') || (s[2] == '-'))) {
+        operand->kind = OPERAND_STACK_OFFSET;
+        operand->expression = strdup(&s[2]);
+        return;
+    }
+
+    operand->kind = OPERAND_IMMEDIATE;
+    operand->expression = strdup(s);
+}
+
+// Split on commas that are not inside a string
+static int split_operands(char* s, char** parts, int max_parts) {
+    int count = 0;
+    int in_quotes = 0;
+    if (*trim(s) == '\0') return 0;
+
+    parts[count++] = s;
+    for (char* p = s; *p != '\0'; p++) {
+        if ((*p == '\"') && ((p == s) || (p[-1] != '\\'))) in_quotes = !in_quotes;
+        if (!in_quotes && (*p == ',')) {
+            if (count >= max_parts) asm_error("too many operands");
+            *p = '\0';
+            parts[count++] = p+1;
+        }
+    }
+    return count;
+}
+
+static int is_branch(enum Opcode opcode) {
+    return (opcode >= OP_JMP) && (opcode <= OP_CALL);
+}
+
+// Check operands are a valid combination, returns size in bytes
+static int check_instruction(struct Instruction* instruction) {
+    struct Operand* left = &instruction->operands[0];
+    struct Operand* right = &instruction->operands[1];
+    int count = instruction->operand_count;
+
+    switch (instruction->opcode) {
+        case OP_MOV:
+            if (count != 2) break;
+            if ((left->kind == OPERAND_REGISTER) && (right->kind == OPERAND_REGISTER)) {
+                if (register_size(left->reg) != register_size(right->reg)) asm_error("mov between registers of different sizes");
+                if ((left->reg == R_SP) || (right->reg == R_SP)) break;
+                return 1;
+            }
+            if ((left->kind == OPERAND_REGISTER) && (right->kind == OPERAND_IMMEDIATE) && (left->reg != R_SP)) return 1 + register_size(left->reg);
+            if ((left->kind == OPERAND_REGISTER) && (right->kind == OPERAND_INDIRECT) && (left->reg != R_SP)) return 1;
+            if ((left->kind == OPERAND_INDIRECT) && (right->kind == OPERAND_REGISTER) && (right->reg != R_SP)) return 1;
+            if ((left->kind == OPERAND_REGISTER) && (register_size(left->reg) == 2) && (right->kind == OPERAND_STACK_OFFSET)) return 2;
+            break;
+        case OP_PUSH:
+        case OP_POP:
+        case OP_INC:
+        case OP_DEC:
+            if ((count == 1) && (left->kind == OPERAND_REGISTER) && (left->reg != R_SP)) return 1;
+            break;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_AND:
+        case OP_OR:
+        case OP_CMP:
+            if ((count == 1) && (left->kind == OPERAND_REGISTER) && (register_size(left->reg) == 1)) return 1;
+            if ((count == 1) && (left->kind == OPERAND_IMMEDIATE)) return 2;
+            break;
+        case OP_ROL:
+        case OP_LDE:
+        case OP_LDC:
+        case OP_RET:
+            if (count == 0) return 1;
+            break;
+        case OP_JMP:
+        case OP_JE:
+        case OP_JNE:
+        case OP_JC:
+        case OP_JNC:
+        case OP_CALL:
+            if ((count == 1) && (left->kind == OPERAND_IMMEDIATE)) return 3;
+            break;
+        case OP_ADD16:
+        case OP_SUB16:
+            // Pseudo-ops, sized as the 8-bit sequence an assembler macro expands them to
+            if ((count == 2) && (left->kind == OPERAND_REGISTER) && (right->kind == OPERAND_REGISTER) &&
+                (register_size(left->reg) == 2) && (register_size(right->reg) == 2) &&
+                (left->reg != R_SP) && (right->reg != R_SP)) return 6;
+            break;
+        default:
+            break;
+    }
+
+    asm_error("invalid operands for '%s'", opcode_names[instruction->opcode]);
+    return 0;
+}
+
+// Modelled cost: one cycle per byte fetched, one per data byte
+// moved to or from memory and one for 16-bit address arithmetic
+static int instruction_cycles(struct Instruction* instruction) {
+    struct Operand* left = &instruction->operands[0];
+    struct Operand* right = &instruction->operands[1];
+    int cycles = instruction->size;
+
+    switch (instruction->opcode) {
+        case OP_MOV:
+            if (right->kind == OPERAND_INDIRECT) cycles += register_size(left->reg);
+            if (left->kind == OPERAND_INDIRECT) cycles += register_size(right->reg);
+            if (right->kind == OPERAND_STACK_OFFSET) cycles += 1;
+            if ((left->kind == OPERAND_REGISTER) && (right->kind == OPERAND_REGISTER) && (register_size(left->reg) == 2)) cycles += 1;
+            break;
+        case OP_PUSH:
+        case OP_POP:
+            cycles += register_size(left->reg);
+            break;
+        case OP_INC:
+        case OP_DEC:
+            if (register_size(left->reg) == 2) cycles += 1;
+            break;
+        case OP_CALL:
+        case OP_RET:
+            cycles += 2;
+            break;
+        default:
+            break;
+    }
+
+    return cycles;
+}
+
+static void emit_byte(struct Program* program, int value) {
+    if (pass == 2) program->memory[address & 0xffff] = value;
+    address++;
+}
+
+static void parse_directive(struct Program* program, char* line) {
+    char* name = line;
+    char* rest = line;
+    while ((*rest != '\0') && !isspace(*rest)) rest++;
+    if (*rest != '\0') *rest++ = '\0';
+    rest = trim(rest);
+
+    if (strcmp(name, "#bank") == 0) {
+        return;
+    } else if (strcmp(name, "#addr") == 0) {
+        address = evaluate(rest);
+    } else if (strcmp(name, "#res") == 0) {
+        address += evaluate(rest);
+    } else if ((strcmp(name, "#d") == 0) && (rest[0] == '\"')) {
+        int i = 1;
+        while ((rest[i] != '\"') && (rest[i] != '\0')) {
+            int value;
+            i += string_char(&rest[i], &value);
+            emit_byte(program, value);
+        }
+    } else if ((strcmp(name, "#d8") == 0) || (strcmp(name, "#d16") == 0)) {
+        char* parts[256];
+        int count = split_operands(rest, parts, 256);
+        for (int i = 0; i < count; i++) {
+            int value = evaluate(trim(parts[i]));
+            if (strcmp(name, "#d16") == 0) emit_byte(program, (value >> 8) & 0xff);
+            emit_byte(program, value & 0xff);
+        }
+    } else {
+        asm_error("unknown directive '%s'", name);
+    }
+}
+
+static void parse_instruction(struct Program* program, char* line) {
+    char* mnemonic = line;
+    char* rest = line;
+    while ((*rest != '\0') && !isspace(*rest)) rest++;
+    if (*rest != '\0') *rest++ = '\0';
+
+    struct Instruction instruction = {0};
+    instruction.opcode = OP_COUNT;
+    for (int i = 0; i < OP_COUNT; i++) {
+        if (strcmp(mnemonic, opcode_names[i]) == 0) instruction.opcode = i;
+    }
+    if (instruction.opcode == OP_COUNT) asm_error("unknown instruction '%s'", mnemonic);
+
+    char* parts[2];
+    instruction.operand_count = split_operands(rest, parts, 2);
+    for (int i = 0; i < instruction.operand_count; i++) parse_operand(parts[i], &instruction.operands[i]);
+
+    instruction.address = address;
+    instruction.size = check_instruction(&instruction);
+    instruction.line = current_line;
+
+    if (pass == 2) {
+        for (int i = 0; i < instruction.operand_count; i++) {
+            struct Operand* operand = &instruction.operands[i];
+            if ((operand->kind == OPERAND_IMMEDIATE) || (operand->kind == OPERAND_STACK_OFFSET)) {
+                operand->value = evaluate(operand->expression);
+            }
+            if (operand->kind == OPERAND_IMMEDIATE) {
+                if (is_branch(instruction.opcode) || (register_size(instruction.operands[0].reg) == 2)) operand->value &= 0xffff;
+                else operand->value &= 0xff;
+            }
+        }
+
+        instruction.cycles = instruction_cycles(&instruction);
+
+        program->instructions[program->instruction_count] = instruction;
+        program->instruction_at[address & 0xffff] = program->instruction_count;
+    }
+    program->instruction_count++;
+
+    address += instruction.size;
+}
+
+static void parse_line(struct Program* program, char* line) {
+    // Strip comment
+    int in_quotes = 0;
+    for (char* p = line; *p != '\0'; p++) {
+        if ((*p == '\"') && ((p == line) || (p[-1] != '\\'))) in_quotes = !in_quotes;
+        if (!in_quotes && (*p == ';')) {
+            *p = '\0';
+            break;
+        }
+    }
+
+    line = trim(line);
+    if (*line == '\0') return;
+
+    // Label, may be followed by more on the same line
+    char* colon = strchr(line, ':');
+    if ((colon != NULL) && (line[0] != '#')) {
+        int is_label = 1;
+        for (char* p = line; p < colon; p++) {
+            if (!(isalnum(*p) || (*p == '_') || (*p == '.'))) is_label = 0;
+        }
+        if (is_label) {
+            *colon = '\0';
+            define_label(line);
+            line = trim(colon+1);
+            if (*line == '\0') return;
+        }
+    }
+
+    if (line[0] == '#') parse_directive(program, line);
+    else parse_instruction(program, line);
+}
+
+static void run_pass(struct Program* program, FILE* fp) {
+    char buffer[1024];
+
+    address = 0;
+    current_line = 0;
+    global_label[0] = '\0';
+    fseek(fp, 0, SEEK_SET);
+
+    while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+        current_line++;
+        parse_line(program, buffer);
+    }
+}
+
+struct Program* assemble(char* filename) {
+    current_filename = filename;
+
+    FILE* fp = fopen(filename, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "error: unable to open file '%s'\n", filename);
+        exit(255);
+    }
+
+    struct Program* program = calloc(1, sizeof(struct Program));
+    for (int i = 0; i < MEMORY_SIZE; i++) program->instruction_at[i] = -1;
+
+    // First pass finds label addresses, second resolves operands
+    pass = 1;
+    run_pass(program, fp);
+
+    program->instructions = calloc(program->instruction_count, sizeof(struct Instruction));
+    program->instruction_count = 0;
+
+    pass = 2;
+    run_pass(program, fp);
+
+    fclose(fp);
+
+    struct Label* start = find_label("_start");
+    if (start == NULL) {
+        fprintf(stderr, "%s: error: no '_start' label\n", filename);
+        exit(255);
+    }
+    program->entry = start->address;
+
+    return program;
+}
@@ -0,0 +1,49 @@
+#ifndef _ASSEMBLER_H
+#define _ASSEMBLER_H
+
+#define MEMORY_SIZE 0x10000
+
+enum Opcode {OP_MOV, OP_PUSH, OP_POP, OP_ADD, OP_SUB, OP_AND, OP_OR, OP_CMP, OP_INC, OP_DEC, OP_ROL, OP_LDE, OP_LDC, OP_JMP, OP_JE, OP_JNE, OP_JC, OP_JNC, OP_CALL, OP_RET, OP_ADD16, OP_SUB16, OP_COUNT};
+
+enum OperandKind {OPERAND_NONE, OPERAND_REGISTER, OPERAND_INDIRECT, OPERAND_STACK_OFFSET, OPERAND_IMMEDIATE};
+
+enum {R_A, R_B, R_C, R_D, R_E, R_BC, R_DE, R_SP};
+
+struct Operand {
+    enum OperandKind kind;
+    int reg;
+    int value;
+    char* expression;
+};
+
+struct Instruction {
+    enum Opcode opcode;
+    struct Operand operands[2];
+    int operand_count;
+
+    int address;
+    int size;
+    int cycles;
+
+    char* text;
+    int line;
+};
+
+struct Program {
+    unsigned char memory[MEMORY_SIZE];
+
+    struct Instruction* instructions;
+    int instruction_count;
+
+    // Index into instructions for every address an instruction starts at, -1 otherwise
+    int instruction_at[MEMORY_SIZE];
+
+    int entry;
+};
+
+extern char* opcode_names[];
+
+int register_size(int);
+struct Program* assemble(char*);
+
+#endif
@@ -0,0 +1,279 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "cpu.h"
+
+// Executes an assembled program.
+//
+// Flag behaviour is the one the code generator relies on:
+//   add  carry set on unsigned overflow
+//   sub  carry set when no borrow, a >= operand
+//   cmp  zero set when a == operand, carry set when a > operand
+//   inc  carry set when the register wraps to zero
+//   dec  carry set when no borrow, register was not zero
+//   rol  rotate a left, carry gets the bit rotated out
+// and/or only update zero. lde and ldc load the zero and carry flag into a.
+// Multi-byte values are big-endian and the stack grows down from the top of
+// memory. Returning from the outermost call halts with a as the exit code.
+
+#define STACK_TOP 0x10000
+
+static struct Program* program;
+static struct Cpu* cpu;
+
+static void fault(struct Instruction* instruction, const char* message) {
+    if (instruction != NULL) fprintf(stderr, "line %d: %s: %s\n", instruction->line, opcode_names[instruction->opcode], message);
+    else fprintf(stderr, "pc 0x%04x: %s\n", cpu->pc, message);
+    exit(255);
+}
+
+static int read_byte(int address) {
+    address &= 0xffff;
+    if (address == TERMINAL_ADDRESS) {
+        fflush(stdout);
+        int c = getchar();
+        return (c == EOF) ? 0 : (c & 0xff);
+    }
+    return program->memory[address];
+}
+
+static void write_byte(int address, int value) {
+    address &= 0xffff;
+    if (address == TERMINAL_ADDRESS) {
+        putchar(value & 0xff);
+        return;
+    }
+    program->memory[address] = value & 0xff;
+}
+
+static int read_value(int address, int size) {
+    if (size == 2) return (read_byte(address) << 8) | read_byte(address+1);
+    return read_byte(address);
+}
+
+static void write_value(int address, int size, int value) {
+    if (size == 2) {
+        write_byte(address, value >> 8);
+        write_byte(address+1, value);
+    } else {
+        write_byte(address, value);
+    }
+}
+
+static int get_register(int reg) {
+    switch (reg) {
+        case R_A: return cpu->a;
+        case R_B: return cpu->b;
+        case R_C: return cpu->c;
+        case R_D: return cpu->d;
+        case R_E: return cpu->e;
+        case R_BC: return (cpu->b << 8) | cpu->c;
+        case R_DE: return (cpu->d << 8) | cpu->e;
+        case R_SP: return cpu->sp & 0xffff;
+    }
+    return 0;
+}
+
+static void set_register(int reg, int value) {
+    switch (reg) {
+        case R_A: cpu->a = value; break;
+        case R_B: cpu->b = value; break;
+        case R_C: cpu->c = value; break;
+        case R_D: cpu->d = value; break;
+        case R_E: cpu->e = value; break;
+        case R_BC: cpu->b = value >> 8; cpu->c = value; break;
+        case R_DE: cpu->d = value >> 8; cpu->e = value; break;
+    }
+}
+
+static void push(int size, int value) {
+    cpu->sp -= size;
+    if (cpu->sp < 0) fault(NULL, "stack overflow");
+    write_value(cpu->sp, size, value);
+
+    int depth = STACK_TOP - cpu->sp;
+    if (depth > cpu->statistics.peak_stack) cpu->statistics.peak_stack = depth;
+}
+
+static int pop(int size) {
+    if (cpu->sp + size > STACK_TOP) fault(NULL, "stack underflow");
+    int value = read_value(cpu->sp, size);
+    cpu->sp += size;
+    return value;
+}
+
+static int operand_value(struct Operand* operand) {
+    if (operand->kind == OPERAND_REGISTER) return get_register(operand->reg);
+    return operand->value;
+}
+
+static void execute_mov(struct Instruction* instruction) {
+    struct Operand* left = &instruction->operands[0];
+    struct Operand* right = &instruction->operands[1];
+
+    if (left->kind == OPERAND_INDIRECT) {
+        write_value(get_register(left->reg), register_size(right->reg), get_register(right->reg));
+    } else if (right->kind == OPERAND_INDIRECT) {
+        set_register(left->reg, read_value(get_register(right->reg), register_size(left->reg)));
+    } else if (right->kind == OPERAND_STACK_OFFSET) {
+        int value = cpu->sp + right->value;
+        if (left->reg == R_SP) {
+            if ((value < 0) || (value > STACK_TOP)) fault(instruction, "stack pointer out of range");
+            cpu->sp = value;
+            int depth = STACK_TOP - cpu->sp;
+            if (depth > cpu->statistics.peak_stack) cpu->statistics.peak_stack = depth;
+        } else {
+            set_register(left->reg, value & 0xffff);
+        }
+    } else {
+        set_register(left->reg, operand_value(right));
+    }
+}
+
+// Returns non-zero when the program has halted
+static int step(struct Instruction* instruction) {
+    struct Operand* left = &instruction->operands[0];
+    int next_pc = instruction->address + instruction->size;
+    int value;
+    int size;
+
+    switch (instruction->opcode) {
+        case OP_MOV:
+            execute_mov(instruction);
+            break;
+        case OP_PUSH:
+            push(register_size(left->reg), get_register(left->reg));
+            break;
+        case OP_POP:
+            set_register(left->reg, pop(register_size(left->reg)));
+            break;
+        case OP_ADD:
+            value = cpu->a + operand_value(left);
+            cpu->carry = value > 0xff;
+            cpu->a = value;
+            cpu->zero = cpu->a == 0;
+            break;
+        case OP_SUB:
+            value = operand_value(left);
+            cpu->carry = cpu->a >= value;
+            cpu->a = cpu->a - value;
+            cpu->zero = cpu->a == 0;
+            break;
+        case OP_AND:
+            cpu->a &= operand_value(left);
+            cpu->zero = cpu->a == 0;
+            break;
+        case OP_OR:
+            cpu->a |= operand_value(left);
+            cpu->zero = cpu->a == 0;
+            break;
+        case OP_CMP:
+            value = operand_value(left);
+            cpu->zero = cpu->a == value;
+            cpu->carry = cpu->a > value;
+            break;
+        case OP_INC:
+            size = register_size(left->reg);
+            value = (get_register(left->reg) + 1) & ((size == 2) ? 0xffff : 0xff);
+            set_register(left->reg, value);
+            cpu->carry = value == 0;
+            cpu->zero = value == 0;
+            break;
+        case OP_DEC:
+            size = register_size(left->reg);
+            value = get_register(left->reg);
+            cpu->carry = value != 0;
+            value = (value - 1) & ((size == 2) ? 0xffff : 0xff);
+            set_register(left->reg, value);
+            cpu->zero = value == 0;
+            break;
+        case OP_ROL:
+            cpu->carry = (cpu->a >> 7) & 1;
+            cpu->a = (cpu->a << 1) | cpu->carry;
+            cpu->zero = cpu->a == 0;
+            break;
+        case OP_LDE:
+            cpu->a = cpu->zero;
+            break;
+        case OP_LDC:
+            cpu->a = cpu->carry;
+            break;
+        case OP_JMP:
+            next_pc = left->value;
+            break;
+        case OP_JE:
+            if (cpu->zero) next_pc = left->value;
+            break;
+        case OP_JNE:
+            if (!cpu->zero) next_pc = left->value;
+            break;
+        case OP_JC:
+            if (cpu->carry) next_pc = left->value;
+            break;
+        case OP_JNC:
+            if (!cpu->carry) next_pc = left->value;
+            break;
+        case OP_CALL:
+            push(2, next_pc);
+            next_pc = left->value;
+            break;
+        case OP_RET:
+            if (cpu->sp == STACK_TOP) return 1;
+            next_pc = pop(2);
+            break;
+        case OP_ADD16:
+            value = get_register(left->reg) + get_register(instruction->operands[1].reg);
+            cpu->carry = value > 0xffff;
+            set_register(left->reg, value & 0xffff);
+            cpu->zero = (value & 0xffff) == 0;
+            break;
+        case OP_SUB16:
+            value = get_register(instruction->operands[1].reg);
+            cpu->carry = get_register(left->reg) >= value;
+            value = (get_register(left->reg) - value) & 0xffff;
+            set_register(left->reg, value);
+            cpu->zero = value == 0;
+            break;
+        default:
+            fault(instruction, "not implemented");
+    }
+
+    cpu->pc = next_pc & 0xffff;
+    return 0;
+}
+
+int run(struct Program* _program, struct Cpu* _cpu, long max_cycles, int trace) {
+    program = _program;
+    cpu = _cpu;
+
+    cpu->sp = STACK_TOP;
+    cpu->pc = program->entry;
+
+    while (1) {
+        int index = program->instruction_at[cpu->pc];
+        if (index < 0) fault(NULL, "no instruction at address");
+
+        struct Instruction* instruction = &program->instructions[index];
+
+        if (trace) {
+            fprintf(stderr, "%04x  a=%02x b=%02x c=%02x d=%02x e=%02x sp=%04x z=%d c=%d  %-5s line %d\n",
+                cpu->pc, cpu->a, cpu->b, cpu->c, cpu->d, cpu->e, cpu->sp & 0xffff, cpu->zero, cpu->carry,
+                opcode_names[instruction->opcode], instruction->line);
+        }
+
+        struct Statistics* statistics = &cpu->statistics;
+        statistics->cycles += instruction->cycles;
+        statistics->instructions++;
+        statistics->opcode_count[instruction->opcode]++;
+        statistics->opcode_cycles[instruction->opcode] += instruction->cycles;
+
+        if (step(instruction)) break;
+
+        if ((max_cycles > 0) && (statistics->cycles > max_cycles)) {
+            fprintf(stderr, "cycle limit of %ld exceeded\n", max_cycles);
+            return 255;
+        }
+    }
+
+    fflush(stdout);
+    return cpu->a;
+}
@@ -0,0 +1,28 @@
+#ifndef _CPU_H
+#define _CPU_H
+
+#include "assembler.h"
+
+#define TERMINAL_ADDRESS 0x7000
+
+struct Statistics {
+    long cycles;
+    long instructions;
+    int peak_stack;
+    long opcode_count[OP_COUNT];
+    long opcode_cycles[OP_COUNT];
+};
+
+struct Cpu {
+    unsigned char a, b, c, d, e;
+    int sp;
+    int pc;
+    int zero;
+    int carry;
+
+    struct Statistics statistics;
+};
+
+int run(struct Program*, struct Cpu*, long, int);
+
+#endif
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "assembler.h"
+#include "cpu.h"
+
+static void print_statistics(struct Statistics* statistics) {
+    fprintf(stderr, "cycles: %ld\n", statistics->cycles);
+    fprintf(stderr, "instructions: %ld\n", statistics->instructions);
+    fprintf(stderr, "peak stack: %d\n", statistics->peak_stack);
+    fprintf(stderr, "%-8s %12s %12s\n", "opcode", "count", "cycles");
+    for (int i = 0; i < OP_COUNT; i++) {
+        if (statistics->opcode_count[i] == 0) continue;
+        fprintf(stderr, "%-8s %12ld %12ld\n", opcode_names[i], statistics->opcode_count[i], statistics->opcode_cycles[i]);
+    }
+}
+
+int main(int argc, char **argv) {
+    char* input_filename = NULL;
+    int show_statistics = 0;
+    int trace = 0;
+    long max_cycles = 100000000;
+
+    // Process arguments
+    int i = 1;
+    while (i < argc) {
+        if (strcmp(argv[i], "-s") == 0) {
+            show_statistics = 1;
+            i += 1;
+        } else if (strcmp(argv[i], "-t") == 0) {
+            trace = 1;
+            i += 1;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            if (argc <= (i+1)) {
+                fprintf(stderr, "error: flag given with no value\n");
+                return 255;
+            }
+            max_cycles = strtol(argv[i+1], NULL, 0);
+            i += 2;
+        } else {
+            if (input_filename != NULL) {
+                fprintf(stderr, "error: more than one input file supplied\n");
+                return 255;
+            }
+            input_filename = argv[i];
+            i += 1;
+        }
+    }
+
+    if (input_filename == NULL) {
+        fprintf(stderr, "usage: qsim [-s] [-t] [-c max_cycles] program.asm\n");
+        return 255;
+    }
+
+    struct Program* program = assemble(input_filename);
+
+    struct Cpu cpu = {0};
+    int exit_code = run(program, &cpu, max_cycles, trace);
+
+    if (show_statistics) print_statistics(&cpu.statistics);
+
+    return exit_code;
+}
@@ -0,0 +1,51 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "depend.h"
+#include "lexer.h"
+#include "messages.h"
+#include "list.h"
+
+// Make rule listing the input and every file it includes
+
+static void print_escaped(FILE* fp, char* filename) {
+    for (char* p = filename; *p != '\0'; p++) {
+        if (*p == ' ') fprintf(fp, "\\ ");
+        else if (*p == '$') fprintf(fp, "$$");
+        else fprintf(fp, "%c", *p);
+    }
+}
+
+// Writes to stdout when no filename given
+// Phony targets stop make failing when an include is removed
+void write_dependencies(char* filename, char* target, char* input_filename, int phony_targets) {
+    FILE* fp = stdout;
+    if (filename != NULL) {
+        fp = fopen(filename, "w");
+        if (!fp) error(NULL, "unable to create dependency file '%s'", filename);
+    }
+
+    print_escaped(fp, target);
+    fprintf(fp, ": ");
+    print_escaped(fp, input_filename);
+
+    struct List* included_files = get_included_files();
+    if (included_files != NULL) {
+        struct List* current_entry = included_files;
+        do {
+            fprintf(fp, " \\\n  ");
+            print_escaped(fp, (char*)current_entry->value);
+        } while (list_next(&current_entry));
+    }
+    fprintf(fp, "\n");
+
+    if (phony_targets && (included_files != NULL)) {
+        struct List* current_entry = included_files;
+        do {
+            fprintf(fp, "\n");
+            print_escaped(fp, (char*)current_entry->value);
+            fprintf(fp, ":\n");
+        } while (list_next(&current_entry));
+    }
+
+    if (filename != NULL) fclose(fp);
+}
@@ -0,0 +1,6 @@
+#ifndef _DEPEND_H
+#define _DEPEND_H
+
+void write_dependencies(char*, char*, char*, int);
+
+#endif
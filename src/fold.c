@@ -0,0 +1,342 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "fold.h"
+#include "lexer.h"
+#include "parser.h"
+#include "remarks.h"
+#include "type.h"
+
+// Evaluates constant subtrees at compile time, reassociates constants within
+// chains of the same operator, removes identity operations and turns
+// multiplying and dividing by powers of two into shifts and masks.
+// Values wrap exactly like the generated 8 and 16-bit code would.
+
+#define MAX_TERMS 64
+
+struct Term {
+    struct Node* node;
+    int negative;
+};
+
+static int changes;
+
+static int is_arithmetic(struct Type* type) {
+    return (type->kind == TY_CHAR) || (type->kind == TY_INT);
+}
+
+static int is_number(struct Node* node) {
+    return (node->kind == N_NUMBER) && is_arithmetic(node->type);
+}
+
+static int is_comparison(enum TokenKind kind) {
+    return (kind == TK_MORE) || (kind == TK_LESS) || (kind == TK_MORE_EQUAL) || (kind == TK_LESS_EQUAL) || (kind == TK_EQUAL) || (kind == TK_NOT_EQUAL);
+}
+
+static int type_mask(struct Type* type) {
+    return (type->size == 2) ? 0xffff : 0xff;
+}
+
+// Whether a node can be dropped without losing a side effect,
+// dereferences count as side effects as they may read a device
+int is_pure(struct Node* node) {
+    switch (node->kind) {
+        case N_NUMBER:
+        case N_STRING:
+        case N_VARIABLE:
+            return 1;
+        case N_BINOP:
+            return is_pure(node->BinOp.left) && is_pure(node->BinOp.right);
+        case N_UNARY:
+            if (node->token->kind == TK_ASTERISK) return 0;
+            return is_pure(node->UnaryOp.left);
+        default:
+            return 0;
+    }
+}
+
+static struct Node* new_number(struct Node* original, int value, struct Type* type) {
+    char buffer[8];
+    sprintf(buffer, "%d", value);
+
+    struct Node* node = calloc(1, sizeof(struct Node));
+    node->token = duplicate_token(original->token);
+    node->token->kind = TK_NUMBER;
+    node->token->value = strdup(buffer);
+    node->kind = N_NUMBER;
+    node->type = type;
+    node->scope = original->scope;
+    node->constant = 1;
+    return node;
+}
+
+static struct Node* new_bin_op(struct Node* original, enum TokenKind kind, struct Node* left, struct Node* right) {
+    char* names[] = {[TK_PLUS]="+", [TK_MINUS]="-", [TK_AMPERSAND]="&", [TK_BAR]="|", [TK_LSHIFT]="<<", [TK_RSHIFT]=">>", [TK_PERCENT]="%"};
+
+    struct Node* node = calloc(1, sizeof(struct Node));
+    node->token = duplicate_token(original->token);
+    node->token->kind = kind;
+    node->token->value = names[kind];
+    node->kind = N_BINOP;
+    node->type = original->type;
+    node->scope = original->scope;
+    node->BinOp.left = left;
+    node->BinOp.right = right;
+    node->constant = left->constant && right->constant;
+    return node;
+}
+
+// Returns zero if the operation can't be evaluated at compile time
+static int evaluate(enum TokenKind kind, int left, int right, struct Type* type, int* result) {
+    int mask = type_mask(type);
+    int bits = type->size * 8;
+    left &= mask;
+    right &= mask;
+
+    switch (kind) {
+        case TK_PLUS: *result = left + right; break;
+        case TK_MINUS: *result = left - right; break;
+        case TK_ASTERISK: *result = left * right; break;
+        case TK_DIV:
+            if (right == 0) return 0;
+            *result = left / right;
+            break;
+        case TK_PERCENT:
+            if (right == 0) return 0;
+            *result = left % right;
+            break;
+        case TK_AMPERSAND: *result = left & right; break;
+        case TK_BAR: *result = left | right; break;
+        case TK_LSHIFT: *result = (right >= bits) ? 0 : left << right; break;
+        case TK_RSHIFT: *result = (right >= bits) ? 0 : left >> right; break;
+        case TK_MORE: *result = left > right; break;
+        case TK_LESS: *result = left < right; break;
+        case TK_MORE_EQUAL: *result = left >= right; break;
+        case TK_LESS_EQUAL: *result = left <= right; break;
+        case TK_EQUAL: *result = left == right; break;
+        case TK_NOT_EQUAL: *result = left != right; break;
+        default: return 0;
+    }
+
+    *result &= mask;
+    return 1;
+}
+
+// Evaluates a comparison with the given operand values, zero if it can't be
+int evaluate_comparison(struct Node* comparison, int left, int right, int* result) {
+    if (!is_comparison(comparison->token->kind)) return 0;
+    return evaluate(comparison->token->kind, left, right, comparison->type, result);
+}
+
+static int chains_with(struct Node* node, struct Node* root) {
+    if ((node->kind != N_BINOP) || (node->type->kind != root->type->kind)) return 0;
+    if ((root->token->kind == TK_PLUS) || (root->token->kind == TK_MINUS)) return (node->token->kind == TK_PLUS) || (node->token->kind == TK_MINUS);
+    return node->token->kind == root->token->kind;
+}
+
+// Flatten a chain of the same operator and type into its terms,
+// anything that isn't part of the chain is kept whole as a term
+static void collect_terms(struct Node* node, struct Node* root, int negative, struct Term* terms, int* count) {
+    if (chains_with(node, root) && (*count < MAX_TERMS - 1)) {
+        collect_terms(node->BinOp.left, root, negative, terms, count);
+        collect_terms(node->BinOp.right, root, negative ^ (node->token->kind == TK_MINUS), terms, count);
+        return;
+    }
+
+    terms[*count].node = node;
+    terms[*count].negative = negative;
+    (*count)++;
+}
+
+static void replace(struct Node** slot, struct Node* node) {
+    *slot = node;
+    changes++;
+}
+
+// Move every constant of a chain to the end and combine them into one,
+// the order of the remaining terms is kept so side effects still happen in order
+static int reassociate(struct Node** slot) {
+    struct Node* node = *slot;
+    enum TokenKind kind = node->token->kind;
+    int additive = (kind == TK_PLUS) || (kind == TK_MINUS);
+    if (!additive && (kind != TK_AMPERSAND) && (kind != TK_BAR)) return 0;
+
+    struct Term terms[MAX_TERMS];
+    int count = 0;
+    collect_terms(node, node, 0, terms, &count);
+
+    int mask = type_mask(node->type);
+    int value = (kind == TK_AMPERSAND) ? mask : 0;
+    int constant_count = 0;
+    struct Node* first = NULL;
+    int first_negative = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (is_number(terms[i].node)) {
+            int term_value = number_value(terms[i].node);
+            if (additive) value += terms[i].negative ? -term_value : term_value;
+            else if (kind == TK_AMPERSAND) value &= term_value;
+            else value |= term_value;
+            constant_count++;
+        } else if (first == NULL) {
+            first = terms[i].node;
+            first_negative = terms[i].negative;
+        }
+    }
+    value &= mask;
+
+    // Only worth rebuilding if there are constants to combine
+    if ((constant_count < 2) || (first == NULL) || first_negative) return 0;
+
+    struct Node* result = first;
+    int seen_first = 0;
+    for (int i = 0; i < count; i++) {
+        if (is_number(terms[i].node)) continue;
+        if (!seen_first) {
+            seen_first = 1;
+            continue;
+        }
+        enum TokenKind term_kind = additive ? (terms[i].negative ? TK_MINUS : TK_PLUS) : kind;
+        result = new_bin_op(node, term_kind, result, terms[i].node);
+    }
+
+    // Subtracting reads better than adding a wrapped negative
+    if (additive && (value > mask/2)) result = new_bin_op(node, TK_MINUS, result, new_number(node, (-value) & mask, node->type));
+    else result = new_bin_op(node, additive ? TK_PLUS : kind, result, new_number(node, value, node->type));
+
+    remark(RK_PASSED, "fold", "Reassociated", node->token, "combined %d constants in '%s' chain", constant_count, node->token->value);
+    replace(slot, result);
+    return 1;
+}
+
+// Remove operations that leave their operand unchanged or always give the same value
+static void simplify_identity(struct Node** slot) {
+    struct Node* node = *slot;
+    struct Node* left = node->BinOp.left;
+    struct Node* right = node->BinOp.right;
+    enum TokenKind kind = node->token->kind;
+    int mask = type_mask(node->type);
+    int bits = node->type->size * 8;
+
+    // Replacing a node with an operand must not change its type
+    int left_same = left->type->kind == node->type->kind;
+    int right_same = right->type->kind == node->type->kind;
+
+    struct Node* result = NULL;
+    if (is_number(right)) {
+        int value = number_value(right) & mask;
+        if ((value == 0) && ((kind == TK_PLUS) || (kind == TK_MINUS) || (kind == TK_BAR) || (kind == TK_LSHIFT) || (kind == TK_RSHIFT)) && left_same) result = left;
+        else if ((value == mask) && (kind == TK_AMPERSAND) && left_same) result = left;
+        else if ((value == 1) && ((kind == TK_ASTERISK) || (kind == TK_DIV)) && left_same) result = left;
+        else if ((value == 0) && ((kind == TK_AMPERSAND) || (kind == TK_ASTERISK)) && is_pure(left)) result = new_number(node, 0, node->type);
+        else if ((value == 1) && (kind == TK_PERCENT) && is_pure(left)) result = new_number(node, 0, node->type);
+        else if ((value == mask) && (kind == TK_BAR) && is_pure(left)) result = new_number(node, mask, node->type);
+        else if ((value >= bits) && ((kind == TK_LSHIFT) || (kind == TK_RSHIFT)) && is_pure(left)) result = new_number(node, 0, node->type);
+    }
+    if ((result == NULL) && is_number(left)) {
+        int value = number_value(left) & mask;
+        if ((value == 0) && ((kind == TK_PLUS) || (kind == TK_BAR)) && right_same) result = right;
+        else if ((value == mask) && (kind == TK_AMPERSAND) && right_same) result = right;
+        else if ((value == 1) && (kind == TK_ASTERISK) && right_same) result = right;
+        else if ((value == 0) && ((kind == TK_AMPERSAND) || (kind == TK_ASTERISK) || (kind == TK_LSHIFT) || (kind == TK_RSHIFT)) && is_pure(right)) result = new_number(node, 0, node->type);
+        else if ((value == mask) && (kind == TK_BAR) && is_pure(right)) result = new_number(node, mask, node->type);
+    }
+
+    if (result == NULL) return;
+
+    remark(RK_PASSED, "fold", "IdentityRemoved", node->token, "removed identity operation '%s'", node->token->value);
+    replace(slot, result);
+}
+
+static int power_of_two(int value) {
+    int power = 0;
+    while ((1 << power) < value) power++;
+    return ((1 << power) == value) ? power : -1;
+}
+
+// Multiplying, dividing and taking the remainder by a power of two become shifts and masks,
+// everything is unsigned so no rounding fixup is needed
+static void reduce_strength(struct Node** slot) {
+    struct Node* node = *slot;
+    struct Node* left = node->BinOp.left;
+    struct Node* right = node->BinOp.right;
+    enum TokenKind kind = node->token->kind;
+    int mask = type_mask(node->type);
+
+    if ((kind != TK_ASTERISK) && (kind != TK_DIV) && (kind != TK_PERCENT)) return;
+
+    // Multiplying commutes so a constant on the left works too
+    if ((kind == TK_ASTERISK) && is_number(left) && !is_number(right)) {
+        left = node->BinOp.right;
+        right = node->BinOp.left;
+    }
+    if (!is_number(right)) return;
+
+    int value = number_value(right) & mask;
+    int power = power_of_two(value);
+    if (power < 1) return;
+
+    struct Node* result;
+    if (kind == TK_ASTERISK) result = new_bin_op(node, TK_LSHIFT, left, new_number(node, power, node->type));
+    else if (kind == TK_DIV) result = new_bin_op(node, TK_RSHIFT, left, new_number(node, power, node->type));
+    else result = new_bin_op(node, TK_AMPERSAND, left, new_number(node, value - 1, node->type));
+
+    remark(RK_PASSED, "fold", "StrengthReduced", node->token, "replaced '%s' by %d with '%s'", node->token->value, value, result->token->value);
+    replace(slot, result);
+}
+
+static void fold_bin_op(struct Node** slot) {
+    struct Node* node = *slot;
+    struct Node* left = node->BinOp.left;
+    struct Node* right = node->BinOp.right;
+
+    node->constant = left->constant && right->constant;
+    if (!is_arithmetic(node->type)) return;
+
+    if (node->constant && is_number(left) && is_number(right)) {
+        int value;
+        if (!evaluate(node->token->kind, number_value(left), number_value(right), node->type, &value)) return;
+
+        // Comparisons only produce 0 or 1, which fits in a byte
+        struct Type* type = is_comparison(node->token->kind) ? &type_char : node->type;
+        remark(RK_PASSED, "fold", "ConstantFolded", node->token, "folded '%s' of constants to %d", node->token->value, value);
+        replace(slot, new_number(node, value, type));
+        return;
+    }
+
+    if (reassociate(slot)) node = *slot;
+    if (node->kind == N_BINOP) simplify_identity(slot);
+    if ((*slot)->kind == N_BINOP) reduce_strength(slot);
+}
+
+static void fold_unary(struct Node** slot) {
+    struct Node* node = *slot;
+    struct Node* left = node->UnaryOp.left;
+
+    if (node->token->kind == TK_PLUS) {
+        replace(slot, left);
+    } else if ((node->token->kind == TK_MINUS) && is_number(left)) {
+        int value = (-number_value(left)) & type_mask(node->type);
+        remark(RK_PASSED, "fold", "ConstantFolded", node->token, "folded '-' of constant to %d", value);
+        replace(slot, new_number(node, value, node->type));
+    } else if ((node->token->kind == TK_MINUS) && (left->kind == N_UNARY) && (left->token->kind == TK_MINUS)) {
+        replace(slot, left->UnaryOp.left);
+    }
+}
+
+static void fold_node(struct Node** slot, void* data) {
+    if ((*slot)->kind == N_FUNC_DECL) set_remark_function((*slot)->token->value);
+
+    // Children first so constants bubble up
+    for_each_child(*slot, fold_node, data);
+
+    if ((*slot)->kind == N_BINOP) fold_bin_op(slot);
+    else if ((*slot)->kind == N_UNARY) fold_unary(slot);
+}
+
+int fold_constants(struct Node* root_node) {
+    changes = 0;
+    fold_node(&root_node, NULL);
+    set_remark_function(NULL);
+    return changes;
+}
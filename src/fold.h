@@ -0,0 +1,10 @@
+#ifndef _FOLD_H
+#define _FOLD_H
+
+struct Node;
+
+int is_pure(struct Node*);
+int evaluate_comparison(struct Node*, int, int, int*);
+int fold_constants(struct Node*);
+
+#endif
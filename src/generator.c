@@ -1,56 +1,269 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
+#include "fold.h"
 #include "generator.h"
+#include "ir.h"
 #include "lexer.h"
+#include "licm.h"
 #include "messages.h"
 #include "parser.h"
+#include "pass.h"
+#include "peephole.h"
 #include "register.h"
+#include "regalloc.h"
+#include "remarks.h"
 #include "scope.h"
+#include "stringpool.h"
 #include "symbol.h"
 #include "type.h"
 #include "list.h"
-#include "target.h"
 
-int local_stack_usage = 0;
+// Every value goes in a virtual register of its own, register allocation decides
+// where they all live once the function is generated
 
-static struct Register* visit(struct Node*, FILE *fp, int);
+// Locals of the function being generated, reserved once on entry
+static int frame_size = 0;
+static char* exit_label = NULL;
+static struct Type* return_type = NULL;
+static char* function_name = NULL;
+static int frame_address_taken = 0;
 
-static void visit_all(struct List* listRoot, FILE *fp, int depth) {
+#define MAX_ARGUMENTS 16
+
+// Arguments go in registers unless assembly written for the stack convention is linked in
+static int arguments_in_registers = 1;
+
+void set_abi(char* name) {
+    if (strcmp(name, "registers") == 0) arguments_in_registers = 1;
+    else if (strcmp(name, "stack") == 0) arguments_in_registers = 0;
+    else error(NULL, "invalid ABI '-mabi=%s'", name);
+}
+
+// Where each parameter of a function is passed, NULL for the stack. Bytes go in a, b then c
+// and words in bc then de, each taking the first whose halves are still unused.
+// Results come back in a or bc either way.
+static int assign_arguments(struct Type* function, struct Register** assigned) {
+    int used[REG_COUNT] = {0};
+    int count = 0;
+
+    for (struct List* entry = function->parameters; entry != NULL; entry = entry->next) {
+        struct Type* type = (struct Type*)entry->value;
+        if (count == MAX_ARGUMENTS) error(NULL, "more than %d parameters", MAX_ARGUMENTS);
+        assigned[count] = NULL;
+
+        int first = (type->size == 1) ? REG_A : REG_BC;
+        int last = (type->size == 1) ? REG_C : REG_DE;
+        for (int i = first; arguments_in_registers && (i <= last); i++) {
+            struct Register* reg = &registers[i];
+            if (used[i] || ((reg->parent_reg != NULL) && used[reg->parent_reg - registers])) continue;
+            if ((reg->high_reg != NULL) && (used[reg->high_reg - registers] || used[reg->low_reg - registers])) continue;
+            used[i] = 1;
+            assigned[count] = reg;
+            break;
+        }
+        count++;
+    }
+    return count;
+}
+
+static struct VirtualRegister* visit(struct Node*, int);
+
+// The statement being visited and the one run just before it, if any
+static struct Node* current_statement = NULL;
+static struct Node* previous_statement = NULL;
+
+// Expressions that are the whole statement, or a declaration's initialization,
+// have their value thrown away so it never has to be put in a register
+static int is_discarded(struct Node* node) {
+    if (node == current_statement) return 1;
+    return (current_statement->kind == N_VAR_DECL) && (node == current_statement->VarDecl.assignment);
+}
+
+static void visit_statement(struct Node* node, struct Node* previous, int depth) {
+    current_statement = node;
+    previous_statement = previous;
+    visit(node, depth);
+}
+
+static void visit_all(struct List* listRoot, int depth) {
     if (listRoot == NULL) return;
     struct List* current_entry = listRoot;
+    struct Node* previous = NULL;
     do {
-        struct Register* reg = visit((struct Node*)current_entry->value, fp, depth);
-        free_reg(reg);   // Free registers that were allocated but never used for anything :(
+        visit_statement((struct Node*)current_entry->value, previous, depth);
+        previous = (struct Node*)current_entry->value;
     } while (list_next(&current_entry));
 }
 
+// Label text that has to outlive the node it came from
+static char* format_label(char* format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    return strdup(buffer);
+}
+
 static void print_indent(int depth) {
     for (int i = 0; i < depth; i++) {
         printf(" ");
     }
 }
 
-static struct Register* get_address(struct Node* node, FILE *fp, int depth) {
-    struct Register* pointer_reg;
+static int is_comparison(struct Node* node) {
+    if (node->kind != N_BINOP) return 0;
+    switch (node->token->kind) {
+        case TK_MORE:
+        case TK_LESS:
+        case TK_MORE_EQUAL:
+        case TK_LESS_EQUAL:
+        case TK_EQUAL:
+        case TK_NOT_EQUAL:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// The comparison that holds with the operands the other way round
+static enum TokenKind mirror_comparison(enum TokenKind kind) {
+    switch (kind) {
+        case TK_MORE: return TK_LESS;
+        case TK_LESS: return TK_MORE;
+        case TK_MORE_EQUAL: return TK_LESS_EQUAL;
+        case TK_LESS_EQUAL: return TK_MORE_EQUAL;
+        default: return kind;
+    }
+}
+
+struct Search {
+    int (*match)(struct Node*);
+    int found;
+};
+
+static void search_node(struct Node** slot, void* data) {
+    struct Search* search = (struct Search*)data;
+    if (search->found) return;
+    if (search->match(*slot)) search->found = 1;
+    else for_each_child(*slot, search_node, data);
+}
+
+static int contains(struct Node* node, int (*match)(struct Node*)) {
+    struct Search search = {.match=match, .found=0};
+    search_node(&node, &search);
+    return search.found;
+}
+
+static int is_side_effect(struct Node* node) {
+    return (node->kind == N_FUNC_CALL) || (node->kind == N_ASSIGNMENT) || (node->kind == N_INC_DEC);
+}
+
+// The address of a local or parameter, which points into the frame
+static int is_frame_address(struct Node* node) {
+    if ((node->kind != N_UNARY) || (node->token->kind != TK_AMPERSAND)) return 0;
+    struct Symbol* symbol = node->UnaryOp.left->Variable.symbol;
+    return !symbol->global && !symbol->is_extern;
+}
+
+static int is_dereference(struct Node* node) {
+    return (node->kind == N_UNARY) && (node->token->kind == TK_ASTERISK);
+}
+
+// Operands can only be evaluated out of order if neither has a side effect,
+// and not both read through a pointer in case it points at a device
+static int can_reorder(struct Node* first, struct Node* second) {
+    if (contains(first, is_side_effect) || contains(second, is_side_effect)) return 0;
+    return !(contains(first, is_dereference) && contains(second, is_dereference));
+}
+
+static int register_need(struct Node* node);
+
+// Register pairs needed to compute the address of an lvalue
+static int address_need(struct Node* node) {
+    if (is_dereference(node)) return register_need(node->UnaryOp.left);
+    if (node->Variable.symbol->reg != NULL) return 0;
+    return 1;
+}
+
+// An operand widened to the type of its operation ends up in a pair however little it needed
+static int operand_need(struct Node* operand, struct Type* type) {
+    int need = register_need(operand);
+    if ((operand->type->size < type->size) && (need == 0)) return 1;
+    return need;
+}
+
+// Sethi-Ullman number, roughly how many of bc/de evaluating a node ties up.
+// 8-bit results go in the accumulator so only pointers and 16-bit values count.
+// Calls save every live register so they never need any on top.
+// Variables promoted to registers only need somewhere to copy 16-bit values.
+static int register_need(struct Node* node) {
+    int left, right, held;
+
+    switch (node->kind) {
+        case N_NUMBER:
+            return (node->type->size == 2) ? 1 : 0;
+        case N_STRING:
+            return 1;
+        case N_VARIABLE:
+            if (node->Variable.symbol->reg != NULL) return (node->type->size == 2) ? 1 : 0;
+            return 1;
+        case N_UNARY:
+            if (node->token->kind == TK_AMPERSAND) return 1;
+            left = register_need(node->UnaryOp.left);
+            if ((node->token->kind == TK_ASTERISK) || (node->token->kind == TK_MINUS)) {
+                held = (node->type->size == 2) ? 2 : 1;
+                return (left > held) ? left : held;
+            }
+            return left;
+        case N_BINOP:
+            left = operand_need(node->BinOp.left, node->type);
+            right = operand_need(node->BinOp.right, node->type);
+            if (left == right) return left + 1;
+            return (left > right) ? left : right;
+        case N_ASSIGNMENT:
+            right = register_need(node->Assignment.right);
+            held = (node->type->size == 2) || is_dereference(node->Assignment.left);
+            left = held + address_need(node->Assignment.left);
+            return (left > right) ? left : right;
+        case N_INC_DEC:
+            held = node->type->size == 2;
+            return held + address_need(node->IncDec.variable);
+        default:
+            return 0;
+    }
+}
+
+// An operand that is only read, a variable in a register is used where it is
+static struct VirtualRegister* visit_operand(struct Node* node, int depth) {
+    if ((node->kind == N_VARIABLE) && (node->Variable.symbol->reg != NULL)) return node->Variable.symbol->reg;
+    return visit(node, depth);
+}
+
+static struct VirtualRegister* get_address(struct Node* node, int depth) {
+    struct VirtualRegister* pointer_reg;
 
     if (node->kind == N_VARIABLE) {
         printf("%-32s", node->type->name);
         print_indent(depth);
         printf("Variable: %s\n", node->Assignment.left->token->value);
 
-        pointer_reg = allocate_reg(2);
+        if (node->Variable.symbol->reg != NULL) error(node->token, "internal error: address of register variable '%s'", node->Variable.symbol->token->value);
+
+        pointer_reg = ir_new_reg(2);
         if (node->Variable.symbol->global || node->Variable.symbol->is_extern) {
-            fprintf(fp, "\tmov %s, %s\n", pointer_reg->name, node->Variable.symbol->token->value);
+            ir_immediate(pointer_reg, node->Variable.symbol->token->value);
         } else {
-            fprintf(fp, "\tmov %s, sp+%d ; %s\n", pointer_reg->name, get_symbol_stack_offset(node->Variable.symbol, node->scope)+local_stack_usage, node->Variable.symbol->token->value);
+            ir_frame_address(pointer_reg, node->Variable.symbol->frame_offset, node->Variable.symbol->token->value);
         }
     } else if ((node->kind == N_UNARY) && (strcmp(node->token->value, "*") == 0)) {
         printf("%-32s", node->type->name);
         print_indent(depth);
         printf("UnaryOp: *\n");
 
-        pointer_reg = visit(node->UnaryOp.left, fp, depth+1);
+        pointer_reg = visit_operand(node->UnaryOp.left, depth+1);
     } else {
         error(node->token, "lvalue required as left operand of assignment");
     }
@@ -58,258 +271,499 @@ static struct Register* get_address(struct Node* node, FILE *fp, int depth) {
     return pointer_reg;
 }
 
-static void visit_program(struct Node* node, FILE *fp, int depth) {
+// A global whose initial value the assembler can write, zero is left to bss
+static int has_static_value(struct Node* node) {
+    if (node->VarDecl.assignment == NULL) return 0;
+    struct Node* value = node->VarDecl.assignment->Assignment.right;
+    return (value->kind == N_STRING) || ((value->kind == N_NUMBER) && (number_value(value) != 0));
+}
+
+static int needs_zero_fill(struct List* global_variables) {
+    for (; global_variables != NULL; global_variables = global_variables->next) {
+        struct Node* node = (struct Node*)global_variables->value;
+        if (!node->VarDecl.symbol->is_extern && !has_static_value(node)) return 1;
+    }
+    return 0;
+}
+
+static void visit_program(struct Node* node, int depth) {
     printf("%-32s", node->type->name);
     print_indent(depth);
     printf("Program:\n");
 
     // Program setup
-    fprintf(fp, "#bank RAM\n\n");
-    fprintf(fp, "#addr 0x8100\n\n");
+    ir_data("#bank RAM\n");
+    ir_data("#addr 0x8100\n");
 
-    fprintf(fp, "_start:\n");
+    ir_begin_function("_start");
+    ir_enter(0);
+    ir_reserve(0);
 
-    // Initialise global variables
-    visit_all(node->Program.global_variables, fp, depth+1);
+    // Globals without a value of their own start as zero, then any initializer
+    // the assembler can't write runs
+    ir_section(SECTION_BSS);
+    ir_label("bss_start", -1);
+    ir_section(SECTION_CODE);
+    if (needs_zero_fill(node->Program.global_variables)) ir_zero_fill("bss_start");
+    visit_all(node->Program.global_variables, depth+1);
 
     // Call main
-    fprintf(fp, "\tcall main\n");
-    fprintf(fp, "\tret\n\n");
+    ir_call("main", 0, NULL, -1);
+    ir_release(0);
+    ir_return(0);
+    allocate_registers(ir_end_function());
+    ir_data("");
 
     // Generate code for all functions
-    visit_all(node->Program.function_declarations, fp, depth+1);
+    if (pass_enabled("licm")) find_private_globals(node);
+    visit_all(node->Program.function_declarations, depth+1);
+    set_remark_function(NULL);
+
+    // Then whichever runtime routines they call
+    ir_routines();
+
+    ir_section(SECTION_RODATA);
+    emit_string_pool();
 
     // Label address at end of program, heap starts here
-    fprintf(fp, "heap_start:\n\n");
+    ir_section(SECTION_BSS);
+    ir_label("heap_start", -1);
+    ir_data("");
+    ir_section(SECTION_CODE);
 }
 
-static void visit_var_decl(struct Node* node, FILE *fp, int depth) {
+static void visit_var_decl(struct Node* node, int depth) {
     printf("%-32s", node->type->name);
     print_indent(depth);
     printf("Variable declaration: %s\n", node->VarDecl.symbol->token->value);
-    
+
+    struct Symbol* symbol = node->VarDecl.symbol;
+    if (symbol->global && !symbol->is_extern && has_static_value(node)) {
+        struct Node* value = node->VarDecl.assignment->Assignment.right;
+        ir_section(SECTION_DATA);
+        ir_label(node->token->value, -1);
+        if (value->kind == N_STRING) ir_data("\t#d16 %s", pool_string(value->token));
+        else ir_data("\t#d%d %d", node->type->size * 8, number_value(value) & ((node->type->size == 2) ? 0xffff : 0xff));
+        ir_section(SECTION_CODE);
+        return;
+    }
+
     if (node->VarDecl.assignment != NULL) {
-        free_reg(visit(node->VarDecl.assignment, fp, depth+1));
+        struct Node* value = node->VarDecl.assignment->Assignment.right;
+        int zero = (value->kind == N_NUMBER) && (number_value(value) == 0);
+        if (symbol->global && !zero) remark(RK_MISSED, "globals", "StartupInit", node->token, "'%s' initialized at startup as its value isn't a plain constant", node->token->value);
+        if (!symbol->global || !zero) visit(node->VarDecl.assignment, depth+1);
     }
 
-    struct Symbol* symbol = node->VarDecl.symbol;
     if (symbol->global && !symbol->is_extern) {
-        // TODO this is a nasty hack, space reservations should go at end of file
-        fprintf(fp, "\tjmp $+%d+3\n", node->type->size);
-        fprintf(fp, "%s:\n", node->token->value);
-        fprintf(fp, "\t#res %d\n", node->type->size);
+        ir_section(SECTION_BSS);
+        ir_label(node->token->value, -1);
+        ir_data("\t#res %d", node->type->size);
+        ir_section(SECTION_CODE);
     }
 }
 
-// TODO need to preserve registers
-static void visit_func_decl(struct Node* node, FILE *fp, int depth) {
+struct FrameLayout {
+    int used;
+    int size;
+    int place;
+};
+
+// Nested blocks go below the one they are in and blocks side by side share space,
+// so the frame is as big as the deepest nesting needs. Variables in registers take none.
+static void layout_block(struct Node** slot, void* data) {
+    struct Node* node = *slot;
+    struct FrameLayout* layout = data;
+    int used = layout->used;
+
+    if (node->kind == N_BLOCK) {
+        for (struct List* entry = node->scope->symbol_list; entry != NULL; entry = entry->next) {
+            struct Symbol* symbol = (struct Symbol*)entry->value;
+            if (symbol->is_extern || (symbol->reg != NULL)) continue;
+            layout->used += symbol->type->size;
+            if (layout->place) symbol->frame_offset = layout->size - layout->used;
+        }
+        if (layout->used > layout->size) layout->size = layout->used;
+    }
+
+    for_each_child(node, layout_block, data);
+    layout->used = used;
+}
+
+// Sets where every parameter and local is relative to sp once the frame is reserved.
+// Parameters passed in registers but not kept in one are pushed on entry and sit at the
+// top of the frame, parameters passed on the stack are above it past the return address.
+static int layout_frame(struct Node* node, struct Register** assigned, int* pushed) {
+    struct FrameLayout layout = {0};
+    struct List* entry;
+    int i;
+
+    for (entry = node->FunctionDecl.formal_parameters, i = 0; entry != NULL; entry = entry->next, i++) {
+        struct Symbol* symbol = ((struct Node*)entry->value)->VarDecl.symbol;
+        if ((assigned[i] != NULL) && (symbol->reg == NULL)) layout.used += symbol->type->size;
+    }
+    *pushed = layout.used;
+    layout.size = layout.used;
+
+    layout_block(&node->FunctionDecl.block, &layout);
+    layout.used = *pushed;
+    layout.place = 1;
+    layout_block(&node->FunctionDecl.block, &layout);
+
+    int used = 0;
+    int above = 0;
+    for (entry = node->FunctionDecl.formal_parameters, i = 0; entry != NULL; entry = entry->next, i++) {
+        struct Symbol* symbol = ((struct Node*)entry->value)->VarDecl.symbol;
+        if (assigned[i] == NULL) above += symbol->type->size;
+        else if (symbol->reg == NULL) {
+            used += symbol->type->size;
+            symbol->frame_offset = layout.size - used;
+        }
+    }
+
+    // The last parameter pushed is nearest the return address
+    for (entry = node->FunctionDecl.formal_parameters, i = 0; entry != NULL; entry = entry->next, i++) {
+        struct Symbol* symbol = ((struct Node*)entry->value)->VarDecl.symbol;
+        if (assigned[i] != NULL) continue;
+        above -= symbol->type->size;
+        symbol->frame_offset = layout.size + 2 + above;
+    }
+
+    return layout.size;
+}
+
+static void visit_func_decl(struct Node* node, int depth) {
     printf("%-32s", node->type->name);
     print_indent(depth);
     printf("Function declaration: %s %s\n", node->type->name, node->token->value);
 
-    fprintf(fp, "%s:\n", node->token->value);
+    ir_begin_function(node->token->value);
+    set_remark_function(node->token->value);
+
+    if (pass_enabled("regalloc")) promote_variables(node);
+
+    struct Register* assigned[MAX_ARGUMENTS];
+    assign_arguments(node->type, assigned);
 
-    visit_all(node->FunctionDecl.formal_parameters, fp, depth+1);
-    free_reg(visit(node->FunctionDecl.block, fp, depth+1));
+    // One frame for every block, functions without locals on the stack have none
+    int pushed;
+    frame_size = layout_frame(node, assigned, &pushed);
+    exit_label = format_label(".%s_exit", node->token->value);
+    return_type = node->type->base;
+    function_name = node->token->value;
+    frame_address_taken = contains(node->FunctionDecl.block, is_frame_address);
 
-    fprintf(fp, ".%s_exit:\n", node->token->value);
-    fprintf(fp, "\tret\n\n");
+    visit_all(node->FunctionDecl.formal_parameters, depth+1);
+
+    struct List* entry;
+    int i;
+    int arguments = 0;
+    for (entry = node->FunctionDecl.formal_parameters, i = 0; entry != NULL; entry = entry->next, i++) {
+        if (assigned[i] != NULL) arguments |= 1 << (assigned[i] - registers);
+    }
+    ir_enter(arguments);
+
+    // Register parameters are pushed into the frame or copied to the register they are kept in,
+    // then the rest are loaded from where the caller pushed them
+    for (entry = node->FunctionDecl.formal_parameters, i = 0; entry != NULL; entry = entry->next, i++) {
+        struct Symbol* symbol = ((struct Node*)entry->value)->VarDecl.symbol;
+        if ((assigned[i] != NULL) && (symbol->reg == NULL)) ir_push(ir_fixed_reg(assigned[i] - registers));
+    }
+    ir_reserve(frame_size - pushed);
+
+    for (entry = node->FunctionDecl.formal_parameters, i = 0; entry != NULL; entry = entry->next, i++) {
+        struct Symbol* symbol = ((struct Node*)entry->value)->VarDecl.symbol;
+        if ((assigned[i] != NULL) && (symbol->reg != NULL)) ir_move(symbol->reg, ir_fixed_reg(assigned[i] - registers));
+    }
+
+    for (entry = node->FunctionDecl.formal_parameters, i = 0; entry != NULL; entry = entry->next, i++) {
+        struct Symbol* symbol = ((struct Node*)entry->value)->VarDecl.symbol;
+        if ((assigned[i] != NULL) || (symbol->reg == NULL)) continue;
+
+        struct VirtualRegister* pointer_reg = ir_new_reg(2);
+        ir_frame_address(pointer_reg, symbol->frame_offset, symbol->token->value);
+        ir_load(symbol->reg, pointer_reg);
+    }
+
+    visit(node->FunctionDecl.block, depth+1);
+
+    // Every return with a frame to free comes through here
+    ir_label(exit_label, -1);
+    ir_release(frame_size);
+    ir_return(0);
+
+    struct Function* function = ir_end_function();
+    if (pass_enabled("licm")) move_loop_invariants(function);
+    allocate_registers(function);
+    ir_data("");
 }
 
-static void visit_block(struct Node* node, FILE *fp, int depth) {
+static void visit_block(struct Node* node, int depth) {
     printf("%-32s", node->type->name);
     print_indent(depth);
     printf("Block:\n");
 
-    // Allocate stack space
-    if (node->scope->stack_size != 0) fprintf(fp, "\tmov sp, sp-%d\n", node->scope->stack_size);
-
-    visit_all(node->Block.statements, fp, depth+1);
-
-    // Deallocate
-    if (node->scope->stack_size != 0) fprintf(fp, "\tmov sp, sp+%d\n", node->scope->stack_size);
+    // Stack space is part of the function's frame
+    visit_all(node->Block.statements, depth+1);
 }
 
-static struct Register* visit_number(struct Node* node, FILE *fp, int depth) {
+static struct VirtualRegister* visit_number(struct Node* node, int depth) {
     printf("%-32s", node->type->name);
     print_indent(depth);
     printf("Number: %s\n", node->token->value);
 
-    struct Register* reg = allocate_reg(node->type->size);
-    fprintf(fp, "\tmov %s, %s\n", reg->name, node->token->value);
+    struct VirtualRegister* reg = ir_new_reg(node->type->size);
+    ir_immediate(reg, node->token->value);
     return reg;
 }
 
-static struct Register* visit_string(struct Node* node, FILE *fp, int depth) {
+static struct VirtualRegister* visit_string(struct Node* node, int depth) {
     printf("%-32s", node->type->name);
     print_indent(depth);
     printf("String: %s\n", node->token->value);
 
-    static int label_count = 0;
-
-    // TODO this is a nasty hack, constant data should go at end of file
-    fprintf(fp, "\tjmp .string_skip_%d\n", label_count);
-    fprintf(fp, ".string_%d:\n", label_count);
-    fprintf(fp, "\t#d %s\n", node->token->value);
-    fprintf(fp, "\t#d8 0\n");
-    fprintf(fp, ".string_skip_%d:\n", label_count);
-
-    struct Register* reg = allocate_reg(node->type->size);
-    fprintf(fp, "\tmov %s, .string_%d\n", reg->name, label_count);
-
-    label_count += 1;
-
+    struct VirtualRegister* reg = ir_new_reg(node->type->size);
+    ir_immediate(reg, pool_string(node->token));
     return reg;
 }
 
-static struct Register* visit_variable(struct Node* node, FILE *fp, int depth) {
+static struct VirtualRegister* visit_variable(struct Node* node, int depth) {
     // printf("%-32s", node->type->name);
     // print_indent(depth);
     // printf("Variable: %s\n", node->token->value);
 
-    struct Register* pointer_reg = get_address(node, fp, depth);
-    struct Register* value_reg = allocate_reg(node->type->size);
-
-    emit_indirect_load(fp, value_reg, pointer_reg);
-
-    free_reg(pointer_reg);
+    // Copy so the variable isn't changed by whatever the value is used for
+    struct VirtualRegister* value_reg = ir_new_reg(node->type->size);
+    if (node->Variable.symbol->reg != NULL) {
+        ir_move(value_reg, node->Variable.symbol->reg);
+        return value_reg;
+    }
 
+    struct VirtualRegister* pointer_reg = get_address(node, depth);
+    ir_load(value_reg, pointer_reg);
     return value_reg;
 }
 
-static struct Register* cast(struct Register* reg, struct Type* from_type, struct Type* to_type, FILE *fp) {
+static struct VirtualRegister* cast(struct VirtualRegister* reg, struct Type* from_type, struct Type* to_type, struct Token* token) {
+    if (reg->size == to_type->size) return reg;
     if (from_type->kind == to_type->kind) return reg;
 
     printf("cast from '%s' to '%s'\n", from_type->name, to_type->name);
-    
-    struct Register* original_reg = reg;
-    free_reg(reg);
-    reg = allocate_reg(to_type->size);
-
-    if ((from_type->kind == TY_INT) && (to_type->kind == TY_CHAR)) fprintf(fp, "\tmov %s, %s ; (%s)\n", reg->name, original_reg->high_reg->name, to_type->name);
-    else if ((from_type->kind == TY_CHAR) && (to_type->kind == TY_INT)) fprintf(fp, "\tmov %s, 0 ; (%s)\n\tmov %s, %s\n", reg->high_reg->name, to_type->name, reg->low_reg->name, original_reg->name);
-    else if ((from_type->kind == TY_POINTER) && (to_type->kind == TY_INT)) ;
-    else if ((from_type->kind == TY_INT) && (to_type->kind == TY_POINTER)) ;
-    else error(NULL, "cast from '%s' to '%s' not implemented", from_type->name, to_type->name);
+    if (from_type->size != to_type->size) remark(RK_MISSED, "casts", "CastInserted", token, "cast from '%s' to '%s' inserted", from_type->name, to_type->name);
+
+    struct VirtualRegister* cast_reg = ir_new_reg(to_type->size);
+    if ((from_type->kind == TY_INT) && (to_type->kind == TY_CHAR)) {
+        ir_truncate(cast_reg, reg);
+    } else if ((from_type->kind == TY_CHAR) && ((to_type->kind == TY_INT) || (to_type->kind == TY_POINTER))) {
+        ir_extend(cast_reg, reg);
+    } else if (((from_type->kind == TY_POINTER) && (to_type->kind == TY_INT)) || ((from_type->kind == TY_INT) && (to_type->kind == TY_POINTER))) {
+        // Same size, only the type changes
+        return reg;
+    } else {
+        error(NULL, "cast from '%s' to '%s' not implemented", from_type->name, to_type->name);
+    }
 
-    return reg;
+    return cast_reg;
 }
 
-static struct Register* visit_assignment(struct Node* node, FILE *fp, int depth) {
+static struct VirtualRegister* visit_assignment(struct Node* node, int depth) {
     printf("%-32s", node->type->name);
     print_indent(depth);
     // printf("Assignment: %s\n", node->Assignment.left->token->value);
     printf("Assignment:\n");
 
-    struct Register* value_reg = visit(node->Assignment.right, fp, depth+1);
+    struct Node* left = node->Assignment.left;
+    struct Node* right = node->Assignment.right;
+    int discarded = is_discarded(node);
+    struct VirtualRegister* variable_reg = (left->kind == N_VARIABLE) ? left->Variable.symbol->reg : NULL;
+
+    // Without a copy to give back, constants and other register variables go straight in
+    if (discarded && (variable_reg != NULL)) {
+        if (right->kind == N_NUMBER) {
+            ir_immediate(variable_reg, format_label("%d", number_value(right) & ((left->type->size == 2) ? 0xffff : 0xff)));
+            return NULL;
+        }
+        if ((right->kind == N_VARIABLE) && (right->Variable.symbol->reg != NULL) && (right->type->size == left->type->size)) {
+            if (right->Variable.symbol->reg != variable_reg) ir_move(variable_reg, right->Variable.symbol->reg);
+            return NULL;
+        }
+    }
 
-    emit_push(fp, value_reg);
-    local_stack_usage += value_reg->size;
-    free_reg(value_reg);
+    // A value that is only stored can be read straight out of a register variable,
+    // unless working out where it goes might change it
+    struct VirtualRegister* value_reg;
+    if (discarded && (variable_reg == NULL) && !contains(left, is_side_effect)) value_reg = visit_operand(right, depth+1);
+    else value_reg = visit(right, depth+1);
+    value_reg = cast(value_reg, right->type, left->type, node->token);
 
-    struct Register* pointer_reg = get_address(node->Assignment.left, fp, depth+1);
+    if (variable_reg != NULL) {
+        ir_move(variable_reg, value_reg);
+    } else {
+        struct VirtualRegister* pointer_reg = get_address(left, depth+1);
+        ir_store(pointer_reg, value_reg);
+    }
 
-    value_reg = allocate_reg(value_reg->size);
-    emit_pop(fp, value_reg);
-    local_stack_usage -= value_reg->size;
+    return discarded ? NULL : value_reg;
+}
 
-    value_reg = cast(value_reg, node->Assignment.right->type, node->Assignment.left->type, fp);
+static void step(struct VirtualRegister* reg, enum TokenKind kind, int size) {
+    if (kind == TK_INC) ir_add_immediate(reg, size);
+    else ir_sub_immediate(reg, size);
+}
 
-    emit_indirect_store(fp, pointer_reg, value_reg);
-    
-    free_reg(pointer_reg);
+// The variable is stepped where it is, in its register or loaded, stepped and stored back.
+// A value is only produced if used, for postfix the one from before the change.
+static struct VirtualRegister* visit_inc_dec(struct Node* node, int depth) {
+    printf("%-32s", node->type->name);
+    print_indent(depth);
+    printf("IncDec: %s%s\n", node->IncDec.postfix ? "postfix " : "", node->token->value);
+
+    struct Node* variable = node->IncDec.variable;
+    int size = step_size(variable->type);
+    int used = !is_discarded(node);
+    struct VirtualRegister* value_reg = NULL;
+
+    struct VirtualRegister* variable_reg = variable->Variable.symbol->reg;
+    if (variable_reg != NULL) {
+        if (used && node->IncDec.postfix) {
+            value_reg = ir_new_reg(node->type->size);
+            ir_move(value_reg, variable_reg);
+        }
+        step(variable_reg, node->token->kind, size);
+        if (used && !node->IncDec.postfix) {
+            value_reg = ir_new_reg(node->type->size);
+            ir_move(value_reg, variable_reg);
+        }
+        return value_reg;
+    }
 
+    struct VirtualRegister* pointer_reg = get_address(variable, depth+1);
+    value_reg = ir_new_reg(node->type->size);
+    ir_load(value_reg, pointer_reg);
+    step(value_reg, node->token->kind, size);
+    ir_store(pointer_reg, value_reg);
+
+    if (!used) return NULL;
+
+    // Stepping back is cheaper than keeping a copy from before
+    if (node->IncDec.postfix) step(value_reg, (node->token->kind == TK_INC) ? TK_DEC : TK_INC, size);
     return value_reg;
 }
 
-static struct Register* visit_bin_op(struct Node* node, FILE *fp, int depth) {
+// Both operands end up in registers. The left one is worked on in place so it is a copy
+// unless it is only read, the right one is only read apart from shift counts.
+static void evaluate_operands(struct Node* node, struct VirtualRegister** left_out, struct VirtualRegister** right_out, int left_read_only, int depth) {
+    struct Node* left = node->BinOp.left;
+    struct Node* right = node->BinOp.right;
+    int is_shift = (node->token->kind == TK_LSHIFT) || (node->token->kind == TK_RSHIFT);
+
+    // Evaluate the operand that needs more registers first so fewer are tied up holding the other
+    int swapped = (register_need(right) > register_need(left)) && can_reorder(left, right);
+
+    // A variable read in place has to keep its value until the operation
+    struct VirtualRegister* right_reg = NULL;
+    if (swapped) right_reg = is_shift ? visit(right, depth+1) : visit_operand(right, depth+1);
+
+    struct VirtualRegister* left_reg;
+    if (left_read_only && (swapped || !contains(right, is_side_effect))) left_reg = visit_operand(left, depth+1);
+    else left_reg = visit(left, depth+1);
+    left_reg = cast(left_reg, left->type, node->type, node->token);
+
+    if (!swapped) right_reg = is_shift ? visit(right, depth+1) : visit_operand(right, depth+1);
+    right_reg = cast(right_reg, right->type, node->type, node->token);
+
+    if (left_reg->size != right_reg->size) error(node->token, "cannot work on registers of different sizes");
+
+    *left_out = left_reg;
+    *right_out = right_reg;
+}
+
+static struct VirtualRegister* visit_bin_op(struct Node* node, int depth) {
     printf("%-32s", node->type->name);
     print_indent(depth);
     printf("BinOp: %s\n", node->token->value);
 
-    struct Register* left_reg = visit(node->BinOp.left, fp, depth+1);
-    left_reg = cast(left_reg, node->BinOp.left->type, node->type, fp);
-    emit_push(fp, left_reg);
-    free_reg(left_reg);
-    local_stack_usage += left_reg->size;
+    struct VirtualRegister* left_reg;
+    struct VirtualRegister* right_reg;
 
-    struct Register* right_reg = visit(node->BinOp.right, fp, depth+1);
-    right_reg = cast(right_reg, node->BinOp.right->type, node->type, fp);
-    left_reg = allocate_reg(left_reg->size);
-    emit_pop(fp, left_reg);
-    local_stack_usage -= left_reg->size;
+    // Shifts by a constant are unrolled so only the value needs a register
+    int is_shift = (node->token->kind == TK_LSHIFT) || (node->token->kind == TK_RSHIFT);
+    if (is_shift && (node->BinOp.right->kind == N_NUMBER)) {
+        left_reg = visit(node->BinOp.left, depth+1);
+        left_reg = cast(left_reg, node->BinOp.left->type, node->type, node->token);
 
-    if (left_reg->size != right_reg->size) error(node->token, "cannot work on registers of different sizes");
+        int amount = number_value(node->BinOp.right);
+        if (node->token->kind == TK_LSHIFT) ir_left_shift_immediate(left_reg, amount);
+        else ir_right_shift_immediate(left_reg, amount);
+        return left_reg;
+    }
 
-    // If right is in accumulator move it, will likely need to put left in accumulator
-    if (strcmp(right_reg->name, "a") == 0) {
-        right_reg = allocate_reg(1);
-        emit_move(fp, right_reg, &registers[REG_A]);
-        free_reg(&registers[REG_A]);
+    // Multiplying by a constant doubles and adds a copy instead of calling the routine,
+    // register allocation drops the copy if there is no register for it
+    if ((node->token->kind == TK_ASTERISK) && ((node->BinOp.left->kind == N_NUMBER) || (node->BinOp.right->kind == N_NUMBER))) {
+        struct Node* value = (node->BinOp.right->kind == N_NUMBER) ? node->BinOp.left : node->BinOp.right;
+        struct Node* constant = (node->BinOp.right->kind == N_NUMBER) ? node->BinOp.right : node->BinOp.left;
+
+        left_reg = visit(value, depth+1);
+        left_reg = cast(left_reg, value->type, node->type, node->token);
+
+        ir_multiply_immediate(left_reg, ir_new_reg(left_reg->size), number_value(constant) & ((left_reg->size == 2) ? 0xffff : 0xff));
+        return left_reg;
     }
 
+    evaluate_operands(node, &left_reg, &right_reg, 0, depth);
+
     // Perform operation
-    if (node->token->kind == TK_PLUS) left_reg = emit_add(fp, left_reg, right_reg);
-    else if (node->token->kind == TK_MINUS) left_reg = emit_sub(fp, left_reg, right_reg);
-    else if (node->token->kind == TK_AMPERSAND) left_reg = emit_and(fp, left_reg, right_reg);
-    else if (node->token->kind == TK_BAR) left_reg = emit_or(fp, left_reg, right_reg);
-    else if (node->token->kind == TK_LSHIFT) left_reg = emit_left_shift(fp, left_reg, right_reg);
-    else if (node->token->kind == TK_RSHIFT) left_reg = emit_right_shift(fp, left_reg, right_reg);
-    else if (node->token->kind == TK_MORE) left_reg = emit_is_more(fp, left_reg, right_reg);
-    else if (node->token->kind == TK_LESS) left_reg = emit_is_less(fp, left_reg, right_reg);
-    else if (node->token->kind == TK_MORE_EQUAL) left_reg = emit_is_more_or_equal(fp, left_reg, right_reg);
-    else if (node->token->kind == TK_LESS_EQUAL) left_reg = emit_is_less_or_equal(fp, left_reg, right_reg);
-    else if (node->token->kind == TK_EQUAL) left_reg = emit_is_equal(fp, left_reg, right_reg);
-    else if (node->token->kind == TK_NOT_EQUAL) left_reg = emit_is_not_equal(fp, left_reg, right_reg);
+    if (node->token->kind == TK_PLUS) ir_binary(IR_ADD, left_reg, right_reg);
+    else if (node->token->kind == TK_MINUS) ir_binary(IR_SUB, left_reg, right_reg);
+    else if (node->token->kind == TK_AMPERSAND) ir_binary(IR_AND, left_reg, right_reg);
+    else if (node->token->kind == TK_BAR) ir_binary(IR_OR, left_reg, right_reg);
+    else if (node->token->kind == TK_LSHIFT) ir_binary(IR_LEFT_SHIFT, left_reg, right_reg);
+    else if (node->token->kind == TK_RSHIFT) ir_binary(IR_RIGHT_SHIFT, left_reg, right_reg);
+    else if (node->token->kind == TK_ASTERISK) ir_binary(IR_MULTIPLY, left_reg, right_reg);
+    else if (node->token->kind == TK_DIV) ir_binary(IR_DIVIDE, left_reg, right_reg);
+    else if (node->token->kind == TK_PERCENT) ir_binary(IR_MODULO, left_reg, right_reg);
+    else if (node->token->kind == TK_MORE) ir_binary(IR_IS_MORE, left_reg, right_reg);
+    else if (node->token->kind == TK_LESS) ir_binary(IR_IS_LESS, left_reg, right_reg);
+    else if (node->token->kind == TK_MORE_EQUAL) ir_binary(IR_IS_MORE_EQUAL, left_reg, right_reg);
+    else if (node->token->kind == TK_LESS_EQUAL) ir_binary(IR_IS_LESS_EQUAL, left_reg, right_reg);
+    else if (node->token->kind == TK_EQUAL) ir_binary(IR_IS_EQUAL, left_reg, right_reg);
+    else if (node->token->kind == TK_NOT_EQUAL) ir_binary(IR_IS_NOT_EQUAL, left_reg, right_reg);
     else error(node->token, "invalid binop node");
 
     return left_reg;
 }
 
-static struct Register* visit_unary_op(struct Node* node, FILE *fp, int depth) {
-    struct Register* left_reg;
+static struct VirtualRegister* visit_unary_op(struct Node* node, int depth) {
+    struct VirtualRegister* left_reg;
 
     // Perform operation
     if (strcmp(node->token->value, "+") == 0) {
         printf("%-32s", node->type->name);
         print_indent(depth);
         printf("UnaryOp: %s\n", node->token->value);
-        
-        left_reg = visit(node->UnaryOp.left, fp, depth+1);
+
+        left_reg = visit(node->UnaryOp.left, depth+1);
     } else if (strcmp(node->token->value, "-") == 0) {
         printf("%-32s", node->type->name);
         print_indent(depth);
         printf("UnaryOp: %s\n", node->token->value);
 
-        struct Register* right_reg = visit(node->UnaryOp.left, fp, depth+1);
-        left_reg = allocate_reg(right_reg->size);
-        emit_immediate_load(fp, left_reg, "0");
-        left_reg = emit_sub(fp, left_reg, right_reg);
+        struct VirtualRegister* right_reg = visit_operand(node->UnaryOp.left, depth+1);
+
+        left_reg = ir_new_reg(right_reg->size);
+        ir_immediate(left_reg, "0");
+        ir_binary(IR_SUB, left_reg, right_reg);
     } else if (strcmp(node->token->value, "*") == 0) {
-        struct Register* pointer_reg = get_address(node, fp, depth);
-        free_reg(pointer_reg);
-        left_reg = allocate_reg(node->UnaryOp.left->Variable.symbol->type->base->size);
-        emit_indirect_load(fp, left_reg, pointer_reg);
+        struct VirtualRegister* pointer_reg = get_address(node, depth);
+        left_reg = ir_new_reg(node->type->size);
+        ir_load(left_reg, pointer_reg);
     } else if (strcmp(node->token->value, "&") == 0) {
         printf("%-32s", node->type->name);
         print_indent(depth);
         printf("UnaryOp: %s\n", node->token->value);
 
-        left_reg = get_address(node->UnaryOp.left, fp, depth+1);
-    } else if (node->token->kind == TK_INC) {
-        printf("%-32s", node->type->name);
-        print_indent(depth);
-        printf("UnaryOp: ++\n");
-
-        left_reg = visit(node->UnaryOp.left, fp, depth+1);
-        emit_add_immediate(fp, left_reg, 1);
-    } else if (node->token->kind == TK_DEC) {
-        printf("%-32s", node->type->name);
-        print_indent(depth);
-        printf("UnaryOp: --\n");
-
-        left_reg = visit(node->UnaryOp.left, fp, depth+1);
-        emit_sub_immediate(fp, left_reg, 1);
+        left_reg = get_address(node->UnaryOp.left, depth+1);
     } else {
         error(node->token, "invalid unary operator");
     }
@@ -317,76 +771,253 @@ static struct Register* visit_unary_op(struct Node* node, FILE *fp, int depth) {
     return left_reg;
 }
 
-static void visit_return(struct Node* node, FILE *fp, int depth) {
+// Evaluates the arguments of a call, a variable in a register can be passed as it is
+// as long as no other argument changes it
+static void evaluate_arguments(struct Node* node, struct VirtualRegister** values, int depth) {
+    int read_only = 1;
+    struct List* entry;
+    int i;
+    for (entry = node->FuncCall.parameters; entry != NULL; entry = entry->next) {
+        if (contains((struct Node*)entry->value, is_side_effect)) read_only = 0;
+    }
+
+    for (entry = node->FuncCall.parameters, i = 0; entry != NULL; entry = entry->next, i++) {
+        if (read_only) values[i] = visit_operand((struct Node*)entry->value, depth+1);
+        else values[i] = visit((struct Node*)entry->value, depth+1);
+    }
+}
+
+// Moves the arguments passed in registers into them, returns which they are
+static int pass_in_registers(struct VirtualRegister** values, struct Register** assigned, int count) {
+    int arguments = 0;
+    for (int i = 0; i < count; i++) {
+        if (assigned[i] == NULL) continue;
+        ir_move(ir_fixed_reg(assigned[i] - registers), values[i]);
+        arguments |= 1 << (assigned[i] - registers);
+    }
+    return arguments;
+}
+
+// A call whose result is returned as it is can leave straight to this function's caller,
+// so the frame is freed and the callee jumped to, a call to itself making a loop.
+// Arguments on the stack would have to overwrite this function's own, those calls stay,
+// as do calls from functions that take the address of a local which may still be used.
+static int visit_tail_call(struct Node* node, int depth) {
+    struct Node* call = node->Return.expr;
+    if (!pass_enabled("tailcall") || (call->kind != N_FUNC_CALL)) return 0;
+    if ((return_type->kind == TY_VOID) || (call->type->size != return_type->size)) return 0;
+    if (frame_address_taken) {
+        remark(RK_MISSED, "tailcall", "FrameAddressTaken", call->token, "call to '%s' not made a jump as the address of a local is taken", call->token->value);
+        return 0;
+    }
+
+    struct Register* assigned[MAX_ARGUMENTS];
+    int count = assign_arguments(call->FuncCall.symbol->type, assigned);
+    for (int i = 0; i < count; i++) {
+        if (assigned[i] != NULL) continue;
+        remark(RK_MISSED, "tailcall", "StackArguments", call->token, "call to '%s' not made a jump as it passes arguments on the stack", call->token->value);
+        return 0;
+    }
+
+    printf("%-32s", call->type->name);
+    print_indent(depth+1);
+    printf("Tail call: %s\n", call->token->value);
+
+    struct VirtualRegister* values[MAX_ARGUMENTS];
+    evaluate_arguments(call, values, depth+1);
+    int arguments = pass_in_registers(values, assigned, count);
+    ir_release(frame_size);
+    ir_exit_jump(call->token->value, -1, arguments);
+    record_pass("tailcall", 1, 0);
+
+    if (strcmp(call->token->value, function_name) == 0) remark(RK_PASSED, "tailcall", "TailRecursion", call->token, "recursive call to '%s' made a loop", call->token->value);
+    else remark(RK_PASSED, "tailcall", "TailCall", call->token, "call to '%s' made a jump", call->token->value);
+    return 1;
+}
+
+static void visit_return(struct Node* node, int depth) {
     printf("%-32s", node->type->name);
     print_indent(depth);
     printf("Return:\n");
 
+    if (visit_tail_call(node, depth)) return;
+
     // Get return value
     // TODO can't return nothing lol
-    struct Register* reg = visit(node->Return.expr, fp, depth+1);
+    struct VirtualRegister* reg = visit_operand(node->Return.expr, depth+1);
+    if (return_type->kind != TY_VOID) reg = cast(reg, node->Return.expr->type, return_type, node->token);
 
-    // TODO return in a 16-bit register or on the stack
-    if (reg->size > 1) error(node->token, "only 8-bit return supported for now");
+    // Bytes are returned in the accumulator, words in bc
+    int result = (reg->size == 2) ? REG_BC : REG_A;
+    ir_move(ir_fixed_reg(result), reg);
 
-    // Move return value to accumulator if necessary
-    if (strcmp(reg->name, "a") != 0) emit_move(fp, &registers[REG_A], reg);
+    // Without a frame there is nothing to free on the way out
+    if (frame_size != 0) {
+        ir_exit_jump(exit_label, -1, 1 << result);
+    } else {
+        ir_release(0);
+        ir_return(1 << result);
+    }
+}
 
-    // TODO this needs account for returns from inside futher scopes
-    // Restore stack
-    if (node->scope->stack_size != 0) emit_stack_free(fp, node->scope->stack_size);
+// Jumps to false_label unless the condition holds, or to true_label when it holds if
+// jump_if_true is set, and otherwise falls through to the other label, which has to
+// come next. Comparisons set the flags with cmp and branch on them, 16-bit ones
+// deciding on the high bytes first, anything else is evaluated and tested against zero.
+static void branch(struct Node* condition, int jump_if_true, char* true_label, char* false_label, int count, int depth) {
+    if (!is_comparison(condition)) {
+        struct VirtualRegister* reg = visit_operand(condition, depth);
 
-    emit_return(fp);
-    free_reg(reg);
-}
+        if (reg->size == 2) ir_compare(reg, NULL, "0");
+        else ir_test(reg);
 
-static void visit_if(struct Node* node, FILE *fp, int depth) {
-    printf("%-32s", node->type->name);
+        if (jump_if_true) ir_jump(IR_JUMP_IF_NOT_EQUAL, true_label, count);
+        else ir_jump(IR_JUMP_IF_EQUAL, false_label, count);
+        return;
+    }
+
+    printf("%-32s", condition->type->name);
     print_indent(depth);
-    printf("If:\n");
+    printf("BinOp: %s\n", condition->token->value);
 
-    static int label_count = 0;
-    int tmp_label_count = label_count;
-    label_count++;
+    enum TokenKind kind = condition->token->kind;
+    struct Node* left = condition->BinOp.left;
+    struct Node* right = condition->BinOp.right;
 
-    // Get test value
-    struct Register* reg = visit(node->Return.expr, fp, depth+1);
+    // Keep a constant on the right where it can be compared against directly
+    if ((left->kind == N_NUMBER) && (right->kind != N_NUMBER)) {
+        left = condition->BinOp.right;
+        right = condition->BinOp.left;
+        kind = mirror_comparison(kind);
+    }
 
-    // Push accumulator if necessary
-    if ((strcmp(reg->name, "a") != 0) && (!registers[0].free)) {
-        emit_push(fp, &registers[REG_A]);
-        local_stack_usage += 1;
+    // Comparing only reads its operands
+    struct VirtualRegister* left_reg;
+    struct VirtualRegister* right_reg;
+    if (right->kind == N_NUMBER) {
+        left_reg = visit_operand(left, depth+1);
+        left_reg = cast(left_reg, left->type, condition->type, condition->token);
+        if (left_reg->size == 1) ir_compare(left_reg, NULL, right->token->value);
+        else ir_compare(left_reg, NULL, format_label("%d", number_value(right)));
+    } else {
+        // Operands are only swapped for == and != so the order doesn't matter
+        evaluate_operands(condition, &left_reg, &right_reg, 1, depth);
+        ir_compare(left_reg, right_reg, NULL);
     }
 
-    // Move test value to accumulator if necessary
-    if (strcmp(reg->name, "a") != 0) emit_move(fp, &registers[REG_A], reg);
+    // cmp sets zero when equal and carry when the accumulator is greater
+    if (jump_if_true) {
+        switch (kind) {
+            case TK_EQUAL:
+                ir_jump(IR_JUMP_IF_EQUAL, true_label, count);
+                break;
+            case TK_NOT_EQUAL:
+                ir_jump(IR_JUMP_IF_NOT_EQUAL, true_label, count);
+                break;
+            case TK_MORE:
+                ir_jump(IR_JUMP_IF_CARRY, true_label, count);
+                break;
+            case TK_LESS_EQUAL:
+                ir_jump(IR_JUMP_IF_NOT_CARRY, true_label, count);
+                break;
+            case TK_LESS:
+                ir_jump(IR_JUMP_IF_EQUAL, false_label, count);
+                ir_jump(IR_JUMP_IF_NOT_CARRY, true_label, count);
+                break;
+            case TK_MORE_EQUAL:
+                ir_jump(IR_JUMP_IF_EQUAL, true_label, count);
+                ir_jump(IR_JUMP_IF_CARRY, true_label, count);
+                break;
+            default:
+                error(condition->token, "invalid comparison");
+        }
+    } else {
+        switch (kind) {
+            case TK_EQUAL:
+                ir_jump(IR_JUMP_IF_NOT_EQUAL, false_label, count);
+                break;
+            case TK_NOT_EQUAL:
+                ir_jump(IR_JUMP_IF_EQUAL, false_label, count);
+                break;
+            case TK_MORE:
+                ir_jump(IR_JUMP_IF_NOT_CARRY, false_label, count);
+                break;
+            case TK_LESS_EQUAL:
+                ir_jump(IR_JUMP_IF_CARRY, false_label, count);
+                break;
+            case TK_LESS:
+                ir_jump(IR_JUMP_IF_CARRY, false_label, count);
+                ir_jump(IR_JUMP_IF_EQUAL, false_label, count);
+                break;
+            case TK_MORE_EQUAL:
+                ir_jump(IR_JUMP_IF_EQUAL, true_label, count);
+                ir_jump(IR_JUMP_IF_NOT_CARRY, false_label, count);
+                break;
+            default:
+                error(condition->token, "invalid comparison");
+        }
+    }
 
-    // Compare
-    emit_cmp_zero(fp);
+    remark(RK_PASSED, "branch", "FusedCompare", condition->token, "comparison '%s' branched on directly", condition->token->value);
+}
 
-    // Restore accumulator if necessary
-    if ((strcmp(reg->name, "a") != 0) && (!registers[0].free)) {
-        emit_pop(fp, &registers[REG_A]);
-        local_stack_usage -= 1;
-    }
+static void visit_if(struct Node* node, int depth) {
+    printf("%-32s", node->type->name);
+    print_indent(depth);
+    printf("If:\n");
+
+    static int label_count = 0;
+    int tmp_label_count = label_count;
+    label_count++;
 
-    // Jump if equal 0
-    emit_jump_if_equal(fp, ".if_false", tmp_label_count);
-    free_reg(reg);
+    branch(node->If.expr, 0, ".if_true", ".if_false", tmp_label_count, depth+1);
 
     // Visit true branch
-    emit_label(fp, ".if_true", tmp_label_count);
-    free_reg(visit(node->If.true_statement, fp, depth+1));
-    emit_jump(fp, ".if_exit", tmp_label_count);
+    ir_label(".if_true", tmp_label_count);
+    visit_statement(node->If.true_statement, NULL, depth+1);
+    ir_jump(IR_JUMP, ".if_exit", tmp_label_count);
 
     // Visit false branch
-    emit_label(fp, ".if_false", tmp_label_count);
-    if (node->If.false_statement != NULL) free_reg(visit(node->If.false_statement, fp, depth+1));
+    ir_label(".if_false", tmp_label_count);
+    if (node->If.false_statement != NULL) visit_statement(node->If.false_statement, NULL, depth+1);
 
-    emit_label(fp, ".if_exit", tmp_label_count);
+    ir_label(".if_exit", tmp_label_count);
 }
 
-static void visit_while(struct Node* node, FILE *fp, int depth) {
+// Whether a loop condition is true the first time, either constant or testing a
+// variable the statement just before gave a constant
+static int holds_on_entry(struct Node* condition, struct Node* before) {
+    if (condition->kind == N_NUMBER) return number_value(condition) != 0;
+    if (before == NULL) return 0;
+
+    struct Node* assignment = (before->kind == N_VAR_DECL) ? before->VarDecl.assignment : before;
+    if ((assignment == NULL) || (assignment->kind != N_ASSIGNMENT)) return 0;
+    struct Node* target = assignment->Assignment.left;
+    struct Node* value = assignment->Assignment.right;
+    if ((target->kind != N_VARIABLE) || (value->kind != N_NUMBER)) return 0;
+    struct Symbol* symbol = target->Variable.symbol;
+    int known = number_value(value) & ((target->type->size == 2) ? 0xffff : 0xff);
+
+    if (condition->kind == N_VARIABLE) return (condition->Variable.symbol == symbol) && (known != 0);
+    if (!is_comparison(condition)) return 0;
+
+    struct Node* left = condition->BinOp.left;
+    struct Node* right = condition->BinOp.right;
+    int result;
+    if ((left->kind == N_VARIABLE) && (left->Variable.symbol == symbol) && (right->kind == N_NUMBER)) {
+        if (!evaluate_comparison(condition, known, number_value(right), &result)) return 0;
+    } else if ((right->kind == N_VARIABLE) && (right->Variable.symbol == symbol) && (left->kind == N_NUMBER)) {
+        if (!evaluate_comparison(condition, number_value(left), known, &result)) return 0;
+    } else {
+        return 0;
+    }
+    return result;
+}
+
+// Loops test at the bottom so each iteration takes a single branch. The first test is
+// a copy of it in front of the loop, or a jump down to it when optimizing for size,
+// and is left out when the condition is known to hold.
+static void visit_while(struct Node* node, int depth) {
     printf("%-32s", node->type->name);
     print_indent(depth);
     printf("While:\n");
@@ -395,138 +1026,161 @@ static void visit_while(struct Node* node, FILE *fp, int depth) {
     int tmp_label_count = label_count;
     label_count++;
 
-    emit_label(fp, ".while_start", tmp_label_count);
+    if (!pass_enabled("rotate")) {
+        ir_label(".while_start", tmp_label_count);
 
-    // Get test value
-    struct Register* reg = visit(node->Return.expr, fp, depth+1);
+        branch(node->While.expr, 0, ".while_contents", ".while_exit", tmp_label_count, depth+1);
 
-    // Push accumulator if necessary
-    if ((strcmp(reg->name, "a") != 0) && (!registers[0].free)) {
-        emit_push(fp, &registers[REG_A]);
-        local_stack_usage += 1;
-    }
-
-    // Move test value to accumulator if necessary
-    if (strcmp(reg->name, "a") != 0) emit_move(fp, &registers[REG_A], reg);
+        // Visit loop statement
+        ir_label(".while_contents", tmp_label_count);
+        visit_statement(node->While.loop_statement, NULL, depth+1);
 
-    // Compare
-    emit_cmp_zero(fp);
+        // Go back to start of loop
+        ir_jump(IR_JUMP, ".while_start", tmp_label_count);
 
-    // Restore accumulator if necessary
-    if ((strcmp(reg->name, "a") != 0) && (!registers[0].free)) {
-        emit_pop(fp, &registers[REG_A]);
-        local_stack_usage -= 1;
+        ir_label(".while_exit", tmp_label_count);
+        return;
     }
 
-    // Jump if equal 0
-    emit_jump_if_equal(fp, ".while_exit", tmp_label_count);
-    free_reg(reg);
+    // Rotating the loop and leaving out its guard each count as a change
+    int guarded = !holds_on_entry(node->While.expr, (current_statement == node) ? previous_statement : NULL);
+    record_pass("rotate", guarded ? 1 : 2, 0);
+    if (!guarded) {
+        remark(RK_PASSED, "rotate", "GuardRemoved", node->token, "loop condition holds on entry so is only tested at the bottom");
+    } else if (optimizing_for_size()) {
+        ir_jump(IR_JUMP, ".while_test", tmp_label_count);
+    } else {
+        branch(node->While.expr, 0, ".while_contents", ".while_exit", tmp_label_count, depth+1);
+    }
 
     // Visit loop statement
-    emit_label(fp, ".while_contents", tmp_label_count);
-    free_reg(visit(node->While.loop_statement, fp, depth+1));
-
-    // Go back to start of loop
-    emit_jump(fp, ".while_start", tmp_label_count);
+    ir_label(".while_contents", tmp_label_count);
+    visit_statement(node->While.loop_statement, NULL, depth+1);
 
-    emit_label(fp, ".while_exit", tmp_label_count);
+    // Go back to the start of the loop while the condition holds
+    ir_label(".while_test", tmp_label_count);
+    if (guarded || (node->While.expr->kind != N_NUMBER)) branch(node->While.expr, 1, ".while_contents", ".while_exit", tmp_label_count, depth+1);
+    else ir_jump(IR_JUMP, ".while_contents", tmp_label_count);
 
-    tmp_label_count++;
+    ir_label(".while_exit", tmp_label_count);
 }
 
-static struct Register* visit_func_call(struct Node* node, FILE *fp, int depth) {
+// Arguments are evaluated first, then whatever is live across the call is saved
+// and the arguments are pushed or moved into the registers they are passed in
+static struct VirtualRegister* visit_func_call(struct Node* node, int depth) {
     printf("%-32s", node->type->name);
     print_indent(depth);
     printf("Call: %s\n", node->token->value);
 
-    struct Symbol* symbol = node->FuncCall.symbol;
+    struct Register* assigned[MAX_ARGUMENTS];
+    int count = assign_arguments(node->FuncCall.symbol->type, assigned);
+    struct VirtualRegister* values[MAX_ARGUMENTS];
+    evaluate_arguments(node, values, depth);
 
-    // Push accumulator if necessary
-    int preserve_a = !registers[0].free;
-    if (preserve_a) {
-        emit_push(fp, &registers[0]);
-        local_stack_usage += registers[0].size;
-    }
+    int call = ir_save();
 
-    // Push parameters
     int func_stack_usage = 0;
-    if (node->FuncCall.parameters != NULL) {
-        struct List* current_entry = node->FuncCall.parameters;
-        do {
-            struct Node* actual_param = (struct Node*)current_entry->value;
-            
-            struct Register* reg = visit(actual_param, fp, depth+1);
-            // reg = cast(reg, actual_param->node->type, formal_param->type, fp);
-            emit_push(fp, reg);
-            func_stack_usage += reg->size;
-            free_reg(reg);
-        } while (list_next(&current_entry));
-    }
-    
-    emit_call(fp, node->token->value, -1);
-    emit_stack_free(fp, func_stack_usage);
-
-    // Move result out of accumulator if necessary
-    struct Register* result_reg = allocate_reg(1);
-    if (preserve_a) emit_move(fp, result_reg, &registers[0]);
-
-    // Restore accumulator if necessary
-    if (preserve_a) {
-        emit_pop(fp, &registers[0]);
-        local_stack_usage -= registers[0].size;
+    for (int i = 0; i < count; i++) {
+        if (assigned[i] != NULL) continue;
+        ir_push(values[i]);
+        func_stack_usage += values[i]->size;
+    }
+    int arguments = pass_in_registers(values, assigned, count);
+
+    // Results come back in a or bc, unless it isn't used
+    struct VirtualRegister* returned_reg = NULL;
+    if (!is_discarded(node) && (node->type->kind != TY_VOID)) returned_reg = ir_fixed_reg((node->type->size == 2) ? REG_BC : REG_A);
+
+    ir_call(node->token->value, arguments, returned_reg, call);
+    if (func_stack_usage != 0) ir_stack(func_stack_usage);
+
+    struct VirtualRegister* result_reg = NULL;
+    if (returned_reg != NULL) {
+        result_reg = ir_new_reg(returned_reg->size);
+        ir_move(result_reg, returned_reg);
     }
 
+    ir_restore(call);
     return result_reg;
 }
 
-static struct Register* visit(struct Node* node, FILE *fp, int depth) {
+static struct VirtualRegister* visit(struct Node* node, int depth) {
+    // Instructions are marked with the node they were generated for
+    struct Token* token = ir_token(node->token);
+    struct VirtualRegister* reg = NULL;
+
     switch (node->kind) {
         case N_PROGRAM:
-            visit_program(node, fp, depth);
-            return NULL;
+            visit_program(node, depth);
+            break;
         case N_VAR_DECL:
-            visit_var_decl(node, fp, depth);
-            return NULL;
+            visit_var_decl(node, depth);
+            break;
         case N_FUNC_DECL:
-            visit_func_decl(node, fp, depth);
-            return NULL;
+            visit_func_decl(node, depth);
+            break;
         case N_BLOCK:
-            visit_block(node, fp, depth);
-            return NULL;
+            visit_block(node, depth);
+            break;
         case N_NUMBER:
-            return visit_number(node, fp, depth);
+            reg = visit_number(node, depth);
+            break;
         case N_STRING:
-            return visit_string(node, fp, depth);
+            reg = visit_string(node, depth);
+            break;
         case N_VARIABLE:
-            return visit_variable(node, fp, depth);
+            reg = visit_variable(node, depth);
+            break;
         case N_ASSIGNMENT:
-            return visit_assignment(node, fp, depth);
+            reg = visit_assignment(node, depth);
+            break;
+        case N_INC_DEC:
+            reg = visit_inc_dec(node, depth);
+            break;
         case N_BINOP:
-            return visit_bin_op(node, fp, depth);
+            reg = visit_bin_op(node, depth);
+            break;
         case N_UNARY:
-            return visit_unary_op(node, fp, depth);
+            reg = visit_unary_op(node, depth);
+            break;
         case N_RETURN:
-            visit_return(node, fp, depth);
-            return NULL;
+            visit_return(node, depth);
+            break;
         case N_IF:
-            visit_if(node, fp, depth);
-            return NULL;
+            visit_if(node, depth);
+            break;
         case N_WHILE:
-            visit_while(node, fp, depth);
-            return NULL;
+            visit_while(node, depth);
+            break;
         case N_FUNC_CALL:
-            return visit_func_call(node, fp, depth);
+            reg = visit_func_call(node, depth);
+            break;
+        default:
+            error(node->token, "invalid node kind");
     }
 
-    error(node->token, "invalid node kind");
-    return NULL;
+    ir_token(token);
+    return reg;
 }
 
 void generate(struct Node* root_node, char* filename) {
     FILE *fp = fopen(filename, "w");
     if (!fp) error(NULL, "unable to create output file '%s'", filename);
 
-    visit(root_node, fp, 0);
+    visit(root_node, 0);
+
+    // Buffer the assembly so the peephole pass sees the whole program
+    char* text = NULL;
+    size_t size = 0;
+    FILE* buffer = open_memstream(&text, &size);
+    if (!buffer) error(NULL, "unable to buffer output");
 
+    lower_ir(buffer);
+    fclose(buffer);
+
+    if (pass_enabled("peephole")) optimize_peephole(text, fp);
+    else fputs(text, fp);
+
+    free(text);
     fclose(fp);
-}
\ No newline at end of file
+}
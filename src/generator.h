@@ -3,6 +3,7 @@
 
 struct Node;
 
+void set_abi(char*);
 void generate(struct Node*, char*);
 
 #endif
\ No newline at end of file
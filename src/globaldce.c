@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "globaldce.h"
+#include "lexer.h"
+#include "parser.h"
+#include "remarks.h"
+#include "symbol.h"
+#include "list.h"
+
+// Removes functions and global variables the program can never reach.
+// Everything main calls or reads is kept, as is anything named with -u,
+// and from there whatever those use in turn. Global initializers are constant
+// so they never keep anything alive themselves. String literals only exist
+// inside functions so they go with them.
+
+#define MAX_KEPT 64
+
+struct Entry {
+    struct Node* node;
+    int reachable;
+};
+
+static char* kept_names[MAX_KEPT];
+static int kept_count = 0;
+
+static struct Entry* functions = NULL;
+static int function_count = 0;
+static struct Entry* globals = NULL;
+static int global_count = 0;
+
+void keep_symbol(char* name) {
+    if (kept_count < MAX_KEPT) kept_names[kept_count++] = name;
+}
+
+static int list_length(struct List* list) {
+    int length = 0;
+    for (; list != NULL; list = list->next) length++;
+    return length;
+}
+
+static struct Entry* collect(struct List* list, int* count) {
+    *count = list_length(list);
+    struct Entry* entries = calloc(*count + 1, sizeof(struct Entry));
+    for (int i = 0; list != NULL; list = list->next, i++) entries[i].node = (struct Node*)list->value;
+    return entries;
+}
+
+static void mark_node(struct Node* node);
+
+static void mark_function(char* name) {
+    for (int i = 0; i < function_count; i++) {
+        struct Entry* entry = &functions[i];
+        if (entry->reachable || (strcmp(entry->node->token->value, name) != 0)) continue;
+        entry->reachable = 1;
+        mark_node(entry->node);
+    }
+}
+
+static void mark_global(struct Symbol* symbol) {
+    for (int i = 0; i < global_count; i++) {
+        struct Entry* entry = &globals[i];
+        if (entry->reachable || (entry->node->VarDecl.symbol != symbol)) continue;
+        entry->reachable = 1;
+        mark_node(entry->node);
+    }
+}
+
+static void mark_child(struct Node** slot, void* data) {
+    (void)data;
+    mark_node(*slot);
+}
+
+static void mark_node(struct Node* node) {
+    if (node->kind == N_FUNC_CALL) mark_function(node->token->value);
+    else if ((node->kind == N_VARIABLE) && node->Variable.symbol->global) mark_global(node->Variable.symbol);
+
+    for_each_child(node, mark_child, NULL);
+}
+
+// Drop list entries that weren't reached, in place
+static int sweep(struct List** list, struct Entry* entries, int count, char* name) {
+    int removed = 0;
+    struct List** link = list;
+    for (int i = 0; i < count; i++) {
+        if (entries[i].reachable) {
+            link = &(*link)->next;
+            continue;
+        }
+
+        struct Node* node = entries[i].node;
+        remark(RK_PASSED, "globaldce", name, node->token, "'%s' removed as nothing reachable uses it", node->token->value);
+        *link = (*link)->next;
+        removed++;
+    }
+    return removed;
+}
+
+static int has_main(struct List* list) {
+    for (; list != NULL; list = list->next) {
+        if (strcmp(((struct Node*)list->value)->token->value, "main") == 0) return 1;
+    }
+    return 0;
+}
+
+int eliminate_dead_globals(struct Node* root_node) {
+    // Without a main there is nothing to start from
+    if (!has_main(root_node->Program.function_declarations)) return 0;
+
+    functions = collect(root_node->Program.function_declarations, &function_count);
+    globals = collect(root_node->Program.global_variables, &global_count);
+
+    mark_function("main");
+    for (int i = 0; i < kept_count; i++) {
+        mark_function(kept_names[i]);
+        for (int j = 0; j < global_count; j++) {
+            if (strcmp(globals[j].node->token->value, kept_names[i]) == 0) mark_global(globals[j].node->VarDecl.symbol);
+        }
+    }
+
+    int removed = sweep(&root_node->Program.function_declarations, functions, function_count, "FunctionRemoved");
+    removed += sweep(&root_node->Program.global_variables, globals, global_count, "GlobalRemoved");
+
+    free(functions);
+    free(globals);
+    return removed;
+}
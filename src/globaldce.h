@@ -0,0 +1,9 @@
+#ifndef _GLOBALDCE_H
+#define _GLOBALDCE_H
+
+struct Node;
+
+void keep_symbol(char*);
+int eliminate_dead_globals(struct Node*);
+
+#endif
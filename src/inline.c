@@ -0,0 +1,441 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "inline.h"
+#include "fold.h"
+#include "lexer.h"
+#include "messages.h"
+#include "parser.h"
+#include "remarks.h"
+#include "scope.h"
+#include "symbol.h"
+#include "type.h"
+#include "list.h"
+
+// Replaces calls with a copy of the function called, for functions marked inline,
+// functions called from only one place and functions no bigger than the limit.
+// A function whose body is a single return has the returned expression put in
+// place of the call with the arguments substituted for its parameters. A function
+// with no return that is called as a statement becomes a block declaring the
+// parameters, initialized with the arguments, followed by a copy of the body.
+// Callees are expanded before their callers so every copy is already inlined,
+// globaldce then removes whatever is left with no calls.
+
+#define DEFAULT_INLINE_LIMIT 12
+#define MAX_MAPPED 64
+
+struct Callee {
+    struct Node* node;
+    int calls;
+    int state;          // 0 untouched, 1 being expanded, 2 expanded
+};
+
+// Scopes and symbols of the callee and what they became in the copy,
+// anything not mapped is shared with the caller
+struct Clone {
+    void* from[MAX_MAPPED];
+    void* to[MAX_MAPPED];
+    int count;
+
+    struct List* parameters;    // Substituted by the arguments in the same position
+    struct List* arguments;
+    int copy_scopes;            // Unmapped scopes are the callee's own rather than the caller's
+};
+
+static int inline_limit = DEFAULT_INLINE_LIMIT;
+static struct Callee* callees = NULL;
+static int callee_count = 0;
+static struct Callee* current = NULL;
+static int changes;
+
+void set_inline_limit(char* value) {
+    char* end;
+    long limit = strtol(value, &end, 10);
+    if ((*value == '\0') || (*end != '\0') || (limit < 0)) error(NULL, "invalid inline limit '-finline-limit=%s'", value);
+    inline_limit = limit;
+}
+
+static struct Callee* find_callee(char* name) {
+    for (int i = 0; i < callee_count; i++) {
+        if (strcmp(callees[i].node->token->value, name) == 0) return &callees[i];
+    }
+    return NULL;
+}
+
+static void count_calls(struct Node** slot, void* data) {
+    if ((*slot)->kind == N_FUNC_CALL) {
+        struct Callee* callee = find_callee((*slot)->token->value);
+        if (callee != NULL) callee->calls++;
+    }
+    for_each_child(*slot, count_calls, data);
+}
+
+static void count_nodes(struct Node** slot, void* data) {
+    (*(int*)data)++;
+    for_each_child(*slot, count_nodes, data);
+}
+
+static void find_return(struct Node** slot, void* data) {
+    if ((*slot)->kind == N_RETURN) *(int*)data = 1;
+    for_each_child(*slot, find_return, data);
+}
+
+static void* lookup(struct Clone* clone, void* from) {
+    for (int i = 0; i < clone->count; i++) {
+        if (clone->from[i] == from) return clone->to[i];
+    }
+    return NULL;
+}
+
+static void map(struct Clone* clone, void* from, void* to) {
+    if (clone->count == MAX_MAPPED) error(NULL, "internal error: too many scopes and symbols to inline");
+    clone->from[clone->count] = from;
+    clone->to[clone->count] = to;
+    clone->count++;
+}
+
+static struct Symbol* clone_symbol(struct Symbol* symbol, struct Clone* clone) {
+    struct Symbol* copy = calloc(1, sizeof(struct Symbol));
+    *copy = *symbol;
+    copy->reg = NULL;
+    map(clone, symbol, copy);
+    return copy;
+}
+
+// Scopes inside the callee are copied along with their symbols, the global scope is shared
+static struct Scope* clone_scope(struct Scope* scope, struct Clone* clone) {
+    if ((scope == NULL) || (scope->parent_scope == NULL)) return scope;
+
+    struct Scope* copy = lookup(clone, scope);
+    if ((copy != NULL) || !clone->copy_scopes) return (copy != NULL) ? copy : scope;
+
+    copy = calloc(1, sizeof(struct Scope));
+    *copy = *scope;
+    copy->parent_scope = clone_scope(scope->parent_scope, clone);
+    copy->depth = copy->parent_scope->depth + 1;
+    copy->symbol_list = NULL;
+    map(clone, scope, copy);
+
+    for (struct List* entry = scope->symbol_list; entry != NULL; entry = entry->next) {
+        list_add(&copy->symbol_list, clone_symbol((struct Symbol*)entry->value, clone));
+    }
+    return copy;
+}
+
+static struct Symbol* clone_symbol_use(struct Symbol* symbol, struct Clone* clone) {
+    struct Symbol* copy = lookup(clone, symbol);
+    return (copy != NULL) ? copy : symbol;
+}
+
+static struct List* clone_list(struct List* list) {
+    struct List* copy = NULL;
+    for (; list != NULL; list = list->next) list_add(&copy, list->value);
+    return copy;
+}
+
+static struct Node* clone_node(struct Node* node, struct Clone* clone);
+
+static void clone_child(struct Node** slot, void* data) {
+    *slot = clone_node(*slot, data);
+}
+
+static struct Node* clone_node(struct Node* node, struct Clone* clone) {
+    if (node->kind == N_VARIABLE) {
+        struct List* argument = clone->arguments;
+        for (struct List* entry = clone->parameters; entry != NULL; entry = entry->next, argument = argument->next) {
+            struct Clone plain = {0};
+            if (((struct Node*)entry->value)->VarDecl.symbol == node->Variable.symbol) return clone_node((struct Node*)argument->value, &plain);
+        }
+    }
+
+    struct Node* copy = calloc(1, sizeof(struct Node));
+    *copy = *node;
+    copy->scope = clone_scope(node->scope, clone);
+
+    switch (node->kind) {
+        case N_VAR_DECL:
+            copy->VarDecl.symbol = clone_symbol_use(node->VarDecl.symbol, clone);
+            break;
+        case N_VARIABLE:
+            copy->Variable.symbol = clone_symbol_use(node->Variable.symbol, clone);
+            break;
+        case N_BLOCK:
+            copy->Block.statements = clone_list(node->Block.statements);
+            break;
+        case N_FUNC_CALL:
+            copy->FuncCall.parameters = clone_list(node->FuncCall.parameters);
+            break;
+        default:
+            break;
+    }
+
+    for_each_child(copy, clone_child, clone);
+    return copy;
+}
+
+struct Usage {
+    struct Symbol* symbol;
+    int uses;
+    int address_taken;
+    int changed;
+    int side_effects;
+};
+
+static void find_uses(struct Node** slot, void* data) {
+    struct Node* node = *slot;
+    struct Usage* usage = data;
+
+    if ((node->kind == N_VARIABLE) && (node->Variable.symbol == usage->symbol)) usage->uses++;
+    else if ((node->kind == N_UNARY) && (node->token->kind == TK_AMPERSAND) && (node->UnaryOp.left->Variable.symbol == usage->symbol)) usage->address_taken = 1;
+    else if ((node->kind == N_INC_DEC) && (node->IncDec.variable->Variable.symbol == usage->symbol)) usage->changed = 1;
+    else if ((node->kind == N_ASSIGNMENT) && (node->Assignment.left->kind == N_VARIABLE) && (node->Assignment.left->Variable.symbol == usage->symbol)) usage->changed = 1;
+
+    if ((node->kind == N_ASSIGNMENT) || (node->kind == N_INC_DEC) || (node->kind == N_FUNC_CALL)) usage->side_effects = 1;
+
+    for_each_child(node, find_uses, data);
+}
+
+static int is_leaf(struct Node* node) {
+    return (node->kind == N_NUMBER) || (node->kind == N_STRING) || (node->kind == N_VARIABLE);
+}
+
+static int same_type(struct Type* left, struct Type* right) {
+    return strcmp(left->name, right->name) == 0;
+}
+
+// The expression a single return function gives back, or the reason it can't be substituted
+static struct Node* returned_expression(struct Node* function, struct Node* call, char** reason) {
+    struct List* statements = function->FunctionDecl.block->Block.statements;
+    struct Node* statement = (statements != NULL) ? (struct Node*)statements->value : NULL;
+    if ((statement == NULL) || (statements->next != NULL) || (statement->kind != N_RETURN) || (statement->Return.expr == NULL)) {
+        *reason = "its body is more than a single return";
+        return NULL;
+    }
+
+    struct Node* expression = statement->Return.expr;
+    if (!same_type(expression->type, function->type->base)) {
+        *reason = "its result needs a conversion";
+        return NULL;
+    }
+
+    // Arguments are evaluated where the parameter was used instead of before the call,
+    // that is only the same if they can't change anything or be changed by the function
+    struct List* argument = call->FuncCall.parameters;
+    for (struct List* entry = function->FunctionDecl.formal_parameters; entry != NULL; entry = entry->next, argument = argument->next) {
+        struct Node* value = (struct Node*)argument->value;
+        struct Usage usage = {.symbol = ((struct Node*)entry->value)->VarDecl.symbol};
+        find_uses(&statement->Return.expr, &usage);
+
+        if (!is_pure(value)) *reason = "an argument has side effects";
+        else if ((value->kind == N_VARIABLE) && (value->type->size != value->Variable.symbol->type->size)) *reason = "an argument needs a conversion";
+        else if (usage.address_taken) *reason = "the address of a parameter is taken";
+        else if (usage.changed) *reason = "a parameter is changed";
+        else if (!is_leaf(value) && (usage.uses > 1)) *reason = "an argument would be evaluated more than once";
+        else if (usage.side_effects && (value->kind != N_NUMBER) && (value->kind != N_STRING)) *reason = "an argument could change before it is used";
+        else continue;
+        return NULL;
+    }
+
+    return expression;
+}
+
+static void expand_function(struct Callee* callee);
+
+// Returns the function a call may be replaced with, or NULL with a remark saying why not
+static struct Callee* should_inline(struct Node* call, char** reason) {
+    struct Callee* callee = find_callee(call->token->value);
+    if ((callee == NULL) || (strcmp(call->token->value, "main") == 0)) return NULL;
+
+    struct Node* function = callee->node;
+    if (function->FunctionDecl.no_inline) {
+        remark(RK_MISSED, "inline", "NotInlined", call->token, "'%s' not inlined as it is marked noinline", call->token->value);
+        return NULL;
+    }
+
+    if (callee->state == 0) expand_function(callee);
+    if (callee->state == 1) {
+        remark(RK_MISSED, "inline", "NotInlined", call->token, "'%s' not inlined as it is recursive", call->token->value);
+        return NULL;
+    }
+
+    int size = 0;
+    count_nodes(&function->FunctionDecl.block, &size);
+
+    static char buffer[64];
+    if (function->FunctionDecl.is_inline) *reason = "as it is marked inline";
+    else if (callee->calls == 1) *reason = "as it is only called once";
+    else if (size <= inline_limit) {
+        sprintf(buffer, "with a size of %d", size);
+        *reason = buffer;
+    } else {
+        remark(RK_MISSED, "inline", "TooLarge", call->token, "'%s' not inlined as its size of %d is over the limit of %d", call->token->value, size, inline_limit);
+        return NULL;
+    }
+
+    return callee;
+}
+
+static void inline_expression(struct Node** slot, void* data) {
+    for_each_child(*slot, inline_expression, data);
+
+    struct Node* call = *slot;
+    if (call->kind != N_FUNC_CALL) return;
+
+    char* reason;
+    struct Callee* callee = should_inline(call, &reason);
+    if (callee == NULL) return;
+
+    char* missed;
+    struct Node* expression = returned_expression(callee->node, call, &missed);
+    if (expression == NULL) {
+        remark(RK_MISSED, "inline", "NotInlined", call->token, "'%s' not inlined as %s", call->token->value, missed);
+        return;
+    }
+
+    struct Clone clone = {.parameters = callee->node->FunctionDecl.formal_parameters, .arguments = call->FuncCall.parameters};
+    map(&clone, callee->node->FunctionDecl.block->scope, call->scope);
+    map(&clone, callee->node->FunctionDecl.block->scope->parent_scope, call->scope);
+
+    *slot = clone_node(expression, &clone);
+    remark(RK_PASSED, "inline", "Inlined", call->token, "'%s' inlined %s", call->token->value, reason);
+    changes++;
+}
+
+// The parameters become locals of a new block around the body, the arguments their initial values
+static struct Node* inline_block(struct Node* function, struct Node* call) {
+    struct Clone clone = {.copy_scopes = 1};
+    struct Scope* parameter_scope = function->FunctionDecl.block->scope->parent_scope;
+
+    struct Scope* scope = calloc(1, sizeof(struct Scope));
+    *scope = *parameter_scope;
+    scope->parent_scope = call->scope;
+    scope->depth = call->scope->depth + 1;
+    scope->stack_size -= 2;     // No return address
+    scope->symbol_list = NULL;
+    map(&clone, parameter_scope, scope);
+
+    struct Node* block = calloc(1, sizeof(struct Node));
+    block->token = call->token;
+    block->kind = N_BLOCK;
+    block->type = &type_void;
+    block->scope = scope;
+
+    struct List* argument = call->FuncCall.parameters;
+    for (struct List* entry = function->FunctionDecl.formal_parameters; entry != NULL; entry = entry->next, argument = argument->next) {
+        struct Node* parameter = (struct Node*)entry->value;
+        struct Symbol* symbol = clone_symbol(parameter->VarDecl.symbol, &clone);
+        list_add(&scope->symbol_list, symbol);
+
+        struct Node* variable = calloc(1, sizeof(struct Node));
+        variable->token = parameter->token;
+        variable->kind = N_VARIABLE;
+        variable->type = symbol->type;
+        variable->scope = scope;
+        variable->Variable.symbol = symbol;
+
+        struct Node* assignment = calloc(1, sizeof(struct Node));
+        assignment->token = call->token;
+        assignment->kind = N_ASSIGNMENT;
+        assignment->type = symbol->type;
+        assignment->scope = scope;
+        assignment->Assignment.left = variable;
+        assignment->Assignment.right = (struct Node*)argument->value;
+
+        struct Node* declaration = calloc(1, sizeof(struct Node));
+        declaration->token = parameter->token;
+        declaration->kind = N_VAR_DECL;
+        declaration->type = symbol->type;
+        declaration->scope = scope;
+        declaration->VarDecl.symbol = symbol;
+        declaration->VarDecl.assignment = assignment;
+        list_add(&block->Block.statements, declaration);
+    }
+
+    list_add(&block->Block.statements, clone_node(function->FunctionDecl.block, &clone));
+    return block;
+}
+
+// Calls whose value is unused can take any function that runs to the end of its body
+static void inline_call_statement(struct Node** slot) {
+    struct Node* call = *slot;
+    for_each_child(call, inline_expression, NULL);
+
+    char* reason;
+    struct Callee* callee = should_inline(call, &reason);
+    if (callee == NULL) return;
+
+    int returns = 0;
+    find_return(&callee->node->FunctionDecl.block, &returns);
+    if (returns) {
+        remark(RK_MISSED, "inline", "NotInlined", call->token, "'%s' not inlined as its result is unused and it has a return", call->token->value);
+        return;
+    }
+
+    *slot = inline_block(callee->node, call);
+    remark(RK_PASSED, "inline", "Inlined", call->token, "'%s' inlined %s", call->token->value, reason);
+    changes++;
+}
+
+static void inline_statement(struct Node** slot) {
+    struct Node* node = *slot;
+    switch (node->kind) {
+        case N_BLOCK:
+            for (struct List* entry = node->Block.statements; entry != NULL; entry = entry->next) {
+                inline_statement((struct Node**)&entry->value);
+            }
+            break;
+        case N_VAR_DECL:
+            if (node->VarDecl.assignment != NULL) inline_expression(&node->VarDecl.assignment, NULL);
+            break;
+        case N_RETURN:
+            if (node->Return.expr != NULL) inline_expression(&node->Return.expr, NULL);
+            break;
+        case N_IF:
+            inline_expression(&node->If.expr, NULL);
+            inline_statement(&node->If.true_statement);
+            if (node->If.false_statement != NULL) inline_statement(&node->If.false_statement);
+            break;
+        case N_WHILE:
+            inline_expression(&node->While.expr, NULL);
+            inline_statement(&node->While.loop_statement);
+            break;
+        case N_FUNC_CALL:
+            inline_call_statement(slot);
+            break;
+        default:
+            inline_expression(slot, NULL);
+            break;
+    }
+}
+
+static void expand_function(struct Callee* callee) {
+    struct Callee* caller = current;
+    current = callee;
+    callee->state = 1;
+    set_remark_function(callee->node->token->value);
+
+    inline_statement(&callee->node->FunctionDecl.block);
+
+    callee->state = 2;
+    current = caller;
+    set_remark_function((caller != NULL) ? caller->node->token->value : NULL);
+}
+
+int inline_functions(struct Node* root_node) {
+    changes = 0;
+
+    struct List* list = root_node->Program.function_declarations;
+    callee_count = 0;
+    for (struct List* entry = list; entry != NULL; entry = entry->next) callee_count++;
+    callees = calloc(callee_count + 1, sizeof(struct Callee));
+    for (int i = 0; list != NULL; list = list->next, i++) callees[i].node = (struct Node*)list->value;
+
+    for (int i = 0; i < callee_count; i++) count_calls(&callees[i].node->FunctionDecl.block, NULL);
+
+    for (int i = 0; i < callee_count; i++) {
+        if (callees[i].state == 0) expand_function(&callees[i]);
+    }
+
+    free(callees);
+    return changes;
+}
@@ -0,0 +1,9 @@
+#ifndef _INLINE_H
+#define _INLINE_H
+
+struct Node;
+
+void set_inline_limit(char*);
+int inline_functions(struct Node*);
+
+#endif
@@ -0,0 +1,473 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "interp.h"
+#include "lexer.h"
+#include "messages.h"
+#include "parser.h"
+#include "scope.h"
+#include "symbol.h"
+#include "type.h"
+#include "list.h"
+
+// Executes the AST directly on the host while modelling the target:
+// 8-bit char, 16-bit int and pointers, a flat 64KiB big-endian memory
+// image and the memory mapped terminal used by tests/io.h.
+// Each scope gets its own stack space with locals at their parser assigned
+// positions. The generator keeps one frame per function, passes arguments
+// in registers and keeps variables there, so addresses of locals differ
+// from the real machine and only the values they hold can be relied on.
+
+#define MEMORY_SIZE 0x10000
+#define DATA_START 0x8100
+#define TERMINAL_ADDRESS 0x7000
+
+struct Binding {
+    void* key;
+    int address;
+};
+
+static unsigned char memory[MEMORY_SIZE];
+static int sp = MEMORY_SIZE;
+static int data_end = DATA_START;
+static int heap_start = 0;
+
+static struct Node* program_node;
+static struct List* global_bindings = NULL;
+static struct List* string_bindings = NULL;
+
+// Base address of every scope currently active on the stack, innermost last,
+// grown as needed so only running out of stack limits recursion
+static struct Binding* frames = NULL;
+static int frame_count = 0;
+static int frame_capacity = 0;
+
+static int returning = 0;
+static int return_value = 0;
+
+static int eval(struct Node*);
+static int execute(struct Node*);
+
+static int read_byte(int address) {
+    address &= 0xffff;
+    if (address == TERMINAL_ADDRESS) {
+        int c = getchar();
+        return (c == EOF) ? 0 : (c & 0xff);
+    }
+    return memory[address];
+}
+
+static void write_byte(int address, int value) {
+    address &= 0xffff;
+    if (address == TERMINAL_ADDRESS) {
+        putchar(value & 0xff);
+        return;
+    }
+    memory[address] = value & 0xff;
+}
+
+// Multi-byte values are stored big-endian, high byte first
+static int read_value(int address, int size) {
+    if (size == 2) return (read_byte(address) << 8) | read_byte(address+1);
+    return read_byte(address);
+}
+
+static void write_value(int address, int size, int value) {
+    if (size == 2) {
+        write_byte(address, value >> 8);
+        write_byte(address+1, value);
+    } else {
+        write_byte(address, value);
+    }
+}
+
+static int truncate_value(int value, struct Type* type) {
+    if (type->size == 1) return value & 0xff;
+    return value & 0xffff;
+}
+
+static void push_value(int size, int value) {
+    sp -= size;
+    if (sp < data_end) error(NULL, "stack overflow");
+    write_value(sp, size, value);
+}
+
+static struct Binding* find_binding(struct List* list, void* key) {
+    if (list == NULL) return NULL;
+    struct List* current_entry = list;
+    do {
+        struct Binding* binding = (struct Binding*)current_entry->value;
+        if (binding->key == key) return binding;
+    } while (list_next(&current_entry));
+    return NULL;
+}
+
+static void add_binding(struct List** list, void* key, int address) {
+    struct Binding* binding = calloc(1, sizeof(struct Binding));
+    binding->key = key;
+    binding->address = address;
+    list_add(list, binding);
+}
+
+static void enter_frame(struct Scope* scope) {
+    if (frame_count == frame_capacity) {
+        frame_capacity = (frame_capacity == 0) ? 64 : frame_capacity*2;
+        frames = realloc(frames, frame_capacity * sizeof(struct Binding));
+    }
+    frames[frame_count].key = scope;
+    frames[frame_count].address = sp;
+    frame_count++;
+}
+
+static int contains_symbol(struct Scope* scope, struct Symbol* symbol) {
+    if (scope->symbol_list == NULL) return 0;
+    struct List* current_entry = scope->symbol_list;
+    do {
+        if (current_entry->value == symbol) return 1;
+    } while (list_next(&current_entry));
+    return 0;
+}
+
+static int symbol_address(struct Node* node, struct Symbol* symbol) {
+    if (symbol->is_extern) {
+        if (strcmp(symbol->token->value, "heap_start") == 0) return heap_start;
+        error(node->token, "undefined reference to '%s'", symbol->token->value);
+    }
+
+    if (symbol->global) {
+        struct Binding* binding = find_binding(global_bindings, symbol);
+        if (binding == NULL) error(node->token, "'%s' used before its declaration", symbol->token->value);
+        return binding->address;
+    }
+
+    // Find the scope the symbol was declared in then where that scope lives on the stack
+    struct Scope* scope = node->scope;
+    while ((scope != NULL) && !contains_symbol(scope, symbol)) scope = scope->parent_scope;
+    if (scope == NULL) error(node->token, "'%s' is not in scope", symbol->token->value);
+
+    for (int i = frame_count-1; i >= 0; i--) {
+        if (frames[i].key == scope) return frames[i].address + scope->stack_size - symbol->stack_position - symbol->type->size;
+    }
+
+    error(node->token, "'%s' is not on the stack", symbol->token->value);
+    return 0;
+}
+
+// Reserve space for a string literal and copy it in
+static int layout_string(struct Node* node) {
+    int address = data_end;
+    char* value = node->token->value;
+    int i = 1;
+    while (value[i] != '\"') {
+        if (value[i] == '\\') {
+            memory[data_end++] = char_value(&value[i-1]);
+            i += 2;
+        } else {
+            memory[data_end++] = value[i++];
+        }
+    }
+    memory[data_end++] = 0;
+    return address;
+}
+
+static void layout_strings(struct Node* node);
+
+static void layout_all_strings(struct List* list) {
+    if (list == NULL) return;
+    struct List* current_entry = list;
+    do {
+        layout_strings((struct Node*)current_entry->value);
+    } while (list_next(&current_entry));
+}
+
+static void layout_strings(struct Node* node) {
+    if (node == NULL) return;
+
+    switch (node->kind) {
+        case N_PROGRAM:
+            layout_all_strings(node->Program.global_variables);
+            layout_all_strings(node->Program.function_declarations);
+            break;
+        case N_VAR_DECL:
+            layout_strings(node->VarDecl.assignment);
+            break;
+        case N_FUNC_DECL:
+            layout_strings(node->FunctionDecl.block);
+            break;
+        case N_BLOCK:
+            layout_all_strings(node->Block.statements);
+            break;
+        case N_STRING:
+            add_binding(&string_bindings, node, layout_string(node));
+            break;
+        case N_ASSIGNMENT:
+        case N_BINOP:
+        case N_UNARY:
+            layout_strings(node->BinOp.left);
+            layout_strings(node->BinOp.right);
+            break;
+        case N_RETURN:
+            layout_strings(node->Return.expr);
+            break;
+        case N_IF:
+            layout_strings(node->If.expr);
+            layout_strings(node->If.true_statement);
+            layout_strings(node->If.false_statement);
+            break;
+        case N_WHILE:
+            layout_strings(node->While.expr);
+            layout_strings(node->While.loop_statement);
+            break;
+        case N_FUNC_CALL:
+            layout_all_strings(node->FuncCall.parameters);
+            break;
+        default:
+            break;
+    }
+}
+
+static int eval_address(struct Node* node) {
+    if (node->kind == N_VARIABLE) {
+        return symbol_address(node, node->Variable.symbol);
+    } else if ((node->kind == N_UNARY) && (node->token->kind == TK_ASTERISK)) {
+        return eval(node->UnaryOp.left);
+    }
+
+    error(node->token, "lvalue required as left operand of assignment");
+    return 0;
+}
+
+static struct Node* find_function(struct Node* node) {
+    struct List* current_entry = program_node->Program.function_declarations;
+    if (current_entry != NULL) {
+        do {
+            struct Node* function_node = (struct Node*)current_entry->value;
+            if (strcmp(function_node->token->value, node->token->value) == 0) return function_node;
+        } while (list_next(&current_entry));
+    }
+
+    error(node->token, "undefined reference to '%s'", node->token->value);
+    return NULL;
+}
+
+static int call_function(struct Node* function_node) {
+    int old_sp = sp;
+    int old_frame_count = frame_count;
+
+    // Call pushes the return address, parameters sit above it
+    push_value(2, 0);
+    enter_frame(function_node->FunctionDecl.block->scope->parent_scope);
+
+    execute(function_node->FunctionDecl.block);
+
+    int value = returning ? truncate_value(return_value, function_node->type->base) : 0;
+    returning = 0;
+
+    frame_count = old_frame_count;
+    sp = old_sp;
+
+    return value;
+}
+
+static int eval_func_call(struct Node* node) {
+    struct Node* function_node = find_function(node);
+    int old_sp = sp;
+
+    // Push parameters in order, just like the generated code
+    if (node->FuncCall.parameters != NULL) {
+        struct List* current_entry = node->FuncCall.parameters;
+        do {
+            struct Node* actual_param = (struct Node*)current_entry->value;
+            int value = eval(actual_param);
+            push_value(actual_param->type->size, value);
+        } while (list_next(&current_entry));
+    }
+
+    int value = call_function(function_node);
+    sp = old_sp;
+
+    return value;
+}
+
+static int cast_value(int value, struct Type* to_type) {
+    if (to_type->kind == TY_VOID) return value;
+    return truncate_value(value, to_type);
+}
+
+static int eval_bin_op(struct Node* node) {
+    int left = cast_value(eval(node->BinOp.left), node->type);
+    int right = cast_value(eval(node->BinOp.right), node->type);
+
+    switch (node->token->kind) {
+        case TK_PLUS: return truncate_value(left + right, node->type);
+        case TK_MINUS: return truncate_value(left - right, node->type);
+        case TK_ASTERISK: return truncate_value(left * right, node->type);
+        case TK_DIV:
+            if (right == 0) error(node->token, "division by zero");
+            return truncate_value(left / right, node->type);
+        case TK_PERCENT:
+            if (right == 0) error(node->token, "division by zero");
+            return left % right;
+        case TK_AMPERSAND: return left & right;
+        case TK_BAR: return left | right;
+        // Shifting by the width or more clears the value, the same as the generated code
+        case TK_LSHIFT: return (right >= node->type->size*8) ? 0 : truncate_value(left << right, node->type);
+        case TK_RSHIFT: return (right >= node->type->size*8) ? 0 : left >> right;
+        case TK_MORE: return left > right;
+        case TK_LESS: return left < right;
+        case TK_MORE_EQUAL: return left >= right;
+        case TK_LESS_EQUAL: return left <= right;
+        case TK_EQUAL: return left == right;
+        case TK_NOT_EQUAL: return left != right;
+        default: break;
+    }
+
+    error(node->token, "invalid binop node");
+    return 0;
+}
+
+static int eval_unary_op(struct Node* node) {
+    switch (node->token->kind) {
+        case TK_PLUS:
+            return eval(node->UnaryOp.left);
+        case TK_MINUS:
+            return truncate_value(-eval(node->UnaryOp.left), node->type);
+        case TK_ASTERISK:
+            return read_value(eval(node->UnaryOp.left), node->type->size);
+        case TK_AMPERSAND:
+            return eval_address(node->UnaryOp.left);
+        default:
+            break;
+    }
+
+    error(node->token, "invalid unary operator");
+    return 0;
+}
+
+static int eval_assignment(struct Node* node) {
+    int value = cast_value(eval(node->Assignment.right), node->Assignment.left->type);
+    int address = eval_address(node->Assignment.left);
+    write_value(address, node->Assignment.left->type->size, value);
+    return value;
+}
+
+static int eval_inc_dec(struct Node* node) {
+    struct Node* variable = node->IncDec.variable;
+    int address = eval_address(variable);
+    int old_value = read_value(address, variable->type->size);
+    int step = (node->token->kind == TK_INC) ? step_size(variable->type) : -step_size(variable->type);
+    int value = truncate_value(old_value + step, variable->type);
+    write_value(address, variable->type->size, value);
+    return node->IncDec.postfix ? old_value : value;
+}
+
+static int eval(struct Node* node) {
+    switch (node->kind) {
+        case N_NUMBER:
+            return truncate_value(number_value(node), node->type);
+        case N_STRING:
+            return find_binding(string_bindings, node)->address;
+        case N_VARIABLE:
+            return read_value(eval_address(node), node->type->size);
+        case N_ASSIGNMENT:
+            return eval_assignment(node);
+        case N_INC_DEC:
+            return eval_inc_dec(node);
+        case N_BINOP:
+            return eval_bin_op(node);
+        case N_UNARY:
+            return eval_unary_op(node);
+        case N_FUNC_CALL:
+            return eval_func_call(node);
+        default:
+            break;
+    }
+
+    error(node->token, "invalid expression node");
+    return 0;
+}
+
+static int execute_all(struct List* list) {
+    if (list == NULL) return 0;
+    struct List* current_entry = list;
+    do {
+        if (execute((struct Node*)current_entry->value)) return 1;
+    } while (list_next(&current_entry));
+    return 0;
+}
+
+static int execute_block(struct Node* node) {
+    int old_sp = sp;
+    int old_frame_count = frame_count;
+
+    // Allocate stack space
+    sp -= node->scope->stack_size;
+    if (sp < data_end) error(node->token, "stack overflow");
+    enter_frame(node->scope);
+
+    execute_all(node->Block.statements);
+
+    // Deallocate
+    frame_count = old_frame_count;
+    sp = old_sp;
+
+    return returning;
+}
+
+// Returns non-zero once a return statement has been reached
+static int execute(struct Node* node) {
+    switch (node->kind) {
+        case N_VAR_DECL:
+            if (node->VarDecl.assignment != NULL) eval(node->VarDecl.assignment);
+            return 0;
+        case N_BLOCK:
+            return execute_block(node);
+        case N_RETURN:
+            return_value = eval(node->Return.expr);
+            returning = 1;
+            return 1;
+        case N_IF:
+            if (eval(node->If.expr)) return execute(node->If.true_statement);
+            if (node->If.false_statement != NULL) return execute(node->If.false_statement);
+            return 0;
+        case N_WHILE:
+            while (eval(node->While.expr)) {
+                if (execute(node->While.loop_statement)) return 1;
+            }
+            return 0;
+        default:
+            eval(node);
+            return 0;
+    }
+}
+
+int interpret(struct Node* root_node) {
+    program_node = root_node;
+
+    // Place globals then string literals, heap follows directly after
+    if (root_node->Program.global_variables != NULL) {
+        struct List* current_entry = root_node->Program.global_variables;
+        do {
+            struct Node* var_decl = (struct Node*)current_entry->value;
+            struct Symbol* symbol = var_decl->VarDecl.symbol;
+            if (!symbol->is_extern) {
+                add_binding(&global_bindings, symbol, data_end);
+                data_end += symbol->type->size;
+            }
+        } while (list_next(&current_entry));
+    }
+    layout_strings(root_node);
+    heap_start = data_end;
+
+    // Initialise global variables
+    execute_all(root_node->Program.global_variables);
+
+    // Call main
+    struct Token main_token = {.kind=TK_ID, .value="main"};
+    struct Node main_call = {.token=&main_token, .kind=N_FUNC_CALL};
+    int value = call_function(find_function(&main_call));
+
+    fflush(stdout);
+
+    return value & 0xff;
+}
@@ -0,0 +1,8 @@
+#ifndef _INTERP_H
+#define _INTERP_H
+
+struct Node;
+
+int interpret(struct Node*);
+
+#endif
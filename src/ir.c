@@ -0,0 +1,590 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "ir.h"
+#include "messages.h"
+#include "register.h"
+#include "symbol.h"
+#include "target.h"
+#include "type.h"
+
+// Instruction list built by the generator over virtual registers, as many as it
+// likes. Each function is split into basic blocks joined by their jumps, register
+// allocation works over those and gives every virtual register a physical one,
+// then the whole program is lowered to assembly through target.c.
+// Each section is its own list, they are joined when lowering.
+
+static struct Instruction* first_instructions[SECTION_COUNT];
+static struct Instruction* last_instructions[SECTION_COUNT];
+static enum Section section = SECTION_CODE;
+
+// Passes after the generator add instructions in the middle of a function
+static struct Instruction* insert_point = NULL;
+static int inserting = 0;
+static struct Instruction* latest = NULL;
+
+static struct Function* function = NULL;
+static struct Token* token = NULL;
+
+static struct VirtualRegister fixed_regs[REG_COUNT];
+static int reg_count = REG_COUNT;
+static int call_count = 0;
+
+struct VirtualRegister* ir_new_reg(int size) {
+    struct VirtualRegister* reg = calloc(1, sizeof(struct VirtualRegister));
+    reg->number = reg_count++;
+    reg->size = size;
+    return reg;
+}
+
+// The physical register itself, numbered the same
+struct VirtualRegister* ir_fixed_reg(int index) {
+    struct VirtualRegister* reg = &fixed_regs[index];
+    if (!reg->fixed) {
+        reg->number = index;
+        reg->size = registers[index].size;
+        reg->fixed = 1;
+        reg->reg = &registers[index];
+    }
+    return reg;
+}
+
+struct VirtualRegister* ir_variable_reg(struct Symbol* symbol) {
+    struct VirtualRegister* reg = ir_new_reg(symbol->type->size);
+    reg->symbol = symbol;
+    return reg;
+}
+
+// One more than the highest number given out so far
+int ir_reg_count() {
+    return reg_count;
+}
+
+// Instructions added from here on are marked as generated for the token, the previous one is returned
+struct Token* ir_token(struct Token* new_token) {
+    struct Token* previous = token;
+    token = new_token;
+    return previous;
+}
+
+static struct Instruction* append(enum IrOp op, struct VirtualRegister* dest, struct VirtualRegister* src, char* text, int number) {
+    struct Instruction* instruction = calloc(1, sizeof(struct Instruction));
+    instruction->op = op;
+    instruction->dest = dest;
+    instruction->src = src;
+    instruction->text = text;
+    instruction->number = number;
+    instruction->token = token;
+
+    struct Instruction* after = inserting ? insert_point : last_instructions[section];
+    instruction->prev = after;
+    if (after == NULL) {
+        instruction->next = first_instructions[section];
+        first_instructions[section] = instruction;
+    } else {
+        instruction->next = after->next;
+        after->next = instruction;
+    }
+    if (instruction->next != NULL) instruction->next->prev = instruction;
+    else last_instructions[section] = instruction;
+
+    if (inserting) insert_point = instruction;
+    latest = instruction;
+    return instruction;
+}
+
+// Everything added from here on goes in the given section
+void ir_section(enum Section new_section) {
+    section = new_section;
+}
+
+void ir_begin_function(char* name) {
+    function = calloc(1, sizeof(struct Function));
+    function->name = name;
+    function->first_number = reg_count;
+    ir_label(name, -1);
+    function->first = latest;
+}
+
+struct Function* ir_end_function() {
+    function->last = last_instructions[SECTION_CODE];
+    struct Function* ended = function;
+    function = NULL;
+    return ended;
+}
+
+// Instructions are added in front of the given one until ir_append()
+void ir_insert_before(struct Instruction* instruction) {
+    insert_point = instruction->prev;
+    inserting = 1;
+}
+
+void ir_insert_after(struct Instruction* instruction) {
+    insert_point = instruction;
+    inserting = 1;
+}
+
+void ir_append() {
+    inserting = 0;
+}
+
+struct Instruction* ir_last() {
+    return latest;
+}
+
+void ir_remove(struct Instruction* instruction) {
+    if (instruction->prev != NULL) instruction->prev->next = instruction->next;
+    else first_instructions[SECTION_CODE] = instruction->next;
+    if (instruction->next != NULL) instruction->next->prev = instruction->prev;
+    else last_instructions[SECTION_CODE] = instruction->prev;
+}
+
+// Takes the instruction out of where it is and puts it back after the given one
+void ir_reinsert(struct Instruction* instruction, struct Instruction* after) {
+    ir_remove(instruction);
+    instruction->prev = after;
+    instruction->next = after->next;
+    after->next = instruction;
+    if (instruction->next != NULL) instruction->next->prev = instruction;
+    else last_instructions[SECTION_CODE] = instruction;
+}
+
+void ir_label(char* label, int count) {
+    append(IR_LABEL, NULL, NULL, label, count);
+}
+
+void ir_data(char* format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    append(IR_DATA, NULL, NULL, strdup(buffer), 0);
+}
+
+void ir_move(struct VirtualRegister* dest, struct VirtualRegister* src) {
+    append(IR_MOVE, dest, src, NULL, 0);
+}
+
+void ir_immediate(struct VirtualRegister* dest, char* value) {
+    append(IR_IMMEDIATE, dest, NULL, value, 0);
+}
+
+// Offsets are from sp once the frame is reserved, anything pushed since is allowed for when lowering
+void ir_frame_address(struct VirtualRegister* dest, int offset, char* name) {
+    append(IR_FRAME_ADDRESS, dest, NULL, name, offset);
+}
+
+void ir_load(struct VirtualRegister* dest, struct VirtualRegister* pointer) {
+    append(IR_LOAD, dest, pointer, NULL, 0);
+}
+
+void ir_store(struct VirtualRegister* pointer, struct VirtualRegister* value) {
+    append(IR_STORE, pointer, value, NULL, 0);
+}
+
+void ir_push(struct VirtualRegister* reg) {
+    append(IR_PUSH, NULL, reg, NULL, 0);
+}
+
+void ir_pop(struct VirtualRegister* reg) {
+    append(IR_POP, reg, NULL, NULL, 0);
+}
+
+void ir_stack(int adjustment) {
+    append(IR_STACK, NULL, NULL, NULL, adjustment);
+}
+
+void ir_extend(struct VirtualRegister* dest, struct VirtualRegister* src) {
+    append(IR_EXTEND, dest, src, NULL, 0);
+}
+
+void ir_truncate(struct VirtualRegister* dest, struct VirtualRegister* src) {
+    append(IR_TRUNCATE, dest, src, NULL, 0);
+}
+
+void ir_binary(enum IrOp op, struct VirtualRegister* left_reg, struct VirtualRegister* right_reg) {
+    if (left_reg->size != right_reg->size) error(token, "cannot work on registers of different sizes");
+    append(op, left_reg, right_reg, NULL, 0);
+}
+
+void ir_add_immediate(struct VirtualRegister* reg, int value) {
+    append(IR_ADD_IMMEDIATE, reg, NULL, NULL, value);
+}
+
+void ir_sub_immediate(struct VirtualRegister* reg, int value) {
+    append(IR_SUB_IMMEDIATE, reg, NULL, NULL, value);
+}
+
+void ir_left_shift_immediate(struct VirtualRegister* reg, int amount) {
+    append(IR_LEFT_SHIFT_IMMEDIATE, reg, NULL, NULL, amount);
+}
+
+void ir_right_shift_immediate(struct VirtualRegister* reg, int amount) {
+    append(IR_RIGHT_SHIFT_IMMEDIATE, reg, NULL, NULL, amount);
+}
+
+// Register allocation drops the scratch register if there is none to spare
+void ir_multiply_immediate(struct VirtualRegister* reg, struct VirtualRegister* scratch_reg, int value) {
+    append(IR_MULTIPLY_IMMEDIATE, reg, scratch_reg, NULL, value);
+}
+
+// Every routine, only those the program calls are lowered
+void ir_routines() {
+    for (int i = 0; i < ROUTINE_COUNT; i++) append(IR_ROUTINE, NULL, NULL, NULL, i);
+}
+
+void ir_test(struct VirtualRegister* reg) {
+    append(IR_TEST, reg, NULL, NULL, 0);
+}
+
+void ir_compare(struct VirtualRegister* left_reg, struct VirtualRegister* right_reg, char* immediate) {
+    append(IR_COMPARE, left_reg, right_reg, immediate, 0);
+}
+
+void ir_jump(enum IrOp op, char* label, int count) {
+    append(op, NULL, NULL, label, count);
+}
+
+// A jump that leaves the function, to its exit or as a tail call, reading the result or arguments
+void ir_exit_jump(char* label, int count, int arguments) {
+    append(IR_JUMP, NULL, NULL, label, count)->registers = arguments;
+}
+
+// The call number pairs it with its ir_save(), -1 when nothing can be live across it
+void ir_call(char* name, int arguments, struct VirtualRegister* result, int call) {
+    append(IR_CALL, result, NULL, name, call)->registers = arguments;
+}
+
+void ir_return(int result) {
+    append(IR_RETURN, NULL, NULL, NULL, 0)->registers = result;
+}
+
+void ir_enter(int arguments) {
+    append(IR_ENTER, NULL, NULL, NULL, 0)->registers = arguments;
+}
+
+void ir_reserve(int size) {
+    append(IR_RESERVE, NULL, NULL, NULL, size);
+}
+
+void ir_release(int size) {
+    append(IR_RELEASE, NULL, NULL, NULL, size);
+}
+
+// Starts a call, returning the number to give ir_call() and ir_restore()
+int ir_save() {
+    append(IR_SAVE, NULL, NULL, NULL, call_count);
+    return call_count++;
+}
+
+void ir_restore(int call) {
+    append(IR_RESTORE, NULL, NULL, NULL, call);
+}
+
+// Only at startup, when no register holds anything
+void ir_zero_fill(char* start) {
+    append(IR_ZERO_FILL, NULL, NULL, start, 0);
+}
+
+int is_binary(enum IrOp op) {
+    return (op >= IR_ADD) && (op <= IR_IS_NOT_EQUAL);
+}
+
+int is_immediate_op(enum IrOp op) {
+    return (op >= IR_ADD_IMMEDIATE) && (op <= IR_MULTIPLY_IMMEDIATE);
+}
+
+// 8-bit operations that give the same result with the operands the other way round
+static int is_commutative(enum IrOp op) {
+    return (op == IR_ADD) || (op == IR_AND) || (op == IR_OR) || (op == IR_IS_EQUAL) || (op == IR_IS_NOT_EQUAL);
+}
+
+int is_jump(enum IrOp op) {
+    return (op >= IR_JUMP) && (op <= IR_JUMP_IF_NOT_CARRY);
+}
+
+static int add_fixed(int mask, struct VirtualRegister** regs, int count) {
+    for (int i = 0; i < REG_COUNT; i++) {
+        if (mask & (1 << i)) regs[count++] = ir_fixed_reg(i);
+    }
+    return count;
+}
+
+// Registers an instruction reads, returns how many
+int ir_uses(struct Instruction* instruction, struct VirtualRegister** regs) {
+    enum IrOp op = instruction->op;
+    int count = 0;
+
+    if ((op == IR_MOVE) || (op == IR_LOAD) || (op == IR_PUSH) || (op == IR_EXTEND) || (op == IR_TRUNCATE)) {
+        regs[count++] = instruction->src;
+    } else if ((op == IR_STORE) || is_binary(op) || (op == IR_COMPARE)) {
+        regs[count++] = instruction->dest;
+        if (instruction->src != NULL) regs[count++] = instruction->src;
+    } else if (is_immediate_op(op) || (op == IR_TEST)) {
+        regs[count++] = instruction->dest;
+    } else if ((op == IR_CALL) || is_jump(op) || (op == IR_RETURN)) {
+        count = add_fixed(instruction->registers, regs, count);
+    }
+    return count;
+}
+
+// Registers an instruction writes, returns how many
+int ir_defs(struct Instruction* instruction, struct VirtualRegister** regs) {
+    enum IrOp op = instruction->op;
+    int count = 0;
+
+    switch (op) {
+        case IR_MOVE:
+        case IR_IMMEDIATE:
+        case IR_FRAME_ADDRESS:
+        case IR_LOAD:
+        case IR_POP:
+        case IR_EXTEND:
+        case IR_TRUNCATE:
+            regs[count++] = instruction->dest;
+            break;
+        case IR_CALL:
+            if (instruction->dest != NULL) regs[count++] = instruction->dest;
+            break;
+        case IR_ENTER:
+            count = add_fixed(instruction->registers, regs, count);
+            break;
+        default:
+            if (is_binary(op) || is_immediate_op(op)) {
+                regs[count++] = instruction->dest;
+                // Shift counts are counted down and the copy to multiply by is scratch
+                if ((op == IR_LEFT_SHIFT) || (op == IR_RIGHT_SHIFT) || ((op == IR_MULTIPLY_IMMEDIATE) && (instruction->src != NULL))) regs[count++] = instruction->src;
+            }
+            break;
+    }
+    return count;
+}
+
+// Whether lowering goes through the accumulator, anything but dest held in it is lost
+int ir_uses_accumulator(struct Instruction* instruction) {
+    enum IrOp op = instruction->op;
+    int size = (instruction->dest != NULL) ? instruction->dest->size : 0;
+    int value = instruction->number;
+
+    if (is_binary(op) || (op == IR_MULTIPLY_IMMEDIATE) || (op == IR_TEST) || (op == IR_COMPARE) || (op == IR_ZERO_FILL)) return 1;
+    if ((op == IR_ADD_IMMEDIATE) || (op == IR_SUB_IMMEDIATE)) return (size == 1) && (value != 1);
+
+    // Pairs are cleared by moving zero, any other shift needs the accumulator
+    if ((op == IR_LEFT_SHIFT_IMMEDIATE) || (op == IR_RIGHT_SHIFT_IMMEDIATE)) return (size == 1) || ((value != 0) && (value < 16));
+    return 0;
+}
+
+// An 8-bit commutative operation can take its right operand in the accumulator as long as it is
+// used up, the left one is worked on there instead and the result moved back
+int ir_swaps_operands(struct Instruction* instruction) {
+    return is_commutative(instruction->op) && (instruction->dest->size == 1);
+}
+
+// Tail calls leave the function, only its own labels are jumped to
+static struct Block* find_block(struct Function* function, char* label, int count) {
+    for (struct Block* block = function->blocks; block != NULL; block = block->next) {
+        struct Instruction* instruction = block->first;
+        if (instruction == function->first) continue;
+        if ((instruction->op == IR_LABEL) && (instruction->number == count) && (strcmp(instruction->text, label) == 0)) return block;
+    }
+    return NULL;
+}
+
+static void add_edge(struct Block* from, struct Block* to, int slot) {
+    from->successors[slot] = to;
+    to->predecessors = realloc(to->predecessors, (to->predecessor_count + 1) * sizeof(struct Block*));
+    to->predecessors[to->predecessor_count++] = from;
+}
+
+// Any blocks built before are freed, instructions may have moved since
+void build_blocks(struct Function* function) {
+    struct Block* block = function->blocks;
+    while (block != NULL) {
+        struct Block* next = block->next;
+        free(block->predecessors);
+        free(block);
+        block = next;
+    }
+    function->blocks = NULL;
+    function->block_count = 0;
+
+    for (struct Instruction* instruction = function->first; instruction != function->last->next; instruction = instruction->next) {
+        int ends_block = (block != NULL) && (is_jump(block->last->op) || (block->last->op == IR_RETURN));
+        if ((block == NULL) || ends_block || (instruction->op == IR_LABEL)) {
+            struct Block* new_block = calloc(1, sizeof(struct Block));
+            new_block->first = instruction;
+            new_block->index = function->block_count++;
+            if (block == NULL) function->blocks = new_block;
+            else block->next = new_block;
+            block = new_block;
+        }
+        block->last = instruction;
+    }
+
+    for (block = function->blocks; block != NULL; block = block->next) {
+        struct Instruction* last = block->last;
+        if (is_jump(last->op)) {
+            struct Block* target = find_block(function, last->text, last->number);
+            if (target != NULL) add_edge(block, target, 0);
+        }
+        if ((last->op != IR_JUMP) && (last->op != IR_RETURN) && (block->next != NULL)) add_edge(block, block->next, 1);
+    }
+}
+
+static int routines_used[ROUTINE_COUNT];
+
+static void find_routines() {
+    for (struct Instruction* instruction = first_instructions[SECTION_CODE]; instruction != NULL; instruction = instruction->next) {
+        enum IrOp op = instruction->op;
+        int size = (instruction->dest != NULL) ? instruction->dest->size : 0;
+        int multiply = (op == IR_MULTIPLY) || ((op == IR_MULTIPLY_IMMEDIATE) && (instruction->src == NULL));
+        if (multiply) routines_used[(size == 1) ? ROUTINE_MULTIPLY_U8 : ROUTINE_MULTIPLY_U16] = 1;
+        else if ((op == IR_DIVIDE) || (op == IR_MODULO)) routines_used[(size == 1) ? ROUTINE_DIVIDE_U8 : ROUTINE_DIVIDE_U16] = 1;
+    }
+}
+
+static struct Register* physical(struct VirtualRegister* reg) {
+    if (reg == NULL) return NULL;
+    if (reg->reg == NULL) error(NULL, "internal error: virtual register %d has no register", reg->number);
+    return reg->reg;
+}
+
+static struct Register* lower_binary(enum IrOp op, FILE* fp, struct Register* dest, struct Register* src) {
+    switch (op) {
+        case IR_ADD: return emit_add(fp, dest, src);
+        case IR_SUB: return emit_sub(fp, dest, src);
+        case IR_AND: return emit_and(fp, dest, src);
+        case IR_OR: return emit_or(fp, dest, src);
+        case IR_LEFT_SHIFT: return emit_left_shift(fp, dest, src);
+        case IR_RIGHT_SHIFT: return emit_right_shift(fp, dest, src);
+        case IR_MULTIPLY: return emit_multiply(fp, dest, src);
+        case IR_DIVIDE: return emit_divide(fp, dest, src);
+        case IR_MODULO: return emit_modulo(fp, dest, src);
+        case IR_IS_MORE: return emit_is_more(fp, dest, src);
+        case IR_IS_LESS: return emit_is_less(fp, dest, src);
+        case IR_IS_MORE_EQUAL: return emit_is_more_or_equal(fp, dest, src);
+        case IR_IS_LESS_EQUAL: return emit_is_less_or_equal(fp, dest, src);
+        case IR_IS_EQUAL: return emit_is_equal(fp, dest, src);
+        case IR_IS_NOT_EQUAL: return emit_is_not_equal(fp, dest, src);
+        default: error(NULL, "invalid binary instruction");
+    }
+    return dest;
+}
+
+// Pushed since the frame was reserved, frame slots are that much further from sp
+static int depth = 0;
+
+static void lower(struct Instruction* instruction, FILE* fp) {
+    struct Register* dest = physical(instruction->dest);
+    struct Register* src = physical(instruction->src);
+    struct Register* accumulator = &registers[REG_A];
+    enum IrOp op = instruction->op;
+
+    if (is_binary(op)) {
+        if ((dest->size == 1) && (src == accumulator) && ir_swaps_operands(instruction)) {
+            lower_binary(op, fp, accumulator, dest);
+            emit_move(fp, dest, accumulator);
+            return;
+        }
+
+        // 16-bit comparisons leave their result in the low half
+        struct Register* result = lower_binary(op, fp, dest, src);
+        if (result != dest) emit_immediate_load(fp, dest->high_reg, "0");
+        return;
+    }
+
+    // Only pairs can be compared or multiplied outside the accumulator
+    int through_accumulator = (dest != NULL) && (dest->size == 1) && (dest != accumulator) && ((op == IR_MULTIPLY_IMMEDIATE) || (op == IR_TEST) || (op == IR_COMPARE));
+    if (through_accumulator) {
+        emit_move(fp, accumulator, dest);
+        dest = accumulator;
+    }
+
+    switch (op) {
+        case IR_LABEL: emit_label(fp, instruction->text, instruction->number); break;
+        case IR_DATA: emit_data(fp, instruction->text); break;
+        case IR_MOVE:
+            if (dest != src) emit_move(fp, dest, src);
+            break;
+        case IR_IMMEDIATE: emit_immediate_load(fp, dest, instruction->text); break;
+        case IR_FRAME_ADDRESS: emit_frame_address(fp, dest, instruction->number + depth, instruction->text); break;
+        case IR_LOAD: emit_indirect_load(fp, dest, src); break;
+        case IR_STORE: emit_indirect_store(fp, dest, src); break;
+        case IR_PUSH:
+            emit_push(fp, src);
+            depth += src->size;
+            break;
+        case IR_POP:
+            emit_pop(fp, dest);
+            depth -= dest->size;
+            break;
+        case IR_STACK:
+            if (instruction->number < 0) emit_stack_reserve(fp, -instruction->number);
+            else emit_stack_free(fp, instruction->number);
+            depth -= instruction->number;
+            break;
+        case IR_EXTEND:
+            if (dest->low_reg != src) emit_move(fp, dest->low_reg, src);
+            emit_immediate_load(fp, dest->high_reg, "0");
+            break;
+        case IR_TRUNCATE:
+            if (dest != src->low_reg) emit_move(fp, dest, src->low_reg);
+            break;
+        case IR_ADD_IMMEDIATE: emit_add_immediate(fp, dest, instruction->number); break;
+        case IR_SUB_IMMEDIATE: emit_sub_immediate(fp, dest, instruction->number); break;
+        case IR_LEFT_SHIFT_IMMEDIATE: emit_left_shift_immediate(fp, dest, instruction->number); break;
+        case IR_RIGHT_SHIFT_IMMEDIATE: emit_right_shift_immediate(fp, dest, instruction->number); break;
+        case IR_MULTIPLY_IMMEDIATE: emit_multiply_immediate(fp, dest, src, instruction->number); break;
+        case IR_TEST: emit_cmp_zero(fp); break;
+        case IR_COMPARE:
+            if (src == NULL) emit_cmp_immediate(fp, dest, instruction->text);
+            else emit_cmp(fp, dest, src);
+            break;
+        case IR_JUMP: emit_jump(fp, instruction->text, instruction->number); break;
+        case IR_JUMP_IF_EQUAL: emit_jump_if_equal(fp, instruction->text, instruction->number); break;
+        case IR_JUMP_IF_NOT_EQUAL: emit_jump_if_not_equal(fp, instruction->text, instruction->number); break;
+        case IR_JUMP_IF_CARRY: emit_jump_if_carry(fp, instruction->text, instruction->number); break;
+        case IR_JUMP_IF_NOT_CARRY: emit_jump_if_not_carry(fp, instruction->text, instruction->number); break;
+        case IR_CALL: emit_call(fp, instruction->text, -1); break;
+        case IR_RETURN: emit_return(fp); break;
+        case IR_ENTER: depth = 0; break;
+        case IR_RESERVE:
+            if (instruction->number != 0) emit_stack_reserve(fp, instruction->number);
+            depth = 0;
+            break;
+        case IR_RELEASE:
+            if (instruction->number != 0) emit_stack_free(fp, instruction->number);
+            break;
+        case IR_SAVE:
+        case IR_RESTORE:
+            // Register allocation replaced them with pushes and pops
+            break;
+        case IR_ZERO_FILL: emit_zero_fill(fp, instruction->text, "heap_start"); break;
+        case IR_ROUTINE:
+            if (routines_used[instruction->number]) emit_routine(fp, instruction->number);
+            break;
+        default: error(NULL, "invalid instruction");
+    }
+
+    if (through_accumulator && (op == IR_MULTIPLY_IMMEDIATE)) emit_move(fp, physical(instruction->dest), accumulator);
+}
+
+void lower_ir(FILE* fp) {
+    find_routines();
+
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        for (struct Instruction* instruction = first_instructions[i]; instruction != NULL; instruction = instruction->next) {
+            lower(instruction, fp);
+        }
+    }
+
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        first_instructions[i] = NULL;
+        last_instructions[i] = NULL;
+    }
+    for (int i = 0; i < ROUTINE_COUNT; i++) routines_used[i] = 0;
+    section = SECTION_CODE;
+}
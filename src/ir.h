@@ -0,0 +1,178 @@
+#ifndef _IR_H
+#define _IR_H
+
+struct _IO_FILE;
+typedef struct _IO_FILE FILE;
+
+struct Register;
+struct Symbol;
+struct Token;
+
+// Laid out in this order, data of every kind follows the code
+enum Section {
+    SECTION_CODE,
+    SECTION_RODATA,         // String literals
+    SECTION_DATA,           // Globals with an initial value
+    SECTION_BSS,            // Globals that start as zero
+    SECTION_COUNT
+};
+
+enum IrOp {
+    IR_LABEL,               // text_count:
+    IR_DATA,                // Raw assembler line, directives and reserved space
+    IR_MOVE,                // dest = src
+    IR_IMMEDIATE,           // dest = text, a number or an address
+    IR_FRAME_ADDRESS,       // dest = address of the frame slot at number, text names it
+    IR_LOAD,                // dest = [src]
+    IR_STORE,               // [dest] = src
+    IR_PUSH,                // push src
+    IR_POP,                 // pop dest
+    IR_STACK,               // sp = sp + number
+    IR_EXTEND,              // dest = src widened to 16 bits
+    IR_TRUNCATE,            // dest = low byte of src
+    IR_ADD,                 // dest = dest op src
+    IR_SUB,
+    IR_AND,
+    IR_OR,
+    IR_LEFT_SHIFT,          // The count in src is used up
+    IR_RIGHT_SHIFT,
+    IR_MULTIPLY,            // Through a runtime routine
+    IR_DIVIDE,
+    IR_MODULO,
+    IR_IS_MORE,             // dest = dest op src, 1 or 0
+    IR_IS_LESS,
+    IR_IS_MORE_EQUAL,
+    IR_IS_LESS_EQUAL,
+    IR_IS_EQUAL,
+    IR_IS_NOT_EQUAL,
+    IR_ADD_IMMEDIATE,       // dest = dest + number
+    IR_SUB_IMMEDIATE,
+    IR_LEFT_SHIFT_IMMEDIATE,
+    IR_RIGHT_SHIFT_IMMEDIATE,
+    IR_MULTIPLY_IMMEDIATE,  // dest = dest * number, src is scratch for a copy or NULL to call the routine
+    IR_TEST,                // Set flags from dest against zero
+    IR_COMPARE,             // Set flags from dest against src, or against text when src is NULL
+    IR_JUMP,                // Jumps go to text_count
+    IR_JUMP_IF_EQUAL,
+    IR_JUMP_IF_NOT_EQUAL,
+    IR_JUMP_IF_CARRY,
+    IR_JUMP_IF_NOT_CARRY,
+    IR_CALL,                // call text, the result comes back in dest
+    IR_RETURN,
+    IR_ENTER,               // Arguments arrive in their registers
+    IR_RESERVE,             // Reserve the rest of the frame below what was pushed on entry, number bytes
+    IR_RELEASE,             // Free the whole frame, number bytes
+    IR_SAVE,                // Push whatever is live across call number, until its IR_RESTORE
+    IR_RESTORE,
+    IR_ZERO_FILL,           // Clear memory from the text label up to heap_start
+    IR_ROUTINE              // Body of runtime routine number, if anything calls it
+};
+
+// A value the generator works with, it makes as many as it needs. Register allocation
+// gives each a physical register, fixed ones have theirs from the start and are how
+// arguments and results are passed.
+struct VirtualRegister {
+    int number;
+    int size;
+    int fixed;
+    struct Register* reg;
+    struct Symbol* symbol;  // Variable kept in it, NULL for temporaries
+};
+
+struct Instruction {
+    enum IrOp op;
+    struct VirtualRegister* dest;
+    struct VirtualRegister* src;
+    char* text;
+    int number;             // Label suffix, -1 for none, or the offset or value of the op
+    int registers;          // Fixed registers a call, jump or return reads or the entry writes, as 1 << REG_*
+    struct Token* token;    // What it was generated for, remarks point there
+    int index;              // Position in its function, numbered by whichever pass needs it
+
+    struct Instruction* prev;
+    struct Instruction* next;
+};
+
+// A block starts at every label and after every jump or return
+struct Block {
+    struct Instruction* first;
+    struct Instruction* last;
+    int index;
+    struct Block* successors[2];
+    struct Block** predecessors;
+    int predecessor_count;
+    struct Block* next;
+};
+
+struct Function {
+    char* name;
+    struct Instruction* first;  // Its label
+    struct Instruction* last;
+    struct Block* blocks;
+    int block_count;
+    int first_number;           // Virtual registers made for it are numbered from here
+};
+
+struct VirtualRegister* ir_new_reg(int);
+struct VirtualRegister* ir_fixed_reg(int);
+struct VirtualRegister* ir_variable_reg(struct Symbol*);
+int ir_reg_count();
+struct Token* ir_token(struct Token*);
+
+void ir_section(enum Section);
+void ir_begin_function(char*);
+struct Function* ir_end_function();
+void ir_insert_before(struct Instruction*);
+void ir_insert_after(struct Instruction*);
+void ir_append();
+struct Instruction* ir_last();
+void ir_remove(struct Instruction*);
+void ir_reinsert(struct Instruction*, struct Instruction*);
+
+void ir_label(char*, int);
+void ir_data(char*, ...);
+void ir_move(struct VirtualRegister*, struct VirtualRegister*);
+void ir_immediate(struct VirtualRegister*, char*);
+void ir_frame_address(struct VirtualRegister*, int, char*);
+void ir_load(struct VirtualRegister*, struct VirtualRegister*);
+void ir_store(struct VirtualRegister*, struct VirtualRegister*);
+void ir_push(struct VirtualRegister*);
+void ir_pop(struct VirtualRegister*);
+void ir_stack(int);
+void ir_extend(struct VirtualRegister*, struct VirtualRegister*);
+void ir_truncate(struct VirtualRegister*, struct VirtualRegister*);
+void ir_binary(enum IrOp, struct VirtualRegister*, struct VirtualRegister*);
+void ir_add_immediate(struct VirtualRegister*, int);
+void ir_sub_immediate(struct VirtualRegister*, int);
+void ir_left_shift_immediate(struct VirtualRegister*, int);
+void ir_right_shift_immediate(struct VirtualRegister*, int);
+void ir_multiply_immediate(struct VirtualRegister*, struct VirtualRegister*, int);
+void ir_routines();
+void ir_test(struct VirtualRegister*);
+void ir_compare(struct VirtualRegister*, struct VirtualRegister*, char*);
+void ir_jump(enum IrOp, char*, int);
+void ir_exit_jump(char*, int, int);
+void ir_call(char*, int, struct VirtualRegister*, int);
+void ir_return(int);
+void ir_enter(int);
+void ir_reserve(int);
+void ir_release(int);
+int ir_save();
+void ir_restore(int);
+void ir_zero_fill(char*);
+
+// Most registers an instruction reads or writes, arguments and results included
+#define MAX_OPERANDS 8
+
+int is_jump(enum IrOp);
+int is_binary(enum IrOp);
+int is_immediate_op(enum IrOp);
+int ir_uses(struct Instruction*, struct VirtualRegister**);
+int ir_defs(struct Instruction*, struct VirtualRegister**);
+int ir_uses_accumulator(struct Instruction*);
+int ir_swaps_operands(struct Instruction*);
+
+void build_blocks(struct Function*);
+void lower_ir(FILE*);
+
+#endif
@@ -0,0 +1,321 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "ivopts.h"
+#include "lexer.h"
+#include "parser.h"
+#include "remarks.h"
+#include "scope.h"
+#include "symbol.h"
+#include "type.h"
+#include "list.h"
+
+// Strength reduction on while loops directly inside a block, inner loops first.
+// A counter multiplied or shifted by a constant is replaced with a second counter
+// stepped by the product wherever the first one is stepped, a local declared in front
+// of the loop that regalloc can keep in a register.
+//
+// Memory is only reached through a pointer in bc or de, so a loop that loads or
+// stores leaves about one pair for its variables. A running total only pays for
+// itself if the loop leaves room for it there.
+
+#define REGISTER_BYTES 2
+
+struct Loop {
+    struct Node* node;
+    struct Scope* scope;        // Where the loop is, anything declared deeper starts again each iteration
+    struct List** insert;       // Declarations go in front of this entry
+
+    struct List* assigned;      // Symbols assigned anywhere in the loop
+    struct List* used;          // Locals the loop reads or writes that could be in registers
+    int demand;                 // Bytes of register those need
+};
+
+static struct List* exposed = NULL;    // Symbols whose address is taken
+static int changes;
+
+static int contains(struct List* list, void* value) {
+    for (; list != NULL; list = list->next) {
+        if (list->value == value) return 1;
+    }
+    return 0;
+}
+
+static void find_exposed(struct Node** slot, void* data) {
+    struct Node* node = *slot;
+    if ((node->kind == N_UNARY) && (node->token->kind == TK_AMPERSAND) && !contains(exposed, node->UnaryOp.left->Variable.symbol)) {
+        list_add(&exposed, node->UnaryOp.left->Variable.symbol);
+    }
+    for_each_child(node, find_exposed, data);
+}
+
+static void summarize(struct Node** slot, void* data) {
+    struct Node* node = *slot;
+    struct Loop* loop = data;
+
+    if (node->kind == N_ASSIGNMENT) {
+        if (node->Assignment.left->kind == N_VARIABLE) list_add(&loop->assigned, node->Assignment.left->Variable.symbol);
+    } else if (node->kind == N_INC_DEC) {
+        list_add(&loop->assigned, node->IncDec.variable->Variable.symbol);
+    } else if ((node->kind == N_VARIABLE) && !node->Variable.symbol->global && !contains(exposed, node->Variable.symbol) && !contains(loop->used, node->Variable.symbol)) {
+        list_add(&loop->used, node->Variable.symbol);
+        loop->demand += node->type->size;
+    }
+
+    for_each_child(node, summarize, data);
+}
+
+static int count_assignments(struct Loop* loop, struct Symbol* symbol) {
+    int count = 0;
+    for (struct List* entry = loop->assigned; entry != NULL; entry = entry->next) {
+        if (entry->value == symbol) count++;
+    }
+    return count;
+}
+
+static int declared_outside(struct Loop* loop, struct Symbol* symbol) {
+    if (symbol->global) return 1;
+    for (struct Scope* scope = loop->scope; scope != NULL; scope = scope->parent_scope) {
+        if (contains(scope->symbol_list, symbol)) return 1;
+    }
+    return 0;
+}
+
+static struct Node* new_node_like(struct Node* original, enum NodeKind kind, struct Type* type) {
+    struct Node* node = calloc(1, sizeof(struct Node));
+    node->token = original->token;
+    node->kind = kind;
+    node->type = type;
+    node->scope = original->scope;
+    return node;
+}
+
+static struct Node* new_variable(struct Node* original, struct Symbol* symbol) {
+    struct Node* node = new_node_like(original, N_VARIABLE, symbol->type);
+    node->Variable.symbol = symbol;
+    return node;
+}
+
+static struct Node* new_assignment(struct Node* original, struct Symbol* symbol, struct Node* value) {
+    struct Node* node = new_node_like(original, N_ASSIGNMENT, symbol->type);
+    node->Assignment.left = new_variable(original, symbol);
+    node->Assignment.right = value;
+    return node;
+}
+
+// A local in the scope the loop is in, set to value just before the loop
+static struct Symbol* declare_before(struct Loop* loop, char* name, struct Node* value) {
+    struct Symbol* symbol = calloc(1, sizeof(struct Symbol));
+    symbol->token = duplicate_token(value->token);
+    symbol->token->value = name;
+    symbol->type = value->type;
+    symbol->stack_position = loop->scope->stack_size;
+    loop->scope->stack_size += symbol->type->size;
+    list_add(&loop->scope->symbol_list, symbol);
+
+    struct Node* declaration = new_node_like(loop->node, N_VAR_DECL, symbol->type);
+    declaration->token = symbol->token;
+    declaration->VarDecl.symbol = symbol;
+    declaration->VarDecl.assignment = new_assignment(loop->node, symbol, value);
+
+    struct List* entry = calloc(1, sizeof(struct List));
+    entry->value = declaration;
+    entry->next = *loop->insert;
+    *loop->insert = entry;
+    loop->insert = &entry->next;
+    return symbol;
+}
+
+// The symbol a statement steps by a constant and by how much, NULL if it doesn't
+static struct Symbol* induction_step(struct Node* statement, int* step) {
+    if (statement->kind == N_INC_DEC) {
+        *step = (statement->token->kind == TK_INC) ? 1 : -1;
+        return statement->IncDec.variable->Variable.symbol;
+    }
+    if ((statement->kind != N_ASSIGNMENT) || (statement->Assignment.left->kind != N_VARIABLE)) return NULL;
+
+    struct Symbol* symbol = statement->Assignment.left->Variable.symbol;
+    struct Node* value = statement->Assignment.right;
+
+    if ((value->kind != N_BINOP) || ((value->token->kind != TK_PLUS) && (value->token->kind != TK_MINUS))) return NULL;
+    if ((value->BinOp.left->kind != N_VARIABLE) || (value->BinOp.left->Variable.symbol != symbol) || (value->BinOp.right->kind != N_NUMBER)) return NULL;
+    *step = number_value(value->BinOp.right);
+    if (value->token->kind == TK_MINUS) *step = -*step;
+    return symbol;
+}
+
+// How much a use of the counter changes when it is stepped once, 0 if it isn't one worth replacing
+static int derived_factor(struct Node* node, struct Symbol* symbol) {
+    if ((node->kind != N_BINOP) || (node->type->size != symbol->type->size)) return 0;
+
+    struct Node* left = node->BinOp.left;
+    struct Node* right = node->BinOp.right;
+    if ((node->token->kind == TK_ASTERISK) && (left->kind == N_NUMBER)) {
+        struct Node* swap = left;
+        left = right;
+        right = swap;
+    }
+    if ((left->kind != N_VARIABLE) || (left->Variable.symbol != symbol) || (right->kind != N_NUMBER)) return 0;
+
+    // Shifting once is already as cheap as adding
+    int value = number_value(right);
+    if (node->token->kind == TK_ASTERISK) return value;
+    if ((node->token->kind == TK_LSHIFT) && (value >= 2) && (value < 16)) return 1 << value;
+    return 0;
+}
+
+struct Derived {
+    struct Loop* loop;
+    struct Symbol* symbol;
+    int factor;
+    struct Symbol* total;
+};
+
+static void replace_derived(struct Node** slot, void* data) {
+    struct Node* node = *slot;
+    struct Derived* derived = data;
+
+    if (node->kind == N_INC_DEC) return;
+    if (node->kind == N_ASSIGNMENT) {
+        struct Node* left = node->Assignment.left;
+        if (left->kind == N_UNARY) replace_derived(&left->UnaryOp.left, data);
+        replace_derived(&node->Assignment.right, data);
+        return;
+    }
+
+    int factor = derived_factor(node, derived->symbol);
+    if ((factor != 0) && ((derived->total == NULL) || (factor == derived->factor))) {
+        if (derived->total == NULL) {
+            struct Loop* loop = derived->loop;
+            // 16-bit multiplies call a routine, a total on the stack still beats that
+            int routine = (node->token->kind == TK_ASTERISK) && (node->type->size == 2);
+            if ((loop->demand + node->type->size > REGISTER_BYTES) && !routine) {
+                remark(RK_MISSED, "ivopts", "NoRegister", node->token, "'%s' times %d left as no register would be free for a running total", derived->symbol->token->value, factor);
+                return;
+            }
+            loop->demand += node->type->size;
+
+            derived->factor = factor;
+            derived->total = declare_before(loop, "induction", node);
+            remark(RK_PASSED, "ivopts", "StrengthReduced", node->token, "'%s' times %d replaced by adding to a running total", derived->symbol->token->value, factor);
+        }
+        *slot = new_variable(node, derived->total);
+        changes++;
+        return;
+    }
+
+    if ((node->kind == N_UNARY) && (node->token->kind == TK_AMPERSAND)) return;
+    for_each_child(node, replace_derived, data);
+}
+
+// After every step of the counter the total is stepped by the same amount times the factor
+static void step_total(struct Node* body, struct Derived* derived) {
+    int mask = (derived->total->type->size == 2) ? 0xffff : 0xff;
+
+    for (struct List* entry = body->Block.statements; entry != NULL; entry = entry->next) {
+        int step;
+        struct Node* statement = entry->value;
+        if (induction_step(statement, &step) != derived->symbol) continue;
+
+        char buffer[8];
+        sprintf(buffer, "%d", (step * derived->factor) & mask);
+        struct Node* amount = new_node_like(statement, N_NUMBER, derived->total->type);
+        amount->token = duplicate_token(statement->token);
+        amount->token->kind = TK_NUMBER;
+        amount->token->value = strdup(buffer);
+        amount->constant = 1;
+
+        struct Node* sum = new_node_like(statement, N_BINOP, derived->total->type);
+        sum->token = duplicate_token(statement->token);
+        sum->token->kind = TK_PLUS;
+        sum->token->value = "+";
+        sum->BinOp.left = new_variable(statement, derived->total);
+        sum->BinOp.right = amount;
+
+        struct List* added = calloc(1, sizeof(struct List));
+        added->value = new_assignment(statement, derived->total, sum);
+        added->next = entry->next;
+        entry->next = added;
+        entry = added;
+    }
+}
+
+static void reduce_strength(struct Loop* loop) {
+    struct Node* body = loop->node->While.loop_statement;
+    if (body->kind != N_BLOCK) return;
+
+    // Counters are stepped only where the body can step the total too
+    struct List* counters = NULL;
+    for (struct List* entry = body->Block.statements; entry != NULL; entry = entry->next) {
+        int step;
+        struct Symbol* symbol = induction_step(entry->value, &step);
+        if ((symbol == NULL) || contains(counters, symbol)) continue;
+
+        int updates = 0;
+        for (struct List* other = body->Block.statements; other != NULL; other = other->next) {
+            if (induction_step(other->value, &step) == symbol) updates++;
+        }
+        if (symbol->global || contains(exposed, symbol) || !declared_outside(loop, symbol)) continue;
+        if ((symbol->type->kind != TY_CHAR) && (symbol->type->kind != TY_INT)) continue;
+        if (updates == count_assignments(loop, symbol)) list_add(&counters, symbol);
+    }
+
+    for (struct List* entry = counters; entry != NULL; entry = entry->next) {
+        // One total for each factor, a second pass picks up any other
+        while (1) {
+            struct Derived derived = {.loop = loop, .symbol = entry->value};
+            replace_derived(&loop->node->While.expr, &derived);
+            replace_derived(&loop->node->While.loop_statement, &derived);
+            if (derived.total == NULL) break;
+            step_total(body, &derived);
+        }
+    }
+}
+
+static void optimize_statement(struct Node* node);
+
+static void optimize_block(struct Node* block) {
+    for (struct List** link = &block->Block.statements; *link != NULL; link = &(*link)->next) {
+        struct Node* statement = (*link)->value;
+        optimize_statement(statement);
+        if (statement->kind != N_WHILE) continue;
+
+        struct Loop loop = {.node = statement, .scope = block->scope, .insert = link};
+        summarize(&loop.node, &loop);
+        reduce_strength(&loop);
+
+        while ((*link)->value != statement) link = &(*link)->next;
+    }
+}
+
+static void optimize_statement(struct Node* node) {
+    switch (node->kind) {
+        case N_BLOCK:
+            optimize_block(node);
+            break;
+        case N_IF:
+            optimize_statement(node->If.true_statement);
+            if (node->If.false_statement != NULL) optimize_statement(node->If.false_statement);
+            break;
+        case N_WHILE:
+            optimize_statement(node->While.loop_statement);
+            break;
+        default:
+            break;
+    }
+}
+
+int reduce_induction_variables(struct Node* root_node) {
+    changes = 0;
+    exposed = NULL;
+    find_exposed(&root_node, NULL);
+
+    for (struct List* entry = root_node->Program.function_declarations; entry != NULL; entry = entry->next) {
+        struct Node* function = entry->value;
+        set_remark_function(function->token->value);
+        optimize_statement(function->FunctionDecl.block);
+    }
+
+    set_remark_function(NULL);
+    return changes;
+}
@@ -0,0 +1,8 @@
+#ifndef _IVOPTS_H
+#define _IVOPTS_H
+
+struct Node;
+
+int reduce_induction_variables(struct Node*);
+
+#endif
@@ -6,6 +6,7 @@
 #include "messages.h"
 #include "symbol.h"
 #include "type.h"
+#include "list.h"
 
 char* current_filename;
 Token* current_token;
@@ -13,6 +14,9 @@ Token* current_token;
 int current_line;
 int current_column;
 
+// Every file pulled in by #include, each listed once
+static struct List* included_files = NULL;
+
 struct Token* new_token(enum TokenKind kind) {
     struct Token* token = calloc(1, sizeof(Token));
     token->kind = kind;
@@ -73,6 +77,32 @@ char* get_line(struct Token* token) {
     return line;
 }
 
+struct List* get_included_files() {
+    return included_files;
+}
+
+static void add_included_file(char* filename) {
+    struct List* current_entry = included_files;
+    if (current_entry != NULL) {
+        do {
+            if (strcmp((char*)current_entry->value, filename) == 0) return;
+        } while (list_next(&current_entry));
+    }
+    list_add(&included_files, filename);
+}
+
+// Quoted includes are relative to the including file
+static char* resolve_include(char* filename) {
+    char* slash = strrchr(current_filename, '/');
+    if ((slash == NULL) || (filename[0] == '/')) return filename;
+
+    int directory_length = slash - current_filename + 1;
+    char* path = calloc(directory_length + strlen(filename) + 1, sizeof(char));
+    memcpy(path, current_filename, directory_length);
+    strcat(path, filename);
+    return path;
+}
+
 static void check_preprocessor(FILE* fp, char c) {
     int start_column = current_column;
 
@@ -97,6 +127,9 @@ static void check_preprocessor(FILE* fp, char c) {
             new_filename[i++] = c;
         }
 
+        new_filename = resolve_include(new_filename);
+        add_included_file(new_filename);
+
         // TODO error message from included files are broken
         char* tmp_filename = current_filename;
         char tmp_line = current_line;
@@ -186,6 +219,8 @@ static void check_keyword(FILE* fp, char c) {
     else if (strcmp(value, "else") == 0) add_token(TK_ELSE, value, current_line, start_column);
     else if (strcmp(value, "while") == 0) add_token(TK_WHILE, value, current_line, start_column);
     else if (strcmp(value, "extern") == 0) add_token(TK_EXTERN, value, current_line, start_column);
+    else if (strcmp(value, "inline") == 0) add_token(TK_INLINE, value, current_line, start_column);
+    else if (strcmp(value, "__attribute__") == 0) add_token(TK_ATTRIBUTE, value, current_line, start_column);
     else if (strcmp(value, "NULL") == 0) add_token(TK_NUMBER, "0", current_line, start_column); // Just kinda bodged a NULL in here lol
     else add_token(TK_ID, value, current_line, start_column);
 }
@@ -254,6 +289,7 @@ struct Token* lex(char* _filename) {
         if (c == '-') {add_token(TK_MINUS, "-", current_line, current_column); continue;}
         if (c == '*') {add_token(TK_ASTERISK, "*", current_line, current_column); continue;}
         if (c == '/') {add_token(TK_DIV, "/", current_line, current_column); continue;}
+        if (c == '%') {add_token(TK_PERCENT, "%", current_line, current_column); continue;}
         if (c == '=') {add_token(TK_ASSIGN, "=", current_line, current_column); continue;}
         if (c == ';') {add_token(TK_SEMICOLON, ";", current_line, current_column); continue;}
         if (c == '>') {add_token(TK_MORE, ">", current_line, current_column); continue;}
@@ -263,7 +299,7 @@ struct Token* lex(char* _filename) {
 
         // Check multi character tokens
         if (isdigit(c)) {check_numeric(fp, c); continue;}
-        if (isalpha(c)) {check_keyword(fp, c); continue;}
+        if (isalpha(c) || (c == '_')) {check_keyword(fp, c); continue;}
         if (c == '\'') {check_char_literal(fp, c); continue;}
         if (c == '\"') {check_string_literal(fp, c); continue;}
 
@@ -0,0 +1,595 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "licm.h"
+#include "ir.h"
+#include "lexer.h"
+#include "parser.h"
+#include "pass.h"
+#include "remarks.h"
+#include "symbol.h"
+#include "list.h"
+
+// Loop-invariant code motion over a function's IR, before register allocation.
+// Dominators are solved over the blocks. An edge to a block that dominates where it
+// comes from closes a natural loop, made of that header and every block reaching
+// the edge without going through it. Inner loops go first so what they move out
+// can keep going.
+//
+// A temporary written in one place in the loop from nothing the loop changes has
+// the same value every time round, so its instructions move to the preheader. That
+// is the end of the only block outside the loop going to the header, or the
+// fall-through of a guard jumping past the loop, so it only runs when the loop does.
+//
+// Loads only move from a global or frame slot the loop can't write. A call may
+// write any global and any slot whose address is taken, a store through a pointer
+// any of those whose address is taken. Loads through a pointer stay, they may read
+// a device. Divides and routine multiplies cost a lot and a divide by zero goes
+// wrong, they only move if they run whenever the loop is entered. Copies and
+// constants are cheap to redo and only move for something that isn't.
+
+// Where a load or store goes, a global or string by name or a frame slot by offset
+struct Location {
+    char* name;
+    int slot;
+};
+
+struct Loop {
+    struct Block* header;
+    unsigned* body;                 // Its blocks by index
+    struct Instruction* preheader;  // Moved instructions go after this one, NULL if there is nowhere
+    int has_call;
+    int has_pointer_store;
+    struct List* stores;            // Each struct Location stored to
+};
+
+// The writes of one temporary, they move together
+struct Chain {
+    struct VirtualRegister* reg;
+    struct List* instructions;
+    int worth;                      // Saves more than keeping the register costs, or something that does needs it
+};
+
+static struct Function* function;
+static struct List* private_globals = NULL;     // Symbols of globals whose address is never taken
+
+static struct Block** blocks = NULL;
+static unsigned** dominators = NULL;
+static int dominator_count = 0;
+static int words;
+
+static int* def_counts = NULL;                  // By register number, writes in the whole function
+static struct Instruction** defs = NULL;        // The last of those writes
+static int* loop_defs = NULL;                   // Writes in the loop not moved out of it
+static struct List* exposed_slots;              // Each struct Instruction whose frame address goes elsewhere
+static struct List* chains;                     // Each struct Chain that can move, in the order found
+
+static int has(unsigned* set, int index) {
+    return (set[index / 32] >> (index % 32)) & 1;
+}
+
+static void add(unsigned* set, int index) {
+    set[index / 32] |= 1u << (index % 32);
+}
+
+static int contains(struct List* list, void* value) {
+    for (; list != NULL; list = list->next) {
+        if (list->value == value) return 1;
+    }
+    return 0;
+}
+
+static int reads(struct Instruction* instruction, struct VirtualRegister* reg) {
+    struct VirtualRegister* uses[MAX_OPERANDS];
+    int count = ir_uses(instruction, uses);
+    for (int i = 0; i < count; i++) {
+        if (uses[i] == reg) return 1;
+    }
+    return 0;
+}
+
+static int writes(struct Instruction* instruction, struct VirtualRegister* reg) {
+    struct VirtualRegister* regs[MAX_OPERANDS];
+    int count = ir_defs(instruction, regs);
+    for (int i = 0; i < count; i++) {
+        if (regs[i] == reg) return 1;
+    }
+    return 0;
+}
+
+static void find_exposed(struct Node** slot, void* data) {
+    struct Node* node = *slot;
+    if ((node->kind == N_UNARY) && (node->token->kind == TK_AMPERSAND)) list_add((struct List**)data, node->UnaryOp.left->Variable.symbol);
+    for_each_child(node, find_exposed, data);
+}
+
+// Any function may take a global's address, so this looks at the whole program first
+void find_private_globals(struct Node* root_node) {
+    struct List* exposed = NULL;
+    find_exposed(&root_node, &exposed);
+
+    private_globals = NULL;
+    for (struct List* entry = root_node->Program.global_variables; entry != NULL; entry = entry->next) {
+        struct Symbol* symbol = ((struct Node*)entry->value)->VarDecl.symbol;
+        if (!symbol->is_extern && !contains(exposed, symbol)) list_add(&private_globals, symbol);
+    }
+}
+
+static int is_private(char* name) {
+    for (struct List* entry = private_globals; entry != NULL; entry = entry->next) {
+        if (strcmp(((struct Symbol*)entry->value)->token->value, name) == 0) return 1;
+    }
+    return 0;
+}
+
+static void count_defs() {
+    int count = ir_reg_count();
+    def_counts = realloc(def_counts, count * sizeof(int));
+    defs = realloc(defs, count * sizeof(struct Instruction*));
+    loop_defs = realloc(loop_defs, count * sizeof(int));
+    memset(def_counts, 0, count * sizeof(int));
+
+    for (struct Instruction* instruction = function->first; instruction != function->last->next; instruction = instruction->next) {
+        struct VirtualRegister* regs[MAX_OPERANDS];
+        int def_count = ir_defs(instruction, regs);
+        for (int i = 0; i < def_count; i++) {
+            def_counts[regs[i]->number]++;
+            defs[regs[i]->number] = instruction;
+        }
+    }
+}
+
+static struct Instruction* frame_address(struct VirtualRegister* reg) {
+    if (reg->fixed || (def_counts[reg->number] != 1) || (defs[reg->number]->op != IR_FRAME_ADDRESS)) return NULL;
+    return defs[reg->number];
+}
+
+// A slot is exposed once its address is used for anything but loading or storing there
+static void find_exposed_slots() {
+    exposed_slots = NULL;
+
+    for (struct Instruction* instruction = function->first; instruction != function->last->next; instruction = instruction->next) {
+        if ((instruction->op == IR_FRAME_ADDRESS) && (def_counts[instruction->dest->number] != 1)) list_add(&exposed_slots, instruction);
+
+        struct VirtualRegister* uses[MAX_OPERANDS];
+        int count = ir_uses(instruction, uses);
+        for (int i = 0; i < count; i++) {
+            struct Instruction* address = frame_address(uses[i]);
+            if (address == NULL) continue;
+            if ((instruction->op == IR_LOAD) || ((instruction->op == IR_STORE) && (instruction->src != uses[i]))) continue;
+            list_add(&exposed_slots, address);
+        }
+    }
+}
+
+// Where a pointer written once with a global's or slot's address points, 0 if anywhere else
+static int find_location(struct VirtualRegister* pointer, struct Location* location) {
+    if (pointer->fixed || (def_counts[pointer->number] != 1)) return 0;
+    struct Instruction* def = defs[pointer->number];
+
+    if (def->op == IR_FRAME_ADDRESS) {
+        location->name = NULL;
+        location->slot = def->number;
+        return 1;
+    }
+    // A number is a fixed address, a device may be there
+    if ((def->op == IR_IMMEDIATE) && !isdigit(def->text[0]) && (def->text[0] != '-')) {
+        location->name = def->text;
+        return 1;
+    }
+    return 0;
+}
+
+static int same_location(struct Location* left, struct Location* right) {
+    if ((left->name == NULL) || (right->name == NULL)) return (left->name == right->name) && (left->slot == right->slot);
+    return strcmp(left->name, right->name) == 0;
+}
+
+static int is_exposed(struct Location* location) {
+    if (location->name != NULL) return !is_private(location->name);
+    for (struct List* entry = exposed_slots; entry != NULL; entry = entry->next) {
+        if (((struct Instruction*)entry->value)->number == location->slot) return 1;
+    }
+    return 0;
+}
+
+// Whether something in the loop may write the location, and if so for a reason worth a remark
+static int clobbered(struct Loop* loop, struct Location* location, char** reason) {
+    *reason = NULL;
+    for (struct List* entry = loop->stores; entry != NULL; entry = entry->next) {
+        if (same_location(entry->value, location)) return 1;
+    }
+
+    int exposed = is_exposed(location);
+    if ((location->name != NULL) && loop->has_call) *reason = "a call in the loop may change it";
+    else if (exposed && loop->has_call) *reason = "a call in the loop may change it through its address";
+    else if (exposed && loop->has_pointer_store) *reason = "a store through a pointer in the loop may change it";
+    return *reason != NULL;
+}
+
+// Each block is dominated by itself and whatever dominates all of its predecessors
+static void find_dominators() {
+    for (int i = 0; i < dominator_count; i++) free(dominators[i]);
+    dominator_count = function->block_count;
+    words = (dominator_count + 31) / 32;
+    blocks = realloc(blocks, dominator_count * sizeof(struct Block*));
+    dominators = realloc(dominators, dominator_count * sizeof(unsigned*));
+
+    for (struct Block* block = function->blocks; block != NULL; block = block->next) {
+        blocks[block->index] = block;
+        dominators[block->index] = calloc(words, sizeof(unsigned));
+        if (block == function->blocks) add(dominators[block->index], block->index);
+        else memset(dominators[block->index], 0xff, words * sizeof(unsigned));
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (struct Block* block = function->blocks->next; block != NULL; block = block->next) {
+            unsigned* set = dominators[block->index];
+            for (int word = 0; word < words; word++) {
+                unsigned value = (block->predecessor_count == 0) ? 0 : ~0u;
+                for (int i = 0; i < block->predecessor_count; i++) value &= dominators[block->predecessors[i]->index][word];
+                if (word == block->index / 32) value |= 1u << (block->index % 32);
+                if (value != set[word]) changed = 1;
+                set[word] = value;
+            }
+        }
+    }
+}
+
+static int dominates(struct Block* dominator, struct Block* block) {
+    return has(dominators[block->index], dominator->index);
+}
+
+static void add_to_body(unsigned* body, struct Block* block) {
+    if (has(body, block->index)) return;
+    add(body, block->index);
+    for (int i = 0; i < block->predecessor_count; i++) add_to_body(body, block->predecessors[i]);
+}
+
+// Where instructions run only on the way into the loop, NULL if there is no such place
+static struct Instruction* find_preheader(struct Loop* loop) {
+    struct Block* outside = NULL;
+    for (int i = 0; i < loop->header->predecessor_count; i++) {
+        struct Block* predecessor = loop->header->predecessors[i];
+        if (has(loop->body, predecessor->index)) continue;
+        if ((outside != NULL) && (outside != predecessor)) return NULL;
+        outside = predecessor;
+    }
+    if (outside == NULL) return NULL;
+
+    // Going nowhere else, in front of the jump so it isn't skipped
+    struct Instruction* last = outside->last;
+    int only_header = 1;
+    for (int i = 0; i < 2; i++) {
+        if ((outside->successors[i] != NULL) && (outside->successors[i] != loop->header)) only_header = 0;
+    }
+    if (only_header) return (last->op == IR_JUMP) ? last->prev : last;
+
+    // A guard jumps past the loop and falls through into it
+    if (outside->successors[1] == loop->header) return last;
+    return NULL;
+}
+
+// The loop with the fewest blocks not done yet, an inner loop has fewer than any around it
+static int find_loop(struct Loop* loop, struct List* done) {
+    int best = 0;
+
+    for (struct Block* header = function->blocks; header != NULL; header = header->next) {
+        if (contains(done, header->first)) continue;
+
+        unsigned* body = NULL;
+        for (int i = 0; i < header->predecessor_count; i++) {
+            struct Block* latch = header->predecessors[i];
+            if (!dominates(header, latch)) continue;
+            if (body == NULL) {
+                body = calloc(words, sizeof(unsigned));
+                add(body, header->index);
+            }
+            add_to_body(body, latch);
+        }
+        if (body == NULL) continue;
+
+        int size = 0;
+        for (int i = 0; i < function->block_count; i++) size += has(body, i);
+        if ((best != 0) && (size >= best)) {
+            free(body);
+            continue;
+        }
+
+        if (best != 0) free(loop->body);
+        memset(loop, 0, sizeof(struct Loop));
+        loop->header = header;
+        loop->body = body;
+        best = size;
+    }
+
+    if (best != 0) loop->preheader = find_preheader(loop);
+    return best != 0;
+}
+
+static void summarize(struct Loop* loop) {
+    memset(loop_defs, 0, ir_reg_count() * sizeof(int));
+
+    for (struct Block* block = function->blocks; block != NULL; block = block->next) {
+        if (!has(loop->body, block->index)) continue;
+        for (struct Instruction* instruction = block->first; instruction != block->last->next; instruction = instruction->next) {
+            struct VirtualRegister* regs[MAX_OPERANDS];
+            int count = ir_defs(instruction, regs);
+            for (int i = 0; i < count; i++) loop_defs[regs[i]->number]++;
+
+            struct Location location;
+            if ((instruction->op == IR_CALL) || (instruction->op == IR_ZERO_FILL)) {
+                loop->has_call = 1;
+            } else if (instruction->op != IR_STORE) {
+                continue;
+            } else if (find_location(instruction->dest, &location)) {
+                struct Location* stored = calloc(1, sizeof(struct Location));
+                *stored = location;
+                list_add(&loop->stores, stored);
+            } else {
+                loop->has_pointer_store = 1;
+            }
+        }
+    }
+}
+
+// Whether the block runs every time the loop is entered, before it is left or goes round again
+static int always_runs(struct Loop* loop, struct Block* block) {
+    for (struct Block* other = function->blocks; other != NULL; other = other->next) {
+        if (!has(loop->body, other->index)) continue;
+
+        int leaves = (other->last->op == IR_RETURN) || (is_jump(other->last->op) && (other->successors[0] == NULL));
+        for (int i = 0; i < 2; i++) {
+            struct Block* successor = other->successors[i];
+            if ((successor != NULL) && (!has(loop->body, successor->index) || (successor == loop->header))) leaves = 1;
+        }
+        if (leaves && !dominates(block, other)) return 0;
+    }
+    return 1;
+}
+
+static int is_expensive(struct Instruction* instruction) {
+    enum IrOp op = instruction->op;
+    return (op == IR_DIVIDE) || (op == IR_MODULO) || (op == IR_MULTIPLY) || ((op == IR_MULTIPLY_IMMEDIATE) && (instruction->src == NULL));
+}
+
+static int is_worth_moving(struct Instruction* instruction) {
+    enum IrOp op = instruction->op;
+    if ((op == IR_LOAD) || (op == IR_FRAME_ADDRESS) || is_immediate_op(op)) return 1;
+    return is_binary(op) && (op < IR_IS_MORE);
+}
+
+// Whether a write of reg computes the same thing every time once what it reads has moved out
+static int can_move(struct Loop* loop, struct Block* block, struct Instruction* instruction, struct VirtualRegister* reg, int report) {
+    enum IrOp op = instruction->op;
+    int simple = (op == IR_MOVE) || (op == IR_IMMEDIATE) || (op == IR_FRAME_ADDRESS) || (op == IR_LOAD) || (op == IR_EXTEND) || (op == IR_TRUNCATE);
+    if (!simple && !is_binary(op) && !is_immediate_op(op)) return 0;
+
+    // Shift counts are used up, the copy a multiply works from is its own
+    struct VirtualRegister* regs[MAX_OPERANDS];
+    int count = ir_defs(instruction, regs);
+    if ((count > 1) && ((op != IR_MULTIPLY_IMMEDIATE) || (def_counts[instruction->src->number] != 1))) return 0;
+
+    count = ir_uses(instruction, regs);
+    for (int i = 0; i < count; i++) {
+        if ((regs[i] != reg) && (regs[i]->fixed || (loop_defs[regs[i]->number] != 0))) return 0;
+    }
+
+    struct Token* token = instruction->token;
+    char* name = (token != NULL) ? token->value : "";
+    if (op == IR_LOAD) {
+        struct Location location;
+        char* reason;
+        if (!find_location(instruction->src, &location)) return 0;
+        if (clobbered(loop, &location, &reason)) {
+            if (report && (reason != NULL)) remark(RK_MISSED, "licm", "NotHoisted", token, "'%s' loaded every iteration as %s", name, reason);
+            return 0;
+        }
+    }
+
+    if (is_expensive(instruction) && !always_runs(loop, block)) {
+        if (report) remark(RK_MISSED, "licm", "NotHoisted", token, "invariant '%s' operation left in the loop as the loop may end before reaching it", name);
+        return 0;
+    }
+    return 1;
+}
+
+// The first write of a temporary and the rest after it, NULL unless they can all move
+static struct Chain* find_chain(struct Loop* loop, struct Block* block, struct Instruction* first, int report) {
+    struct VirtualRegister* reg = first->dest;
+    if ((reg == NULL) || reg->fixed || (reg->symbol != NULL) || !writes(first, reg) || reads(first, reg)) return NULL;
+    if (loop_defs[reg->number] != def_counts[reg->number]) return NULL;
+
+    struct Chain* chain = calloc(1, sizeof(struct Chain));
+    chain->reg = reg;
+    int written = 0;
+    for (struct Instruction* instruction = first; ; instruction = instruction->next) {
+        if (writes(instruction, reg)) {
+            if (!can_move(loop, block, instruction, reg, report)) break;
+            list_add(&chain->instructions, instruction);
+            if (is_worth_moving(instruction)) chain->worth = 1;
+            if (++written == def_counts[reg->number]) return chain;
+        } else if (reads(instruction, reg)) {
+            break;
+        }
+        if (instruction == block->last) break;
+    }
+
+    free(chain);
+    return NULL;
+}
+
+// Every chain found lets the ones reading it move too, so this goes round until nothing more does
+static int find_chains(struct Loop* loop, int report) {
+    int found = 0;
+
+    for (struct Block* block = function->blocks; block != NULL; block = block->next) {
+        if (!has(loop->body, block->index)) continue;
+        for (struct Instruction* instruction = block->first; instruction != block->last->next; instruction = instruction->next) {
+            struct Chain* chain = find_chain(loop, block, instruction, report);
+            if (chain == NULL) continue;
+
+            for (struct List* entry = chain->instructions; entry != NULL; entry = entry->next) {
+                struct VirtualRegister* regs[MAX_OPERANDS];
+                int count = ir_defs(entry->value, regs);
+                for (int i = 0; i < count; i++) loop_defs[regs[i]->number]--;
+            }
+            list_add(&chains, chain);
+            found++;
+        }
+    }
+    return found;
+}
+
+// Chains are found before whatever reads them, so going backwards passes on the need
+static void choose(struct List* entry) {
+    if (entry == NULL) return;
+    choose(entry->next);
+
+    struct Chain* chain = entry->value;
+    if (!chain->worth) return;
+    for (struct List* instruction = chain->instructions; instruction != NULL; instruction = instruction->next) {
+        struct VirtualRegister* uses[MAX_OPERANDS];
+        int count = ir_uses(instruction->value, uses);
+        for (struct List* other = chains; other != entry; other = other->next) {
+            struct Chain* needed = other->value;
+            for (int i = 0; i < count; i++) {
+                if (uses[i] == needed->reg) needed->worth = 1;
+            }
+        }
+    }
+}
+
+static void report_hoisted(struct Chain* chain) {
+    struct Instruction* shown = NULL;
+    for (struct List* entry = chain->instructions; entry != NULL; entry = entry->next) {
+        if (is_worth_moving(entry->value)) shown = entry->value;
+    }
+    if ((shown == NULL) || (shown->token == NULL)) return;
+
+    char* name = shown->token->value;
+    if (shown->op == IR_LOAD) remark(RK_PASSED, "licm", "Hoisted", shown->token, "'%s' loaded once before the loop", name);
+    else if (shown->op == IR_FRAME_ADDRESS) remark(RK_PASSED, "licm", "Hoisted", shown->token, "address of '%s' computed once before the loop", shown->text);
+    else remark(RK_PASSED, "licm", "Hoisted", shown->token, "invariant '%s' operation computed once before the loop", name);
+}
+
+static int same_instruction(struct Instruction* left, struct Instruction* right, struct Chain* left_chain, struct Chain* right_chain) {
+    if ((left->op != right->op) || (left->number != right->number) || (left->dest->size != right->dest->size)) return 0;
+    if ((left->text != right->text) && ((left->text == NULL) || (right->text == NULL) || (strcmp(left->text, right->text) != 0))) return 0;
+
+    // Scratch for a multiply is only ever its own
+    if ((left->op == IR_MULTIPLY_IMMEDIATE) && (left->src != NULL)) return right->src != NULL;
+    if ((left->src == left_chain->reg) && (right->src == right_chain->reg)) return 1;
+    return left->src == right->src;
+}
+
+// Two chains computing the same thing from the same registers, loops often read the same global twice
+static int same_chain(struct Chain* left, struct Chain* right) {
+    struct List* left_entry = left->instructions;
+    struct List* right_entry = right->instructions;
+    for (; (left_entry != NULL) && (right_entry != NULL); left_entry = left_entry->next, right_entry = right_entry->next) {
+        if (!same_instruction(left_entry->value, right_entry->value, left, right)) return 0;
+    }
+    return (left_entry == NULL) && (right_entry == NULL);
+}
+
+// Nothing but the chain writes it, so everything else only reads it
+static void replace_reads(struct Chain* chain, struct VirtualRegister* reg) {
+    for (struct Instruction* instruction = function->first; instruction != function->last->next; instruction = instruction->next) {
+        if (instruction->dest == chain->reg) instruction->dest = reg;
+        if (instruction->src == chain->reg) instruction->src = reg;
+    }
+}
+
+static struct Instruction* instruction_at(struct Chain* chain) {
+    return chain->instructions->value;
+}
+
+// Whether every chain the next instruction reads has moved
+static int is_ready(struct Chain* chain) {
+    struct VirtualRegister* uses[MAX_OPERANDS];
+    int count = ir_uses(instruction_at(chain), uses);
+    for (struct List* entry = chains; entry != NULL; entry = entry->next) {
+        struct Chain* other = entry->value;
+        if ((other == chain) || !other->worth || (other->instructions == NULL)) continue;
+        for (int i = 0; i < count; i++) {
+            if (uses[i] == other->reg) return 0;
+        }
+    }
+    return 1;
+}
+
+static int hoist(struct Loop* loop) {
+    if (loop->preheader == NULL) return 0;
+
+    summarize(loop);
+    chains = NULL;
+    while (find_chains(loop, 0) != 0);
+    find_chains(loop, 1);
+    choose(chains);
+
+    int moved = 0;
+    for (struct List* entry = chains; entry != NULL; entry = entry->next) {
+        struct Chain* chain = entry->value;
+        if (!chain->worth) continue;
+        moved++;
+
+        struct Chain* same = NULL;
+        for (struct List* other = chains; (other != entry) && (same == NULL); other = other->next) {
+            if (((struct Chain*)other->value)->worth && same_chain(other->value, chain)) same = other->value;
+        }
+        if (same == NULL) {
+            report_hoisted(chain);
+            continue;
+        }
+
+        for (struct List* instruction = chain->instructions; instruction != NULL; instruction = instruction->next) ir_remove(instruction->value);
+        replace_reads(chain, same->reg);
+        chain->worth = 0;
+    }
+
+    // In the order they were written as far as what they read allows, so nothing is kept longer than before
+    int index = 0;
+    for (struct Instruction* instruction = function->first; instruction != function->last->next; instruction = instruction->next) instruction->index = index++;
+
+    struct Instruction* after = loop->preheader;
+    while (1) {
+        struct Chain* next = NULL;
+        for (struct List* entry = chains; entry != NULL; entry = entry->next) {
+            struct Chain* chain = entry->value;
+            if (!chain->worth || (chain->instructions == NULL) || !is_ready(chain)) continue;
+            if ((next == NULL) || (instruction_at(chain)->index < instruction_at(next)->index)) next = chain;
+        }
+        if (next == NULL) break;
+
+        ir_reinsert(instruction_at(next), after);
+        after = instruction_at(next);
+        next->instructions = next->instructions->next;
+    }
+    return moved;
+}
+
+void move_loop_invariants(struct Function* optimized) {
+    clock_t start = clock();
+    function = optimized;
+    count_defs();
+    find_exposed_slots();
+
+    int moved = 0;
+    struct List* done = NULL;   // The first instruction of each header
+    struct Loop loop;
+    while (1) {
+        build_blocks(function);
+        find_dominators();
+        if (!find_loop(&loop, done)) break;
+
+        list_add(&done, loop.header->first);
+        moved += hoist(&loop);
+        free(loop.body);
+    }
+
+    record_pass("licm", moved, (double)(clock() - start) / CLOCKS_PER_SEC);
+}
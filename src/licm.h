@@ -0,0 +1,10 @@
+#ifndef _LICM_H
+#define _LICM_H
+
+struct Node;
+struct Function;
+
+void find_private_globals(struct Node*);
+void move_loop_invariants(struct Function*);
+
+#endif
@@ -1,14 +1,39 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include "depend.h"
 #include "generator.h"
+#include "globaldce.h"
+#include "inline.h"
+#include "interp.h"
 #include "lexer.h"
 #include "messages.h"
 #include "parser.h"
+#include "pass.h"
+#include "peephole.h"
+#include "remarks.h"
+
+// Copy of filename with its extension swapped for a new one
+static char* replace_extension(char* filename, char* extension) {
+    char* new_filename = calloc(strlen(filename)+strlen(extension)+1, sizeof(char));
+    strcpy(new_filename, filename);
+    char *p = strrchr(new_filename, '.');
+    if ((p != NULL) && (strchr(p, '/') == NULL)) *p = '\0';
+    strcat(new_filename, extension);
+    return new_filename;
+}
 
 int main(int argc, char **argv) {
     char* input_filename = NULL;
     char* output_filename = NULL;
+    char* record_filename = NULL;
+    int interpret_only = 0;
+    int show_statistics = 0;
+    char* dependency_filename = NULL;
+    char* dependency_target = NULL;
+    int dependencies_only = 0;
+    int write_dependency_file = 0;
+    int phony_targets = 0;
 
     // Process arguments
     int i = 1;
@@ -17,6 +42,62 @@ int main(int argc, char **argv) {
             if (argc <= (i+1)) error(NULL, "flag given with no value");
             output_filename = argv[i+1];
             i += 2;
+        } else if (strcmp(argv[i], "-M") == 0) {
+            dependencies_only = 1;
+            i += 1;
+        } else if (strcmp(argv[i], "-MD") == 0) {
+            write_dependency_file = 1;
+            i += 1;
+        } else if (strcmp(argv[i], "-MP") == 0) {
+            phony_targets = 1;
+            i += 1;
+        } else if (strcmp(argv[i], "-u") == 0) {
+            // Keep a function or global even if nothing in the program uses it
+            if (argc <= (i+1)) error(NULL, "flag given with no value");
+            keep_symbol(argv[i+1]);
+            i += 2;
+        } else if (strcmp(argv[i], "-MF") == 0) {
+            if (argc <= (i+1)) error(NULL, "flag given with no value");
+            dependency_filename = argv[i+1];
+            i += 2;
+        } else if (strcmp(argv[i], "-MT") == 0) {
+            if (argc <= (i+1)) error(NULL, "flag given with no value");
+            dependency_target = argv[i+1];
+            i += 2;
+        } else if (strncmp(argv[i], "-Rpass=", 7) == 0) {
+            set_remark_filter(RK_PASSED, argv[i]+7);
+            i += 1;
+        } else if (strncmp(argv[i], "-Rpass-missed=", 14) == 0) {
+            set_remark_filter(RK_MISSED, argv[i]+14);
+            i += 1;
+        } else if (strncmp(argv[i], "-Rpass-analysis=", 16) == 0) {
+            set_remark_filter(RK_ANALYSIS, argv[i]+16);
+            i += 1;
+        } else if (strncmp(argv[i], "-foptimization-record-file=", 27) == 0) {
+            record_filename = argv[i]+27;
+            i += 1;
+        } else if (strncmp(argv[i], "-O", 2) == 0) {
+            set_optimization_level((argv[i][2] == '\0') ? "1" : argv[i]+2);
+            i += 1;
+        } else if (strcmp(argv[i], "-fstats") == 0) {
+            show_statistics = 1;
+            i += 1;
+        } else if (strncmp(argv[i], "-finline-limit=", 15) == 0) {
+            set_inline_limit(argv[i]+15);
+            i += 1;
+        } else if (strncmp(argv[i], "-fno-", 5) == 0) {
+            set_pass_enabled(argv[i]+5, 0);
+            i += 1;
+        } else if (strncmp(argv[i], "-f", 2) == 0) {
+            set_pass_enabled(argv[i]+2, 1);
+            i += 1;
+        } else if (strncmp(argv[i], "-mabi=", 6) == 0) {
+            // Calling convention, 'stack' matches assembly written for the old one
+            set_abi(argv[i]+6);
+            i += 1;
+        } else if (strcmp(argv[i], "--interp") == 0) {
+            interpret_only = 1;
+            i += 1;
         } else {
             // TODO handle multiple input files
             if (input_filename != NULL) error(NULL, "more than one input file supplied");
@@ -39,16 +120,48 @@ int main(int argc, char **argv) {
         }
     }
     
+    // Remarks go next to the output with the extension changed to .opt.yaml
+    if (record_filename == NULL) record_filename = replace_extension(output_filename, ".opt.yaml");
+
+    if (dependency_target == NULL) dependency_target = output_filename;
+    
     // printf("%s -> %s\n", input_filename, output_filename);
 
     // Lex
     struct Token* first_token = lex(input_filename);
+
+    // Includes are all known after lexing, -M stops here
+    if (dependencies_only) {
+        write_dependencies(dependency_filename, dependency_target, input_filename, phony_targets);
+        return EXIT_SUCCESS;
+    }
     
     // Parse
     struct Node* root_node = parse(first_token);
+
+    // Optimize
+    open_remarks(record_filename);
+    run_passes(root_node);
+
+    // Run on the host instead of generating code
+    if (interpret_only) {
+        close_remarks();
+        return interpret(root_node);
+    }
     
     // Generate code
     generate(root_node, output_filename);
+    close_remarks();
+
+    if (write_dependency_file) {
+        if (dependency_filename == NULL) dependency_filename = replace_extension(output_filename, ".d");
+        write_dependencies(dependency_filename, dependency_target, input_filename, phony_targets);
+    }
+
+    if (show_statistics) {
+        print_pass_statistics();
+        if (pass_enabled("peephole")) print_peephole_statistics();
+    }
 
     return EXIT_SUCCESS;
 }
@@ -35,7 +35,7 @@ static void eat() {
 
 
 static void eat_kind(enum TokenKind kind) {
-    char* messages[] = {"EOF", "'('", "')'", "'{'", "'}'", "','", "'+'", "'-'", "'*'", "'/'", "'='", "a literal", "keyword 'return'", "an identifier", "a type", "';'", "keyword 'if'", "keyword 'else'", "'>'", "'<'", "'>='", "'<='", "'=='", "'!='", "keyword 'while'", "'&'", "'|'", "'<<'", "'>>'", "a string literal", "'++'", "'--'", "keyword 'extern'"};
+    char* messages[] = {"EOF", "'('", "')'", "'{'", "'}'", "','", "'+'", "'-'", "'*'", "'/'", "'='", "a literal", "keyword 'return'", "an identifier", "a type", "';'", "keyword 'if'", "keyword 'else'", "'>'", "'<'", "'>='", "'<='", "'=='", "'!='", "keyword 'while'", "'&'", "'|'", "'<<'", "'>>'", "a string literal", "'++'", "'--'", "keyword 'extern'", "'%'", "keyword 'inline'", "keyword '__attribute__'"};
     if (current_token->kind != kind) {
         error(current_token, "expected %s but got %s", messages[kind], messages[current_token->kind]);
     }
@@ -199,47 +199,19 @@ static struct Node* factor () {
             node->type = node->Variable.symbol->type;
             eat();
 
-            // TODO these are kind of hacked on, should really be handled more in the generator
-            if (preop_token != NULL) {
-                struct Node* assignment_node = new_node(preop_token, N_ASSIGNMENT);
-                struct Node* unary_node = new_node(preop_token, N_UNARY);
-
-                // Inc or dec
-                unary_node->UnaryOp.left = node;
-                unary_node->type = node->type;
-
-                // Assign back to variable
-                assignment_node->Assignment.left = node;
-                assignment_node->Assignment.right = unary_node;
-                assignment_node->type = node->type;
-
-                node = assignment_node;
-            } else { // Only allow pre or post not both, pre has priority
-                if (peek(TK_INC) || peek(TK_DEC)) {
-                    struct Node* assignment_node = new_node(current_token, N_ASSIGNMENT);
-                    struct Node* unary_node = new_node(current_token, N_UNARY);
-                    struct Node* second_unary_node = new_node(current_token, N_UNARY);
-
-                    // Inc or dec
-                    unary_node->UnaryOp.left = node;
-                    unary_node->type = node->type;
-
-                    // Assign back to variable
-                    assignment_node->Assignment.left = node;
-                    assignment_node->Assignment.right = unary_node;
-                    assignment_node->type = node->type;
-
-                    // Undo operation lol, this is a stupid implementation
-                    second_unary_node->UnaryOp.left = assignment_node;
-                    second_unary_node->type = node->type;
-                    second_unary_node->token = duplicate_token(current_token);
-                    if (second_unary_node->token->kind == TK_INC) second_unary_node->token->kind = TK_DEC;
-                    else second_unary_node->token->kind = TK_INC;
-
-                    node = second_unary_node;
-
-                    eat();
-                }
+            // Only allow pre or post not both, pre has priority
+            struct Token* postop_token = NULL;
+            if ((preop_token == NULL) && (peek(TK_INC) || peek(TK_DEC))) {
+                postop_token = current_token;
+                eat();
+            }
+
+            if ((preop_token != NULL) || (postop_token != NULL)) {
+                struct Node* inc_dec_node = new_node((preop_token != NULL) ? preop_token : postop_token, N_INC_DEC);
+                inc_dec_node->IncDec.variable = node;
+                inc_dec_node->IncDec.postfix = postop_token != NULL;
+                inc_dec_node->type = node->type;
+                node = inc_dec_node;
             }
 
             return node;
@@ -254,17 +226,17 @@ static struct Node* factor () {
     return NULL;
 }
 
-// term : factor ((MUL | DIV) factor)*
+// term : factor ((MUL | DIV | MOD) factor)*
 static struct Node* term () {
-    struct Node* factor_node = factor();
-    struct Node* node = factor_node;
+    struct Node* node = factor();
 
-    while (peek(TK_ASTERISK) || peek(TK_DIV)) {
+    while (peek(TK_ASTERISK) || peek(TK_DIV) || peek(TK_PERCENT)) {
         struct Token* token = current_token;
         eat();
+        struct Node* old_node = node;
         node = new_node(token, N_BINOP);
-        node->BinOp.left = factor_node;
-        node->BinOp.right = term();
+        node->BinOp.left = old_node;
+        node->BinOp.right = factor();
         node->type = get_common_type(token, node->BinOp.left->type, node->BinOp.right->type);
         node->constant = node->BinOp.left->constant && node->BinOp.right->constant;
     }
@@ -538,12 +510,39 @@ static struct Node* block() {
     return node;
 }
 
+// function_specifiers : (INLINE | ATTRIBUTE LPAREN LPAREN ID RPAREN RPAREN)*
+static void function_specifiers(int* is_inline, int* no_inline) {
+    while (peek(TK_INLINE) || peek(TK_ATTRIBUTE)) {
+        if (peek(TK_INLINE)) {
+            eat();
+            *is_inline = 1;
+            continue;
+        }
+
+        eat();
+        eat_kind(TK_LPAREN);
+        eat_kind(TK_LPAREN);
+        if (peek(TK_ID) && (strcmp(current_token->value, "noinline") == 0)) *no_inline = 1;
+        else if (peek(TK_ID) && (strcmp(current_token->value, "always_inline") == 0)) *is_inline = 1;
+        else warning(current_token, "attribute '%s' ignored", current_token->value);
+        eat_kind(TK_ID);
+        eat_kind(TK_RPAREN);
+        eat_kind(TK_RPAREN);
+    }
+}
+
 // Probably should be a list of statements rather than a block, would make code generation a bit neater
-// function_decl : type ID LPAREN (FORMAL_PARAMETERS)? RPAREN block
+// function_decl : function_specifiers type ID LPAREN (FORMAL_PARAMETERS)? RPAREN block
 static struct Node* function_decl() {
+    int is_inline = 0;
+    int no_inline = 0;
+    function_specifiers(&is_inline, &no_inline);
+
     struct Type* symbolType = function_of(type());
     struct Node* node = new_node(current_token, N_FUNC_DECL);
     node->type = symbolType;
+    node->FunctionDecl.is_inline = is_inline;
+    node->FunctionDecl.no_inline = no_inline;
 
     struct Symbol* symbol = calloc(1, sizeof(struct Symbol));
     symbol->type = symbolType;
@@ -602,6 +601,24 @@ static struct Node* program () {
     return node;
 }
 
+// Decode a quoted character, escape sequences and all
+int char_value(char* value) {
+    if (value[1] != '\\') return (unsigned char)value[1];
+    switch (value[2]) {
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 't': return '\t';
+        case '0': return '\0';
+        default: return (unsigned char)value[2];
+    }
+}
+
+// Value of a number node, character literals are stored quoted
+int number_value(struct Node* node) {
+    if (node->token->value[0] == '\"') return char_value(node->token->value);
+    return strtol(node->token->value, NULL, 0);
+}
+
 struct Node* parse(Token* first_token) {
     current_token = first_token;
 
@@ -613,4 +630,63 @@ struct Node* parse(Token* first_token) {
     exit_scope();
 
     return root_node;
+}
+
+static void for_each_in_list(struct List* list, void (*fn)(struct Node**, void*), void* data) {
+    if (list == NULL) return;
+    struct List* current_entry = list;
+    do {
+        fn((struct Node**)&current_entry->value, data);
+    } while (list_next(&current_entry));
+}
+
+// Calls fn with a pointer to each child slot so passes can replace nodes in place
+void for_each_child(struct Node* node, void (*fn)(struct Node**, void*), void* data) {
+    switch (node->kind) {
+        case N_PROGRAM:
+            for_each_in_list(node->Program.global_variables, fn, data);
+            for_each_in_list(node->Program.function_declarations, fn, data);
+            break;
+        case N_VAR_DECL:
+            if (node->VarDecl.assignment != NULL) fn(&node->VarDecl.assignment, data);
+            break;
+        case N_FUNC_DECL:
+            for_each_in_list(node->FunctionDecl.formal_parameters, fn, data);
+            fn(&node->FunctionDecl.block, data);
+            break;
+        case N_BLOCK:
+            for_each_in_list(node->Block.statements, fn, data);
+            break;
+        case N_ASSIGNMENT:
+            fn(&node->Assignment.left, data);
+            fn(&node->Assignment.right, data);
+            break;
+        case N_INC_DEC:
+            fn(&node->IncDec.variable, data);
+            break;
+        case N_BINOP:
+            fn(&node->BinOp.left, data);
+            fn(&node->BinOp.right, data);
+            break;
+        case N_UNARY:
+            fn(&node->UnaryOp.left, data);
+            break;
+        case N_RETURN:
+            fn(&node->Return.expr, data);
+            break;
+        case N_IF:
+            fn(&node->If.expr, data);
+            fn(&node->If.true_statement, data);
+            if (node->If.false_statement != NULL) fn(&node->If.false_statement, data);
+            break;
+        case N_WHILE:
+            fn(&node->While.expr, data);
+            fn(&node->While.loop_statement, data);
+            break;
+        case N_FUNC_CALL:
+            for_each_in_list(node->FuncCall.parameters, fn, data);
+            break;
+        default:
+            break;
+    }
 }
\ No newline at end of file
@@ -7,7 +7,7 @@ struct Type;
 struct Scope;
 struct List;
 
-enum NodeKind {N_TYPE, N_PROGRAM, N_VAR_DECL, N_FUNC_DECL, N_BLOCK, N_VARIABLE, N_NUMBER, N_ASSIGNMENT, N_BINOP, N_UNARY, N_RETURN, N_IF, N_WHILE, N_FUNC_CALL, N_STRING};
+enum NodeKind {N_TYPE, N_PROGRAM, N_VAR_DECL, N_FUNC_DECL, N_BLOCK, N_VARIABLE, N_NUMBER, N_ASSIGNMENT, N_INC_DEC, N_BINOP, N_UNARY, N_RETURN, N_IF, N_WHILE, N_FUNC_CALL, N_STRING};
 
 struct Node {
     struct Token* token;
@@ -29,6 +29,8 @@ struct Node {
         struct {
             struct Node* block;
             struct List* formal_parameters;
+            int is_inline;
+            int no_inline;
         } FunctionDecl;
         struct {
             struct List* statements;
@@ -41,6 +43,10 @@ struct Node {
             struct Node* left;
             struct Node* right;
         } Assignment;
+        struct {
+            struct Node* variable;
+            int postfix;        // The result is the value from before the change
+        } IncDec;
         struct {
             struct Node* left;
             struct Node* right;
@@ -69,5 +75,8 @@ struct Node {
 };
 
 struct Node* parse(struct Token*);
+int char_value(char*);
+int number_value(struct Node*);
+void for_each_child(struct Node*, void (*)(struct Node**, void*), void*);
 
 #endif
\ No newline at end of file
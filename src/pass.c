@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "pass.h"
+#include "messages.h"
+#include "verify.h"
+#include "fold.h"
+#include "globaldce.h"
+#include "inline.h"
+#include "ivopts.h"
+
+// Passes run in the order listed, AST passes between parse() and generate().
+// Passes without a run function are switches for work done during code generation,
+// they report their statistics through record_pass().
+// verify isn't run in order, it checks the tree after parsing and after every
+// AST pass that ran so a broken tree is blamed on the pass that broke it.
+
+static struct Pass passes[] = {
+    {.name="inline", .level=2, .for_size=1, .run=inline_functions},
+    {.name="globaldce", .level=1, .for_size=1, .run=eliminate_dead_globals},
+    {.name="fold", .level=1, .for_size=1, .run=fold_constants},
+    {.name="licm", .level=2, .for_size=1},
+    {.name="ivopts", .level=2, .for_size=0, .run=reduce_induction_variables},
+    {.name="verify", .level=0, .for_size=1},
+    {.name="regalloc", .level=1, .for_size=1},
+    {.name="tailcall", .level=2, .for_size=1},
+    {.name="rotate", .level=1, .for_size=1},
+    {.name="peephole", .level=1, .for_size=1},
+    {.name="strpool", .level=1, .for_size=1},
+};
+
+static int optimization_level = 0;
+static int optimize_for_size = 0;
+
+// Explicit -f/-fno- flags win over the optimization level
+static int overridden[sizeof(passes)/sizeof(passes[0])];
+
+static struct Pass* find_pass(char* name) {
+    for (int i = 0; i < sizeof(passes)/sizeof(passes[0]); i++) {
+        if (strcmp(passes[i].name, name) == 0) return &passes[i];
+    }
+    return NULL;
+}
+
+static void update_enabled() {
+    for (int i = 0; i < sizeof(passes)/sizeof(passes[0]); i++) {
+        if (overridden[i]) continue;
+        if (optimize_for_size) passes[i].enabled = passes[i].for_size;
+        else passes[i].enabled = optimization_level >= passes[i].level;
+    }
+}
+
+void set_optimization_level(char* level) {
+    if (strcmp(level, "s") == 0) {
+        optimization_level = 2;
+        optimize_for_size = 1;
+    } else if ((strcmp(level, "0") == 0) || (strcmp(level, "1") == 0) || (strcmp(level, "2") == 0)) {
+        optimization_level = level[0] - '0';
+        optimize_for_size = 0;
+    } else {
+        error(NULL, "invalid optimization level '-O%s'", level);
+    }
+    update_enabled();
+}
+
+void set_pass_enabled(char* name, int enabled) {
+    struct Pass* pass = find_pass(name);
+    if (pass == NULL) error(NULL, "unknown pass '%s'", name);
+    pass->enabled = enabled;
+    overridden[pass - passes] = 1;
+}
+
+int optimizing_for_size() {
+    return optimize_for_size;
+}
+
+int pass_enabled(char* name) {
+    struct Pass* pass = find_pass(name);
+    if (pass == NULL) error(NULL, "unknown pass '%s'", name);
+    return pass->enabled;
+}
+
+void record_pass(char* name, long changes, double seconds) {
+    struct Pass* pass = find_pass(name);
+    if (pass == NULL) error(NULL, "unknown pass '%s'", name);
+    pass->changes += changes;
+    pass->seconds += seconds;
+}
+
+static void verify(struct Node* root_node, char* after) {
+    struct Pass* pass = find_pass("verify");
+    if (!pass->enabled) return;
+
+    clock_t start = clock();
+    verify_ast(root_node, after);
+    pass->seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void run_passes(struct Node* root_node) {
+    update_enabled();
+    verify(root_node, "parse");
+
+    for (int i = 0; i < sizeof(passes)/sizeof(passes[0]); i++) {
+        struct Pass* pass = &passes[i];
+        if (!pass->enabled || (pass->run == NULL)) continue;
+
+        clock_t start = clock();
+        pass->changes += pass->run(root_node);
+        pass->seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        verify(root_node, pass->name);
+    }
+}
+
+void print_pass_statistics() {
+    printf(BOLD "*** PASS STATISTICS ***" RESET "\n");
+    printf("%-24s %8s %10s\n", "pass", "changed", "time (ms)");
+    for (int i = 0; i < sizeof(passes)/sizeof(passes[0]); i++) {
+        struct Pass* pass = &passes[i];
+        if (!pass->enabled) printf(DIM "%-24s %8s %10s" RESET "\n", pass->name, "-", "-");
+        else printf("%-24s %8ld %10.3f\n", pass->name, pass->changes, pass->seconds*1000.0);
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef _PASS_H
+#define _PASS_H
+
+struct Node;
+
+struct Pass {
+    char* name;
+    int level;          // Lowest optimization level the pass runs at
+    int for_size;       // Also runs at -Os
+    int (*run)(struct Node*);   // NULL for passes that run as part of code generation
+
+    int enabled;
+    long changes;
+    double seconds;
+};
+
+void set_optimization_level(char*);
+void set_pass_enabled(char*, int);
+int pass_enabled(char*);
+int optimizing_for_size();
+void record_pass(char*, long, double);
+void run_passes(struct Node*);
+void print_pass_statistics();
+
+#endif
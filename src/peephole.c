@@ -0,0 +1,390 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "peephole.h"
+#include "messages.h"
+#include "pass.h"
+#include "remarks.h"
+
+// Pattern based clean up of the emitted assembly. The generator writes into a
+// buffer, the rules below run over its lines until none of them apply any more
+// and the surviving lines are written out as they were.
+// Every rule removes at least one line when it applies, so the loop always ends.
+
+#define MAX_OPERAND 64
+#define TRACKED_COUNT 7
+
+enum LineKind {LINE_BLANK, LINE_LABEL, LINE_DIRECTIVE, LINE_INSTRUCTION};
+
+struct Line {
+    char* text;
+    enum LineKind kind;
+    char op[8];
+    char left[MAX_OPERAND];     // Label name for labels
+    char right[MAX_OPERAND];
+    int removed;
+};
+
+struct Rule {
+    char* name;
+    int (*apply)();
+    long removed;
+};
+
+static struct Line* lines = NULL;
+static int line_count = 0;
+static int line_capacity = 0;
+
+// Registers whose contents the redundant move rule keeps track of
+static char* tracked[TRACKED_COUNT] = {"a", "b", "c", "d", "e", "bc", "de"};
+static char known[TRACKED_COUNT][MAX_OPERAND];
+
+static char* trim(char* s) {
+    while ((*s == ' ') || (*s == '\t')) s++;
+    char* end = s + strlen(s);
+    while ((end > s) && ((end[-1] == ' ') || (end[-1] == '\t') || (end[-1] == '\r'))) end--;
+    *end = '\0';
+    return s;
+}
+
+static void copy_operand(char* destination, char* source) {
+    strncpy(destination, trim(source), MAX_OPERAND-1);
+    destination[MAX_OPERAND-1] = '\0';
+}
+
+static void parse_line(struct Line* line) {
+    char buffer[256];
+    strncpy(buffer, line->text, sizeof(buffer)-1);
+    buffer[sizeof(buffer)-1] = '\0';
+
+    line->op[0] = '\0';
+    line->left[0] = '\0';
+    line->right[0] = '\0';
+
+    // Drop the comment, quotes may hold a ';' or ','
+    int in_quotes = 0;
+    char* separator = NULL;
+    for (char* p = buffer; *p != '\0'; p++) {
+        if ((*p == '\"') && ((p == buffer) || (p[-1] != '\\'))) in_quotes = !in_quotes;
+        if (in_quotes) continue;
+        if (*p == ';') {
+            *p = '\0';
+            break;
+        }
+        if ((*p == ',') && (separator == NULL)) separator = p;
+    }
+
+    char* s = trim(buffer);
+    if (*s == '\0') {
+        line->kind = LINE_BLANK;
+        return;
+    }
+    if (*s == '#') {
+        line->kind = LINE_DIRECTIVE;
+        return;
+    }
+    if ((s[strlen(s)-1] == ':') && (strpbrk(s, " \t") == NULL)) {
+        line->kind = LINE_LABEL;
+        s[strlen(s)-1] = '\0';
+        copy_operand(line->left, s);
+        return;
+    }
+
+    line->kind = LINE_INSTRUCTION;
+    char* operands = strpbrk(s, " \t");
+    if (operands != NULL) *operands++ = '\0';
+    strncpy(line->op, s, sizeof(line->op)-1);
+    line->op[sizeof(line->op)-1] = '\0';
+    if (operands == NULL) return;
+
+    if (separator != NULL) {
+        *separator = '\0';
+        copy_operand(line->right, separator+1);
+    }
+    copy_operand(line->left, operands);
+}
+
+static void add_line(char* text) {
+    if (line_count == line_capacity) {
+        line_capacity = (line_capacity == 0) ? 256 : line_capacity*2;
+        lines = realloc(lines, line_capacity * sizeof(struct Line));
+    }
+
+    struct Line* line = &lines[line_count++];
+    line->text = text;
+    line->removed = 0;
+    parse_line(line);
+}
+
+// Replace the text of a line with a new instruction
+static void rewrite(struct Line* line, char* op, char* left, char* right) {
+    char buffer[256];
+    if (right != NULL) snprintf(buffer, sizeof(buffer), "\t%s %s, %s", op, left, right);
+    else snprintf(buffer, sizeof(buffer), "\t%s %s", op, left);
+    line->text = strdup(buffer);
+    parse_line(line);
+}
+
+static int is_instruction(int i, char* op) {
+    return (i >= 0) && (lines[i].kind == LINE_INSTRUCTION) && (strcmp(lines[i].op, op) == 0);
+}
+
+// Next line still in use that isn't blank, -1 at the end
+static int next_line(int i) {
+    for (i++; i < line_count; i++) {
+        if (!lines[i].removed && (lines[i].kind != LINE_BLANK)) return i;
+    }
+    return -1;
+}
+
+static int is_register(char* name) {
+    for (int i = 0; i < TRACKED_COUNT; i++) {
+        if (strcmp(tracked[i], name) == 0) return 1;
+    }
+    return strcmp(name, "sp") == 0;
+}
+
+static int register_size(char* name) {
+    return strlen(name);
+}
+
+static int tracked_index(char* name) {
+    for (int i = 0; i < TRACKED_COUNT; i++) {
+        if (strcmp(tracked[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+// Same register, or one is half of the other
+static int registers_overlap(char* x, char* y) {
+    if (strcmp(x, y) == 0) return 1;
+    if ((strlen(x) == 1) && (strlen(y) == 2)) return (x[0] == y[0]) || (x[0] == y[1]);
+    if ((strlen(x) == 2) && (strlen(y) == 1)) return (y[0] == x[0]) || (y[0] == x[1]);
+    return 0;
+}
+
+static int is_stack_offset(char* operand) {
+    return (strncmp(operand, "sp+", 3) == 0) || (strncmp(operand, "sp-", 3) == 0);
+}
+
+static void forget_all() {
+    for (int i = 0; i < TRACKED_COUNT; i++) known[i][0] = '\0';
+}
+
+// A register was written, anything it held or was known to equal is gone
+static void forget(char* reg) {
+    for (int i = 0; i < TRACKED_COUNT; i++) {
+        if (registers_overlap(tracked[i], reg)) known[i][0] = '\0';
+        else if (is_register(known[i]) && registers_overlap(known[i], reg)) known[i][0] = '\0';
+        else if ((strcmp(reg, "sp") == 0) && is_stack_offset(known[i])) known[i][0] = '\0';
+    }
+}
+
+static void remove_line(int i, int* removed) {
+    lines[i].removed = 1;
+    (*removed)++;
+}
+
+// push x / pop x does nothing, push x / pop y is a move
+static int rule_push_pop() {
+    int removed = 0;
+    for (int i = 0; i < line_count; i++) {
+        if (lines[i].removed || !is_instruction(i, "push")) continue;
+        int j = next_line(i);
+        if (!is_instruction(j, "pop")) continue;
+
+        if (strcmp(lines[i].left, lines[j].left) == 0) {
+            remove_line(i, &removed);
+            remove_line(j, &removed);
+        } else if (register_size(lines[i].left) == register_size(lines[j].left)) {
+            rewrite(&lines[j], "mov", lines[j].left, lines[i].left);
+            remove_line(i, &removed);
+        }
+    }
+    return removed;
+}
+
+static int rule_self_move() {
+    int removed = 0;
+    for (int i = 0; i < line_count; i++) {
+        if (lines[i].removed || !is_instruction(i, "mov")) continue;
+        if (strcmp(lines[i].left, lines[i].right) == 0) remove_line(i, &removed);
+    }
+    return removed;
+}
+
+// Adjacent stack adjustments are combined, ones that add up to nothing disappear
+static int rule_stack_adjust() {
+    int removed = 0;
+    for (int i = 0; i < line_count; i++) {
+        if (lines[i].removed || !is_instruction(i, "mov") || (strcmp(lines[i].left, "sp") != 0) || !is_stack_offset(lines[i].right)) continue;
+
+        int offset = atoi(lines[i].right+2);
+        if (offset == 0) {
+            remove_line(i, &removed);
+            continue;
+        }
+
+        int j = next_line(i);
+        if (!is_instruction(j, "mov") || (strcmp(lines[j].left, "sp") != 0) || !is_stack_offset(lines[j].right)) continue;
+
+        offset += atoi(lines[j].right+2);
+        char value[MAX_OPERAND];
+        snprintf(value, sizeof(value), "sp%+d", offset);
+        rewrite(&lines[j], "mov", "sp", value);
+        remove_line(i, &removed);
+    }
+    return removed;
+}
+
+static int is_jump(int i) {
+    return is_instruction(i, "jmp") || is_instruction(i, "je") || is_instruction(i, "jne") || is_instruction(i, "jc") || is_instruction(i, "jnc");
+}
+
+// A jump to a label it would fall through to anyway
+static int rule_jump_to_next() {
+    int removed = 0;
+    for (int i = 0; i < line_count; i++) {
+        if (lines[i].removed || !is_jump(i)) continue;
+
+        for (int j = next_line(i); (j >= 0) && (lines[j].kind == LINE_LABEL); j = next_line(j)) {
+            if (strcmp(lines[j].left, lines[i].left) == 0) {
+                remove_line(i, &removed);
+                break;
+            }
+        }
+    }
+    return removed;
+}
+
+// Nothing after a jump or return runs until the next label
+static int rule_unreachable() {
+    int removed = 0;
+    for (int i = 0; i < line_count; i++) {
+        if (lines[i].removed) continue;
+        if (!is_instruction(i, "ret") && !is_instruction(i, "jmp")) continue;
+
+        for (int j = next_line(i); (j >= 0) && (lines[j].kind == LINE_INSTRUCTION); j = next_line(j)) {
+            remove_line(j, &removed);
+        }
+    }
+    return removed;
+}
+
+// Registers an instruction writes, returns zero if its effect isn't known
+static int note_writes(struct Line* line) {
+    char* op = line->op;
+
+    if (strcmp(op, "mov") == 0) {
+        if (is_register(line->left)) forget(line->left);
+    } else if (strcmp(op, "push") == 0) {
+        forget("sp");
+    } else if (strcmp(op, "pop") == 0) {
+        forget(line->left);
+        forget("sp");
+    } else if ((strcmp(op, "add") == 0) || (strcmp(op, "sub") == 0) || (strcmp(op, "and") == 0) || (strcmp(op, "or") == 0) ||
+               (strcmp(op, "rol") == 0) || (strcmp(op, "lde") == 0) || (strcmp(op, "ldc") == 0)) {
+        forget("a");
+    } else if ((strcmp(op, "inc") == 0) || (strcmp(op, "dec") == 0) || (strcmp(op, "add16") == 0) || (strcmp(op, "sub16") == 0)) {
+        forget(line->left);
+    } else if ((strcmp(op, "cmp") == 0) || (strcmp(op, "je") == 0) || (strcmp(op, "jne") == 0) || (strcmp(op, "jc") == 0) || (strcmp(op, "jnc") == 0)) {
+        // Flags only
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Moves of a value a register is already known to hold within a straight line
+// of code, e.g. reloading a stack slot address or copying a register back
+static int rule_redundant_move() {
+    int removed = 0;
+    char* compared = NULL;
+    forget_all();
+
+    for (int i = 0; i < line_count; i++) {
+        struct Line* line = &lines[i];
+        if (line->removed || (line->kind == LINE_BLANK)) continue;
+        if (line->kind != LINE_INSTRUCTION) {
+            forget_all();
+            compared = NULL;
+            continue;
+        }
+
+        int target = tracked_index(line->left);
+        int source = tracked_index(line->right);
+        if ((strcmp(line->op, "mov") == 0) && (target >= 0) && (line->right[0] != '[')) {
+            if ((strcmp(known[target], line->right) == 0) || ((source >= 0) && (strcmp(known[source], line->left) == 0))) {
+                remove_line(i, &removed);
+                continue;
+            }
+
+            forget(line->left);
+            if (!registers_overlap(line->left, line->right)) strcpy(known[target], line->right);
+        } else if (!note_writes(line)) {
+            forget_all();
+        }
+
+        // Falling through a jne after a compare means a held the compared value
+        if ((strcmp(line->op, "jne") == 0) && (compared != NULL) && (compared[0] != '[') && !registers_overlap(compared, "a")) {
+            forget("a");
+            strcpy(known[tracked_index("a")], compared);
+        }
+        compared = (strcmp(line->op, "cmp") == 0) ? line->left : NULL;
+    }
+    return removed;
+}
+
+static struct Rule rules[] = {
+    {.name="push-pop", .apply=rule_push_pop},
+    {.name="self-move", .apply=rule_self_move},
+    {.name="stack-adjust", .apply=rule_stack_adjust},
+    {.name="jump-to-next", .apply=rule_jump_to_next},
+    {.name="unreachable", .apply=rule_unreachable},
+    {.name="redundant-move", .apply=rule_redundant_move},
+};
+
+void optimize_peephole(char* text, FILE* fp) {
+    clock_t start = clock();
+
+    line_count = 0;
+    while (*text != '\0') {
+        char* end = strchr(text, '\n');
+        if (end != NULL) *end = '\0';
+        add_line(text);
+        if (end == NULL) break;
+        text = end+1;
+    }
+
+    long total = 0;
+    int changed;
+    do {
+        changed = 0;
+        for (int i = 0; i < sizeof(rules)/sizeof(rules[0]); i++) {
+            int removed = rules[i].apply();
+            rules[i].removed += removed;
+            changed += removed;
+        }
+        total += changed;
+    } while (changed);
+
+    for (int i = 0; i < line_count; i++) {
+        if (!lines[i].removed) fprintf(fp, "%s\n", lines[i].text);
+    }
+
+    set_remark_function(NULL);
+    for (int i = 0; i < sizeof(rules)/sizeof(rules[0]); i++) {
+        if (rules[i].removed != 0) remark(RK_ANALYSIS, "peephole", "RuleApplied", NULL, "rule '%s' removed %ld instructions", rules[i].name, rules[i].removed);
+    }
+
+    record_pass("peephole", total, (double)(clock() - start) / CLOCKS_PER_SEC);
+}
+
+void print_peephole_statistics() {
+    printf(BOLD "*** PEEPHOLE RULES ***" RESET "\n");
+    printf("%-24s %8s\n", "rule", "removed");
+    for (int i = 0; i < sizeof(rules)/sizeof(rules[0]); i++) {
+        printf("%-24s %8ld\n", rules[i].name, rules[i].removed);
+    }
+}
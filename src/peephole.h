@@ -0,0 +1,10 @@
+#ifndef _PEEPHOLE_H
+#define _PEEPHOLE_H
+
+struct _IO_FILE;
+typedef struct _IO_FILE FILE;
+
+void optimize_peephole(char*, FILE*);
+void print_peephole_statistics();
+
+#endif
@@ -0,0 +1,887 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "regalloc.h"
+#include "ir.h"
+#include "lexer.h"
+#include "messages.h"
+#include "parser.h"
+#include "pass.h"
+#include "register.h"
+#include "remarks.h"
+#include "symbol.h"
+#include "type.h"
+#include "list.h"
+
+// Register allocation over a function's IR once it has been generated.
+// Liveness is solved over the blocks and their edges, giving each virtual register
+// the ranges of instructions it is live over. They are handed physical registers
+// in order of where they start, skipping any register something overlapping
+// already has. Instruction i reads at 2i and writes at 2i+1, so a value read for
+// the last time can give its register to the one being written.
+//
+// Lowering routes most 8-bit work through the accumulator, so nothing but an
+// instruction's own operand can be kept in it across one that does. Calls are free
+// to use every register, whatever is live across one is pushed at its IR_SAVE and
+// popped at its IR_RESTORE, which leaves those registers free for the arguments
+// and result in between.
+//
+// When nothing fits, whichever is cheaper out of the virtual register and those in
+// its way is spilled. A value used within one block is pushed and popped around
+// where it isn't needed, anything else gets a slot at the bottom of the frame and
+// is loaded before every read and stored after every write. Spill code only makes
+// registers live from one instruction to the next, so going round again finishes.
+//
+// Variables whose address is never taken get a virtual register of their own
+// before the function is generated, the rest stay in the frame.
+
+#define MAX_ROUNDS 1000
+
+struct Range {
+    int start;
+    int end;
+};
+
+struct Interval {
+    struct VirtualRegister* reg;
+    struct Range* ranges;       // In order, not touching
+    int range_count;
+    int range_capacity;
+    int* touches;               // Instructions reading or writing it, in order
+    int touch_count;
+    int touch_capacity;
+    int cost;
+    int length;
+};
+
+// Positions of a call's IR_SAVE, IR_CALL and IR_RESTORE
+struct Call {
+    int number;
+    int save;
+    int call;
+    int restore;
+};
+
+static struct Function* function;
+
+static struct Instruction** instructions = NULL;
+static struct Block** instruction_blocks = NULL;
+static int* loop_depths = NULL;
+static int instruction_count = 0;
+static int instruction_capacity = 0;
+
+static struct Block** blocks = NULL;
+
+static struct Interval* intervals = NULL;
+static int interval_count = 0;
+static int interval_capacity = 0;
+
+static struct Call* calls = NULL;
+static int call_count = 0;
+
+static int* accumulator_uses = NULL;
+static int accumulator_use_count = 0;
+
+static unsigned** live_in = NULL;
+static unsigned** live_out = NULL;
+static int live_block_count = 0;
+
+// Registers made by spill code, there is nothing to gain by spilling them again
+static char* short_lived = NULL;
+static int short_lived_capacity = 0;
+
+static int max(int a, int b) {
+    return (a > b) ? a : b;
+}
+
+static int min(int a, int b) {
+    return (a < b) ? a : b;
+}
+
+// Fixed registers are numbered first, then those made for the function
+static int reg_index(struct VirtualRegister* reg) {
+    if (reg->fixed) return reg->number;
+    return reg->number - function->first_number + REG_COUNT;
+}
+
+static struct Interval* interval_of(struct VirtualRegister* reg) {
+    return &intervals[reg_index(reg)];
+}
+
+static int is_short_lived(struct VirtualRegister* reg) {
+    int index = reg_index(reg);
+    return (index < short_lived_capacity) && short_lived[index];
+}
+
+static struct VirtualRegister* new_short_lived(int size) {
+    struct VirtualRegister* reg = ir_new_reg(size);
+    int index = reg_index(reg);
+    if (index >= short_lived_capacity) {
+        int capacity = max(64, index * 2);
+        short_lived = realloc(short_lived, capacity);
+        memset(&short_lived[short_lived_capacity], 0, capacity - short_lived_capacity);
+        short_lived_capacity = capacity;
+    }
+    short_lived[index] = 1;
+    return reg;
+}
+
+static void number_instructions() {
+    instruction_count = 0;
+    for (struct Instruction* instruction = function->first; instruction != function->last->next; instruction = instruction->next) {
+        if (instruction_count == instruction_capacity) {
+            instruction_capacity = max(256, instruction_capacity * 2);
+            instructions = realloc(instructions, instruction_capacity * sizeof(struct Instruction*));
+            instruction_blocks = realloc(instruction_blocks, instruction_capacity * sizeof(struct Block*));
+            loop_depths = realloc(loop_depths, instruction_capacity * sizeof(int));
+            calls = realloc(calls, instruction_capacity * sizeof(struct Call));
+            accumulator_uses = realloc(accumulator_uses, instruction_capacity * sizeof(int));
+        }
+        instruction->index = instruction_count;
+        instructions[instruction_count++] = instruction;
+    }
+}
+
+// A jump back to an earlier block closes a loop around everything in between
+static void find_loops() {
+    blocks = realloc(blocks, function->block_count * sizeof(struct Block*));
+    for (int i = 0; i < instruction_count; i++) loop_depths[i] = 0;
+
+    for (struct Block* block = function->blocks; block != NULL; block = block->next) {
+        blocks[block->index] = block;
+        for (struct Instruction* instruction = block->first; instruction != block->last->next; instruction = instruction->next) {
+            instruction_blocks[instruction->index] = block;
+        }
+
+        struct Block* target = block->successors[0];
+        if ((target == NULL) || (target->index > block->index)) continue;
+        for (int i = target->first->index; i <= block->last->index; i++) loop_depths[i]++;
+    }
+}
+
+static void find_calls() {
+    call_count = 0;
+    accumulator_use_count = 0;
+
+    for (int i = 0; i < instruction_count; i++) {
+        struct Instruction* instruction = instructions[i];
+        if (ir_uses_accumulator(instruction)) accumulator_uses[accumulator_use_count++] = i;
+
+        if (instruction->op == IR_SAVE) {
+            calls[call_count].number = instruction->number;
+            calls[call_count].save = i;
+            calls[call_count].call = -1;
+            calls[call_count].restore = -1;
+            call_count++;
+        } else if ((instruction->op == IR_CALL) || (instruction->op == IR_RESTORE)) {
+            for (int j = 0; j < call_count; j++) {
+                if (calls[j].number != instruction->number) continue;
+                if (instruction->op == IR_CALL) calls[j].call = i;
+                else calls[j].restore = i;
+            }
+        }
+    }
+}
+
+static int is_live(unsigned* set, int index) {
+    return (set[index / 32] >> (index % 32)) & 1;
+}
+
+static void set_live(unsigned* set, int index) {
+    set[index / 32] |= 1u << (index % 32);
+}
+
+static void free_liveness() {
+    for (int i = 0; i < live_block_count; i++) {
+        free(live_in[i]);
+        free(live_out[i]);
+    }
+    live_block_count = 0;
+}
+
+// Live out of a block is whatever is live into a successor, live in is that less what
+// the block writes, plus what it reads before writing
+static void solve_liveness() {
+    int block_count = function->block_count;
+    int words = (interval_count + 31) / 32;
+    struct VirtualRegister* regs[MAX_OPERANDS];
+
+    free_liveness();
+    live_in = realloc(live_in, block_count * sizeof(unsigned*));
+    live_out = realloc(live_out, block_count * sizeof(unsigned*));
+    live_block_count = block_count;
+
+    unsigned** uses = calloc(block_count, sizeof(unsigned*));
+    unsigned** defs = calloc(block_count, sizeof(unsigned*));
+
+    for (int b = 0; b < block_count; b++) {
+        struct Block* block = blocks[b];
+        live_in[b] = calloc(words, sizeof(unsigned));
+        live_out[b] = calloc(words, sizeof(unsigned));
+        uses[b] = calloc(words, sizeof(unsigned));
+        defs[b] = calloc(words, sizeof(unsigned));
+
+        for (struct Instruction* instruction = block->first; instruction != block->last->next; instruction = instruction->next) {
+            int count = ir_uses(instruction, regs);
+            for (int i = 0; i < count; i++) {
+                if (!is_live(defs[b], reg_index(regs[i]))) set_live(uses[b], reg_index(regs[i]));
+            }
+            count = ir_defs(instruction, regs);
+            for (int i = 0; i < count; i++) set_live(defs[b], reg_index(regs[i]));
+        }
+    }
+
+    int changed;
+    do {
+        changed = 0;
+        for (int b = block_count - 1; b >= 0; b--) {
+            struct Block* block = blocks[b];
+            for (int w = 0; w < words; w++) {
+                unsigned out = 0;
+                for (int s = 0; s < 2; s++) {
+                    if (block->successors[s] != NULL) out |= live_in[block->successors[s]->index][w];
+                }
+                unsigned in = uses[b][w] | (out & ~defs[b][w]);
+                if ((out != live_out[b][w]) || (in != live_in[b][w])) changed = 1;
+                live_out[b][w] = out;
+                live_in[b][w] = in;
+            }
+        }
+    } while (changed);
+
+    for (int b = 0; b < block_count; b++) {
+        free(uses[b]);
+        free(defs[b]);
+    }
+    free(uses);
+    free(defs);
+}
+
+// Ranges are found going backwards, so a new one is never after the first
+static void add_range(struct Interval* interval, int start, int end) {
+    if ((interval->range_count > 0) && (interval->ranges[0].start <= end)) {
+        interval->ranges[0].start = min(interval->ranges[0].start, start);
+        interval->ranges[0].end = max(interval->ranges[0].end, end);
+        return;
+    }
+
+    if (interval->range_count == interval->range_capacity) {
+        interval->range_capacity = max(4, interval->range_capacity * 2);
+        interval->ranges = realloc(interval->ranges, interval->range_capacity * sizeof(struct Range));
+    }
+    memmove(&interval->ranges[1], &interval->ranges[0], interval->range_count * sizeof(struct Range));
+    interval->ranges[0].start = start;
+    interval->ranges[0].end = end;
+    interval->range_count++;
+}
+
+static void add_touch(struct Interval* interval, int position) {
+    if ((interval->touch_count > 0) && (interval->touches[0] == position)) return;
+
+    if (interval->touch_count == interval->touch_capacity) {
+        interval->touch_capacity = max(4, interval->touch_capacity * 2);
+        interval->touches = realloc(interval->touches, interval->touch_capacity * sizeof(int));
+    }
+    memmove(&interval->touches[1], &interval->touches[0], interval->touch_count * sizeof(int));
+    interval->touches[0] = position;
+    interval->touch_count++;
+}
+
+static void build_intervals() {
+    struct VirtualRegister* regs[MAX_OPERANDS];
+
+    for (int i = 0; i < interval_count; i++) {
+        free(intervals[i].ranges);
+        free(intervals[i].touches);
+    }
+    interval_count = ir_reg_count() - function->first_number + REG_COUNT;
+    if (interval_count > interval_capacity) {
+        interval_capacity = interval_count * 2;
+        intervals = realloc(intervals, interval_capacity * sizeof(struct Interval));
+    }
+    memset(intervals, 0, interval_count * sizeof(struct Interval));
+
+    // Only registers some instruction reads or writes get an interval
+    for (int i = 0; i < instruction_count; i++) {
+        int count = ir_uses(instructions[i], regs);
+        count += ir_defs(instructions[i], &regs[count]);
+        for (int j = 0; j < count; j++) interval_of(regs[j])->reg = regs[j];
+    }
+
+    solve_liveness();
+
+    // Blocks backwards, and each block from its end
+    for (int b = function->block_count - 1; b >= 0; b--) {
+        struct Block* block = blocks[b];
+        int from = 2 * block->first->index;
+        int to = 2 * block->last->index + 2;
+
+        for (int i = 0; i < interval_count; i++) {
+            if (is_live(live_out[b], i)) add_range(&intervals[i], from, to);
+        }
+
+        for (struct Instruction* instruction = block->last; instruction != block->first->prev; instruction = instruction->prev) {
+            int position = instruction->index;
+
+            // A write starts the range it is live after, or is live just for itself if nothing reads it
+            int count = ir_defs(instruction, regs);
+            for (int i = 0; i < count; i++) {
+                struct Interval* interval = interval_of(regs[i]);
+                struct Range* first = (interval->range_count > 0) ? &interval->ranges[0] : NULL;
+                if ((first != NULL) && (first->start <= 2*position + 1) && (first->end > 2*position + 1)) first->start = 2*position + 1;
+                else add_range(interval, 2*position + 1, 2*position + 2);
+                add_touch(interval, position);
+            }
+
+            count = ir_uses(instruction, regs);
+            for (int i = 0; i < count; i++) {
+                struct Interval* interval = interval_of(regs[i]);
+                add_range(interval, from, 2*position + 1);
+                add_touch(interval, position);
+            }
+        }
+    }
+
+    // Touches inside loops are worth more
+    for (int i = 0; i < interval_count; i++) {
+        struct Interval* interval = &intervals[i];
+        for (int j = 0; j < interval->touch_count; j++) {
+            int weight = 1;
+            for (int k = 0; k < min(loop_depths[interval->touches[j]], 3); k++) weight *= 8;
+            interval->cost += weight;
+        }
+        for (int j = 0; j < interval->range_count; j++) interval->length += interval->ranges[j].end - interval->ranges[j].start;
+    }
+}
+
+static int covers(struct Interval* interval, int slot) {
+    for (int i = 0; i < interval->range_count; i++) {
+        if (slot < interval->ranges[i].start) return 0;
+        if (slot < interval->ranges[i].end) return 1;
+    }
+    return 0;
+}
+
+// Still needed by the instruction after
+static int live_after(struct Interval* interval, int position) {
+    return covers(interval, 2*position + 2);
+}
+
+static int reads(struct Instruction* instruction, struct VirtualRegister* reg) {
+    struct VirtualRegister* regs[MAX_OPERANDS];
+    int count = ir_uses(instruction, regs);
+    for (int i = 0; i < count; i++) {
+        if (regs[i] == reg) return 1;
+    }
+    return 0;
+}
+
+static int writes(struct Instruction* instruction, struct VirtualRegister* reg) {
+    struct VirtualRegister* regs[MAX_OPERANDS];
+    int count = ir_defs(instruction, regs);
+    for (int i = 0; i < count; i++) {
+        if (regs[i] == reg) return 1;
+    }
+    return 0;
+}
+
+// Whether the register is on the stack for a call over all the slots from lo up to hi,
+// and not touched from lo until the call, so its register may be used for something else
+static int saved_over(struct Interval* interval, int lo, int hi) {
+    for (int i = 0; i < call_count; i++) {
+        struct Call* call = &calls[i];
+        if ((call->call < 0) || (call->restore < 0)) continue;
+        if ((2*call->save >= lo) || (hi > 2*call->restore) || !covers(interval, 2*call->call + 1)) continue;
+
+        int touched = 0;
+        for (int j = 0; j < interval->touch_count; j++) {
+            int position = interval->touches[j];
+            if ((2*position + 1 >= lo) && (position <= call->call)) touched = 1;
+        }
+        if (!touched) return 1;
+    }
+    return 0;
+}
+
+static int overlaps(struct Interval* interval, struct Interval* other) {
+    int i = 0;
+    int j = 0;
+    while ((i < interval->range_count) && (j < other->range_count)) {
+        struct Range* a = &interval->ranges[i];
+        struct Range* b = &other->ranges[j];
+        int lo = max(a->start, b->start);
+        int hi = min(a->end, b->end);
+        if ((lo < hi) && !saved_over(interval, lo, hi) && !saved_over(other, lo, hi)) return 1;
+        if (a->end < b->end) i++;
+        else j++;
+    }
+    return 0;
+}
+
+// Kept in the accumulator over an instruction that lowers through it
+static int clobbered(struct Interval* interval) {
+    for (int i = 0; i < accumulator_use_count; i++) {
+        int position = accumulator_uses[i];
+        struct Instruction* instruction = instructions[position];
+        int live = covers(interval, 2*position + 1);
+        if (!live && !covers(interval, 2*position)) continue;
+
+        if (instruction->dest == interval->reg) continue;
+        if ((instruction->src == interval->reg) && !live && ir_swaps_operands(instruction)) continue;
+        if (saved_over(interval, 2*position, 2*position + 2)) continue;
+        return 1;
+    }
+    return 0;
+}
+
+// The copy a constant multiply works from can be done without
+static int is_optional(struct Interval* interval) {
+    if (interval->touch_count != 1) return 0;
+    struct Instruction* instruction = instructions[interval->touches[0]];
+    return (instruction->op == IR_MULTIPLY_IMMEDIATE) && (instruction->src == interval->reg);
+}
+
+// Spilling only helps a register live over an instruction that doesn't touch it
+static int can_spill(struct Interval* interval) {
+    if (interval->reg->fixed || is_short_lived(interval->reg)) return 0;
+    if (is_optional(interval)) return 1;
+
+    int touch = 0;
+    for (int i = 0; i < interval->range_count; i++) {
+        for (int slot = interval->ranges[i].start; slot + 1 < interval->ranges[i].end; slot++) {
+            if (slot % 2 != 0) continue;
+            while ((touch < interval->touch_count) && (interval->touches[touch] < slot / 2)) touch++;
+            if ((touch == interval->touch_count) || (interval->touches[touch] != slot / 2)) return 1;
+        }
+    }
+    return 0;
+}
+
+static int spill_weight(struct Interval* interval) {
+    return interval->cost * 256 / (interval->length + 1);
+}
+
+// Something with an overlapping register is live at the same time
+static int in_use(struct Interval* interval, struct Register* reg) {
+    for (int i = 0; i < interval_count; i++) {
+        struct Interval* other = &intervals[i];
+        if ((other == interval) || (other->reg == NULL) || (other->reg->reg == NULL)) continue;
+        if (registers_overlap(reg, other->reg->reg) && overlaps(interval, other)) return 1;
+    }
+    return 0;
+}
+
+static int available(struct Interval* interval, struct Register* reg) {
+    if (reg->size != interval->reg->size) return 0;
+    if ((reg == &registers[REG_A]) && clobbered(interval)) return 0;
+    return !in_use(interval, reg);
+}
+
+// Moves and conversions are free when both sides share a register
+static struct Register* hint(struct Instruction* instruction, struct VirtualRegister* reg) {
+    struct VirtualRegister* other = (instruction->dest == reg) ? instruction->src : instruction->dest;
+    if ((other == NULL) || (other == reg) || (other->reg == NULL)) return NULL;
+    struct Register* physical = other->reg;
+
+    switch (instruction->op) {
+        case IR_MOVE:
+            return physical;
+        case IR_EXTEND:
+            return (instruction->dest == reg) ? physical->parent_reg : physical->low_reg;
+        case IR_TRUNCATE:
+            if (instruction->dest == reg) return physical->low_reg;
+            return ((physical->parent_reg != NULL) && (physical->parent_reg->low_reg == physical)) ? physical->parent_reg : NULL;
+        default:
+            return NULL;
+    }
+}
+
+static int add_candidate(struct Register** candidates, int count, struct Register* reg) {
+    if (reg == NULL) return count;
+    for (int i = 0; i < count; i++) {
+        if (candidates[i] == reg) return count;
+    }
+    candidates[count] = reg;
+    return count + 1;
+}
+
+// Hinted registers first, then the accumulator. Bytes go next to one already in use
+// where they can so as many pairs as possible stay whole.
+static int find_candidates(struct Interval* interval, struct Register** candidates) {
+    int count = 0;
+
+    for (int i = 0; i < interval->touch_count; i++) {
+        count = add_candidate(candidates, count, hint(instructions[interval->touches[i]], interval->reg));
+    }
+
+    if (interval->reg->size == 2) {
+        count = add_candidate(candidates, count, &registers[REG_BC]);
+        return add_candidate(candidates, count, &registers[REG_DE]);
+    }
+
+    count = add_candidate(candidates, count, &registers[REG_A]);
+    int halves[] = {REG_B, REG_C, REG_D, REG_E};
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < 4; i++) {
+            struct Register* sibling = &registers[halves[i ^ 1]];
+            if (in_use(interval, sibling) == (pass == 0)) count = add_candidate(candidates, count, &registers[halves[i]]);
+        }
+    }
+    return count;
+}
+
+static void replace_reg(struct Instruction* instruction, struct VirtualRegister* from, struct VirtualRegister* to) {
+    if (instruction->dest == from) instruction->dest = to;
+    if (instruction->src == from) instruction->src = to;
+}
+
+// Pushes and pops in between match up, with nothing that moves the whole frame
+static int balanced(int from, int to) {
+    int depth = 0;
+    for (int i = from; i < to; i++) {
+        struct Instruction* instruction = instructions[i];
+        switch (instruction->op) {
+            case IR_PUSH: depth += instruction->src->size; break;
+            case IR_POP: depth -= instruction->dest->size; break;
+            case IR_STACK: depth -= instruction->number; break;
+            // Registers are pushed and popped for a call in their place
+            case IR_SAVE: depth += 256; break;
+            case IR_RESTORE: depth -= 256; break;
+            case IR_ENTER:
+            case IR_RESERVE:
+            case IR_RELEASE:
+            case IR_RETURN:
+                return 0;
+            default: break;
+        }
+        if (depth < 0) return 0;
+    }
+    return depth == 0;
+}
+
+// Every touch is in one block and whenever it is live between two, anything
+// pushed in between is popped again first
+static int fits_on_stack(struct Interval* interval) {
+    struct Block* block = instruction_blocks[interval->touches[0]];
+    int index = reg_index(interval->reg);
+    if (is_live(live_in[block->index], index) || is_live(live_out[block->index], index)) return 0;
+
+    int pending = 0;
+    for (int i = 0; i < interval->touch_count; i++) {
+        int position = interval->touches[i];
+        struct Instruction* instruction = instructions[position];
+        if (instruction_blocks[position] != block) return 0;
+        if (reads(instruction, interval->reg) && !pending) return 0;
+
+        pending = live_after(interval, position);
+        if (!pending) continue;
+        if (i + 1 == interval->touch_count) return 0;
+        if (!balanced(writes(instruction, interval->reg) ? position + 1 : position, interval->touches[i+1])) return 0;
+    }
+    return 1;
+}
+
+static void spill_to_stack(struct Interval* interval) {
+    struct VirtualRegister* reg = interval->reg;
+
+    for (int i = 0; i < interval->touch_count; i++) {
+        int position = interval->touches[i];
+        struct Instruction* instruction = instructions[position];
+        int reading = reads(instruction, reg);
+        int writing = writes(instruction, reg);
+        int live = live_after(interval, position);
+        struct VirtualRegister* value = new_short_lived(reg->size);
+        struct Token* token = ir_token(instruction->token);
+
+        if (reading) {
+            ir_insert_before(instruction);
+            ir_pop(value);
+        }
+        if (live && !writing) {
+            ir_insert_before(instruction);
+            ir_push(value);
+        }
+        if (live && writing) {
+            ir_insert_after(instruction);
+            ir_push(value);
+        }
+        ir_append();
+        ir_token(token);
+        replace_reg(instruction, reg, value);
+    }
+}
+
+// The IR_RESERVE a parameter's copy out of the register it arrived in could be pushed in front of,
+// so long as nothing but the entry writes that register first
+static struct Instruction* entry_copy(struct Instruction* copy) {
+    struct VirtualRegister* regs[MAX_OPERANDS];
+    if ((copy->op != IR_MOVE) || !copy->src->fixed) return NULL;
+
+    struct Instruction* reserve = NULL;
+    for (struct Instruction* instruction = function->first; instruction != copy; instruction = instruction->next) {
+        if (instruction->op == IR_ENTER) {
+            if (!(instruction->registers & (1 << copy->src->number))) return NULL;
+            continue;
+        }
+        if (instruction->op == IR_RESERVE) reserve = instruction;
+
+        int count = ir_defs(instruction, regs);
+        for (int i = 0; i < count; i++) {
+            if (regs[i]->fixed && registers_overlap(regs[i]->reg, copy->src->reg)) return NULL;
+        }
+    }
+    return reserve;
+}
+
+// The new slot goes at the bottom of the frame, everything else moves up. A parameter
+// still in the register it arrived in is pushed on entry instead, like one that was never
+// promoted, so it doesn't need a pointer while the other parameters are still in theirs.
+static void spill_to_frame(struct Interval* interval) {
+    struct VirtualRegister* reg = interval->reg;
+    char* name = (reg->symbol != NULL) ? reg->symbol->token->value : NULL;
+    struct Instruction* first = instructions[interval->touches[0]];
+    struct Instruction* reserve = entry_copy(first);
+    int slot = (reserve != NULL) ? reserve->number : 0;
+
+    for (struct Instruction* instruction = function->first; instruction != function->last->next; instruction = instruction->next) {
+        enum IrOp op = instruction->op;
+        if ((op == IR_FRAME_ADDRESS) && (instruction->number < slot)) continue;
+        if ((op == IR_RESERVE) && (reserve != NULL)) continue;
+        if ((op == IR_FRAME_ADDRESS) || (op == IR_RESERVE) || (op == IR_RELEASE)) instruction->number += reg->size;
+    }
+
+    int i = 0;
+    if (reserve != NULL) {
+        struct Token* token = ir_token(first->token);
+        ir_insert_before(reserve);
+        ir_push(first->src);
+        ir_append();
+        ir_token(token);
+        ir_remove(first);
+        i++;
+    }
+
+    for (; i < interval->touch_count; i++) {
+        int position = interval->touches[i];
+        struct Instruction* instruction = instructions[position];
+        int reading = reads(instruction, reg);
+        int writing = writes(instruction, reg);
+        struct VirtualRegister* value = new_short_lived(reg->size);
+        struct Token* token = ir_token(instruction->token);
+
+        if (reading) {
+            struct VirtualRegister* pointer = new_short_lived(2);
+            ir_insert_before(instruction);
+            ir_frame_address(pointer, slot, name);
+            ir_load(value, pointer);
+        }
+        if (writing && live_after(interval, position)) {
+            struct VirtualRegister* pointer = new_short_lived(2);
+            ir_insert_after(instruction);
+            ir_frame_address(pointer, slot, name);
+            ir_store(pointer, value);
+        }
+        ir_append();
+        ir_token(token);
+        replace_reg(instruction, reg, value);
+    }
+}
+
+static void spill(struct Interval* interval) {
+    struct VirtualRegister* reg = interval->reg;
+    struct Instruction* first = instructions[interval->touches[0]];
+
+    if (is_optional(interval)) {
+        first->src = NULL;
+        remark(RK_MISSED, "strength", "MultiplyCall", first->token, "no register to hold a copy, multiply by %d calls the runtime routine", first->number);
+        return;
+    }
+
+    if (reg->symbol != NULL) remark(RK_MISSED, "regalloc", "Spilled", reg->symbol->token, "'%s' kept on the stack, no register free for its live range", reg->symbol->token->value);
+    else remark(RK_MISSED, "spill", "TemporarySpill", first->token, "value spilled to the stack, no register free while it is needed");
+
+    if (fits_on_stack(interval)) spill_to_stack(interval);
+    else spill_to_frame(interval);
+}
+
+// Nothing is free for the interval, spill it or the cheapest of what is in its way.
+// One is spilled at a time as the rest may fit once it is gone.
+static void make_room(struct Interval* interval) {
+    struct Interval* best = NULL;
+    int best_cost = 0;
+
+    for (int r = 0; r < REG_COUNT; r++) {
+        struct Register* reg = &registers[r];
+        if (reg->size != interval->reg->size) continue;
+        if ((reg == &registers[REG_A]) && clobbered(interval)) continue;
+
+        int cost = 0;
+        struct Interval* cheapest = NULL;
+        for (int i = 0; i < interval_count; i++) {
+            struct Interval* other = &intervals[i];
+            if ((other == interval) || (other->reg == NULL) || (other->reg->reg == NULL)) continue;
+            if (!registers_overlap(reg, other->reg->reg) || !overlaps(interval, other)) continue;
+            if (!can_spill(other)) {
+                cost = -1;
+                break;
+            }
+            cost += spill_weight(other);
+            if ((cheapest == NULL) || (spill_weight(other) < spill_weight(cheapest))) cheapest = other;
+        }
+
+        if ((cost >= 0) && (cheapest != NULL) && ((best == NULL) || (cost < best_cost))) {
+            best = cheapest;
+            best_cost = cost;
+        }
+    }
+
+    if (can_spill(interval) && ((best == NULL) || (spill_weight(interval) <= best_cost))) spill(interval);
+    else if (best != NULL) spill(best);
+    else error(instructions[interval->touches[0]]->token, "unable to allocate registers");
+}
+
+static int compare_starts(const void* a, const void* b) {
+    struct Interval* left = *(struct Interval**)a;
+    struct Interval* right = *(struct Interval**)b;
+    return left->ranges[0].start - right->ranges[0].start;
+}
+
+// Linear scan in order of where each interval starts, returns 0 if something was spilled
+static int assign() {
+    struct Interval** order = malloc(interval_count * sizeof(struct Interval*));
+    int count = 0;
+
+    for (int i = REG_COUNT; i < interval_count; i++) {
+        if (intervals[i].reg == NULL) continue;
+        intervals[i].reg->reg = NULL;
+        order[count++] = &intervals[i];
+    }
+    qsort(order, count, sizeof(struct Interval*), compare_starts);
+
+    for (int i = 0; i < count; i++) {
+        struct Interval* interval = order[i];
+        struct Register* candidates[REG_COUNT * 2];
+        int candidate_count = find_candidates(interval, candidates);
+
+        for (int j = 0; (j < candidate_count) && (interval->reg->reg == NULL); j++) {
+            if (available(interval, candidates[j])) interval->reg->reg = candidates[j];
+        }
+        if (interval->reg->reg != NULL) continue;
+
+        make_room(interval);
+        free(order);
+        return 0;
+    }
+
+    free(order);
+    return 1;
+}
+
+// Whatever is live across each call is pushed in place of its IR_SAVE and popped in place
+// of its IR_RESTORE, both halves of a pair together
+static void save_registers() {
+    int order[] = {REG_A, REG_BC, REG_B, REG_C, REG_DE, REG_D, REG_E};
+
+    for (int i = 0; i < call_count; i++) {
+        struct Call* call = &calls[i];
+        if ((call->call < 0) || (call->restore < 0)) continue;
+        struct Instruction* save = instructions[call->save];
+        struct Instruction* restore = instructions[call->restore];
+        struct Instruction* instruction = instructions[call->call];
+
+        int saved[REG_COUNT] = {0};
+        for (int j = REG_COUNT; j < interval_count; j++) {
+            struct Interval* interval = &intervals[j];
+            if ((interval->reg == NULL) || !covers(interval, 2*call->call + 1)) continue;
+            saved[interval->reg->reg - registers] = 1;
+        }
+        for (int pair = REG_BC; pair <= REG_DE; pair++) {
+            struct Register* reg = &registers[pair];
+            int high = reg->high_reg - registers;
+            int low = reg->low_reg - registers;
+            if (saved[high] && saved[low]) saved[pair] = 1;
+            if (saved[pair]) saved[high] = saved[low] = 0;
+        }
+
+        struct Token* token = ir_token(instruction->token);
+        ir_insert_after(save);
+        for (int j = 0; j < REG_COUNT; j++) {
+            if (!saved[order[j]]) continue;
+            ir_push(ir_fixed_reg(order[j]));
+            remark(RK_MISSED, "calls", "RegisterSave", instruction->token, "'%s' saved and restored around call to '%s'", registers[order[j]].name, instruction->text);
+        }
+        ir_insert_before(restore);
+        for (int j = REG_COUNT - 1; j >= 0; j--) {
+            if (saved[order[j]]) ir_pop(ir_fixed_reg(order[j]));
+        }
+        ir_append();
+        ir_token(token);
+
+        ir_remove(save);
+        ir_remove(restore);
+    }
+}
+
+void allocate_registers(struct Function* allocated) {
+    clock_t start = clock();
+    function = allocated;
+    memset(short_lived, 0, short_lived_capacity);
+
+    for (int round = 0; ; round++) {
+        if (round == MAX_ROUNDS) error(NULL, "unable to allocate registers in '%s'", function->name);
+
+        number_instructions();
+        build_blocks(function);
+        find_loops();
+        find_calls();
+        build_intervals();
+        if (assign()) break;
+    }
+
+    save_registers();
+
+    int promoted = 0;
+    for (int i = REG_COUNT; i < interval_count; i++) {
+        struct VirtualRegister* reg = intervals[i].reg;
+        if ((reg == NULL) || (reg->symbol == NULL)) continue;
+        remark(RK_PASSED, "regalloc", "Promoted", reg->symbol->token, "'%s' kept in register '%s'", reg->symbol->token->value, reg->reg->name);
+        promoted++;
+    }
+
+    record_pass("regalloc", promoted, (double)(clock() - start) / CLOCKS_PER_SEC);
+}
+
+static void find_variables(struct Node** slot, void* data) {
+    struct Node* node = *slot;
+
+    if (node->kind == N_VAR_DECL) {
+        struct Symbol* symbol = node->VarDecl.symbol;
+        symbol->reg = NULL;
+        if (!symbol->is_extern && !symbol->global) {
+            symbol->reg = ir_variable_reg(symbol);
+            list_add((struct List**)data, node);
+        }
+    }
+
+    for_each_child(node, find_variables, data);
+}
+
+static void find_address_taken(struct Node** slot, void* data) {
+    struct Node* node = *slot;
+    if ((node->kind == N_UNARY) && (node->token->kind == TK_AMPERSAND)) node->UnaryOp.left->Variable.symbol->reg = NULL;
+    for_each_child(node, find_address_taken, data);
+}
+
+// Parameters and locals get a virtual register of their own unless their address is taken
+void promote_variables(struct Node* function_decl) {
+    struct List* variables = NULL;
+    find_variables(&function_decl, &variables);
+    find_address_taken(&function_decl, NULL);
+
+    for (struct List* entry = variables; entry != NULL; entry = entry->next) {
+        struct Node* node = (struct Node*)entry->value;
+        if (node->VarDecl.symbol->reg != NULL) continue;
+        remark(RK_MISSED, "regalloc", "AddressTaken", node->token, "'%s' kept on the stack as its address is taken", node->token->value);
+    }
+}
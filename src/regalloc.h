@@ -0,0 +1,10 @@
+#ifndef _REGALLOC_H
+#define _REGALLOC_H
+
+struct Node;
+struct Function;
+
+void promote_variables(struct Node*);
+void allocate_registers(struct Function*);
+
+#endif
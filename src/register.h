@@ -4,7 +4,6 @@
 struct Register {
     char* name;
     int size;
-    int free;
     
     struct Register* parent_reg;
     struct Register* high_reg;
@@ -20,12 +19,10 @@ enum {
     REG_D = 3,
     REG_E = 4,
     REG_BC = 5,
-    REG_DE = 6
+    REG_DE = 6,
+    REG_COUNT = 7
 };
 
-void dump_register_usage();
-struct Register* allocate_reg(int);
-void free_reg(struct Register*);
-void free_reg_no_sub(struct Register*);
+int registers_overlap(struct Register*, struct Register*);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <regex.h>
+#include "remarks.h"
+#include "lexer.h"
+#include "messages.h"
+
+// Optimization remarks, written as YAML documents in the same layout as
+// LLVM optimization records so existing tooling can aggregate them.
+// Each kind is enabled by a regex matched against the pass name.
+
+static char* kind_tags[] = {"Passed", "Missed", "Analysis"};
+
+static regex_t filters[3];
+static int filter_set[3] = {0, 0, 0};
+
+static FILE* remarks_fp = NULL;
+static char* current_function = NULL;
+
+void set_remark_filter(enum RemarkKind kind, char* pattern) {
+    if (filter_set[kind]) regfree(&filters[kind]);
+    if (regcomp(&filters[kind], pattern, REG_EXTENDED | REG_NOSUB) != 0) error(NULL, "invalid remark pattern '%s'", pattern);
+    filter_set[kind] = 1;
+}
+
+// Only creates the file if some kind of remark was asked for
+void open_remarks(char* filename) {
+    if (!filter_set[RK_PASSED] && !filter_set[RK_MISSED] && !filter_set[RK_ANALYSIS]) return;
+    remarks_fp = fopen(filename, "w");
+    if (!remarks_fp) error(NULL, "unable to create remarks file '%s'", filename);
+}
+
+void close_remarks() {
+    if (remarks_fp != NULL) fclose(remarks_fp);
+    remarks_fp = NULL;
+}
+
+int remarks_enabled(enum RemarkKind kind, char* pass) {
+    if ((remarks_fp == NULL) || !filter_set[kind]) return 0;
+    return regexec(&filters[kind], pass, 0, NULL, 0) == 0;
+}
+
+void set_remark_function(char* name) {
+    current_function = name;
+}
+
+// YAML single quoted scalar, quotes are escaped by doubling them
+static void print_quoted(char* s) {
+    fprintf(remarks_fp, "'");
+    for (; *s != '\0'; s++) {
+        if (*s == '\'') fprintf(remarks_fp, "''");
+        else fprintf(remarks_fp, "%c", *s);
+    }
+    fprintf(remarks_fp, "'");
+}
+
+void remark(enum RemarkKind kind, char* pass, char* name, struct Token* token, const char* format, ...) {
+    if (!remarks_enabled(kind, pass)) return;
+
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    fprintf(remarks_fp, "--- !%s\n", kind_tags[kind]);
+    fprintf(remarks_fp, "Pass:            %s\n", pass);
+    fprintf(remarks_fp, "Name:            %s\n", name);
+    if (token != NULL) {
+        fprintf(remarks_fp, "DebugLoc:        { File: ");
+        print_quoted(token->filename);
+        fprintf(remarks_fp, ", Line: %d, Column: %d }\n", token->line, token->column);
+    }
+    if (current_function != NULL) fprintf(remarks_fp, "Function:        %s\n", current_function);
+    fprintf(remarks_fp, "Args:\n");
+    fprintf(remarks_fp, "  - String:          ");
+    print_quoted(message);
+    fprintf(remarks_fp, "\n...\n");
+}
@@ -0,0 +1,15 @@
+#ifndef _REMARKS_H
+#define _REMARKS_H
+
+struct Token;
+
+enum RemarkKind {RK_PASSED, RK_MISSED, RK_ANALYSIS};
+
+void set_remark_filter(enum RemarkKind, char*);
+void open_remarks(char*);
+void close_remarks();
+int remarks_enabled(enum RemarkKind, char*);
+void set_remark_function(char*);
+void remark(enum RemarkKind, char*, char*, struct Token*, const char* format, ...);
+
+#endif
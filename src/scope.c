@@ -101,32 +101,3 @@ struct Symbol* lookup_symbol(struct Token* target_token) {
 
     error(target_token, "'%s' undeclared", target_token->value);
 }
-
-int get_symbol_stack_offset(struct Symbol* target_symbol, struct Scope* scope) {
-    // Traverse up from scope until symbol located adding up all stack sizes
-    // This should give us offsets for variables on parent stack frames
-
-    struct Scope* search_scope = scope;
-    int stack_offset = 0;
-    while (search_scope != NULL) {
-        // printf("SEARCHING SCOPE: %d size %d\n", search_scope->id, search_scope->stack_size);
-        // If scope has contains symbols then search it
-        if (search_scope->symbol_list != NULL) {
-            struct List* current_entry = search_scope->symbol_list;
-            do {
-                struct Symbol* current_symbol = (struct Symbol*)current_entry->value;
-
-                // Check if matches the symbol we're looking for
-                if (strcmp(current_symbol->token->value, target_symbol->token->value) == 0) {
-                    // TODO make this clearer
-                    return stack_offset + search_scope->stack_size - current_symbol->stack_position - target_symbol->type->size;
-                }
-            } while (list_next(&current_entry));
-        }
-
-        stack_offset += search_scope->stack_size;
-        search_scope = search_scope->parent_scope;
-    }
-
-    return -1;
-}
\ No newline at end of file
@@ -17,6 +17,5 @@ void exit_scope();
 struct Scope* get_current_scope();
 void scope_add_symbol(struct Symbol*);
 struct Symbol* lookup_symbol(struct Token*);
-int get_symbol_stack_offset(struct Symbol*, struct Scope*);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "stringpool.h"
+#include "ir.h"
+#include "lexer.h"
+#include "messages.h"
+#include "pass.h"
+#include "remarks.h"
+
+// String literals are collected while code is generated and placed together in
+// read-only data after it. Identical literals share one copy and a literal that
+// ends a longer one is labelled partway into it, so both use the same zero.
+
+#define MAX_STRINGS 256
+
+struct PooledString {
+    struct Token* token;
+    char* text;                     // Between the quotes, escapes as written
+    char* label;
+    struct PooledString* container; // Longer string this one ends, if any
+    int offset;                     // Where in the container's text it starts
+};
+
+static struct PooledString strings[MAX_STRINGS];
+static int string_count = 0;
+static int label_count = 0;
+static int pooled = 0;
+
+static char* new_label() {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "__string_%d", label_count++);
+    return strdup(buffer);
+}
+
+// Escapes are a backslash and one character
+static int char_length(char* text) {
+    return (text[0] == '\\') ? 2 : 1;
+}
+
+// Where the suffix starts in text, -1 if text doesn't end with it.
+// Only character boundaries count, "n" doesn't end "\n".
+static int suffix_offset(char* text, char* suffix) {
+    int start = strlen(text) - strlen(suffix);
+    if (start < 0) return -1;
+
+    int i = 0;
+    while (i < start) i += char_length(&text[i]);
+    if ((i != start) || (strcmp(&text[i], suffix) != 0)) return -1;
+    return start;
+}
+
+// Returns the label the literal will be placed at
+char* pool_string(struct Token* token) {
+    char* text = strndup(token->value + 1, strlen(token->value) - 2);
+
+    if (pass_enabled("strpool")) {
+        for (int i = 0; i < string_count; i++) {
+            if (strcmp(strings[i].text, text) != 0) continue;
+            remark(RK_PASSED, "strpool", "StringShared", token, "string literal shares its copy with an identical one");
+            pooled++;
+            return strings[i].label;
+        }
+    }
+
+    if (string_count == MAX_STRINGS) error(token, "too many string literals");
+    struct PooledString* string = &strings[string_count++];
+    string->token = token;
+    string->text = text;
+    string->label = new_label();
+    string->container = NULL;
+    string->offset = 0;
+    return string->label;
+}
+
+static int by_length(const void* left, const void* right) {
+    struct PooledString* left_string = *(struct PooledString**)left;
+    struct PooledString* right_string = *(struct PooledString**)right;
+    int difference = strlen(right_string->text) - strlen(left_string->text);
+    if (difference != 0) return difference;
+    return left_string - right_string;
+}
+
+// Longest first so every string finds the longest one it ends
+static void merge_suffixes() {
+    struct PooledString* sorted[MAX_STRINGS];
+    for (int i = 0; i < string_count; i++) sorted[i] = &strings[i];
+    qsort(sorted, string_count, sizeof(sorted[0]), by_length);
+
+    for (int i = 0; i < string_count; i++) {
+        for (int j = 0; j < i; j++) {
+            if (sorted[j]->container != NULL) continue;
+
+            int offset = suffix_offset(sorted[j]->text, sorted[i]->text);
+            if (offset < 0) continue;
+
+            sorted[i]->container = sorted[j];
+            sorted[i]->offset = offset;
+            remark(RK_PASSED, "strpool", "SuffixMerged", sorted[i]->token, "string literal placed at the end of a longer one");
+            pooled++;
+            break;
+        }
+    }
+}
+
+// A string's text in pieces, with a label wherever one of the strings it holds starts
+static void emit_string(struct PooledString* string) {
+    int length = strlen(string->text);
+    int start = 0;
+
+    for (int position = 0; position <= length; position++) {
+        for (int i = 0; i < string_count; i++) {
+            struct PooledString* held = &strings[i];
+            if (((held != string) && (held->container != string)) || (held->offset != position)) continue;
+
+            if (position > start) ir_data("\t#d \"%.*s\"", position - start, &string->text[start]);
+            start = position;
+            ir_label(held->label, -1);
+        }
+    }
+
+    if (length > start) ir_data("\t#d \"%s\"", &string->text[start]);
+    ir_data("\t#d8 0");
+}
+
+void emit_string_pool() {
+    clock_t start = clock();
+
+    if (pass_enabled("strpool")) merge_suffixes();
+    for (int i = 0; i < string_count; i++) {
+        if (strings[i].container == NULL) emit_string(&strings[i]);
+    }
+
+    if (pass_enabled("strpool")) record_pass("strpool", pooled, (double)(clock() - start) / CLOCKS_PER_SEC);
+    string_count = 0;
+    pooled = 0;
+}
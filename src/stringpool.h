@@ -0,0 +1,9 @@
+#ifndef _STRINGPOOL_H
+#define _STRINGPOOL_H
+
+struct Token;
+
+char* pool_string(struct Token*);
+void emit_string_pool();
+
+#endif
@@ -3,13 +3,18 @@
 
 struct Token;
 struct Type;
+struct VirtualRegister;
 
 struct Symbol {
     struct Token* token;
     struct Type* type;
     int global;
     int stack_position;
+    int frame_offset;       // Above sp once the function's frame is reserved
     int is_extern;
+
+    // Virtual register the variable lives in instead of the frame, if promoted
+    struct VirtualRegister* reg;
 };
 
 #endif
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include "target.h"
@@ -9,6 +10,10 @@ void emit_label(FILE* fp, char* label, int count) {
     else fprintf(fp, "%s_%d:\n", label, count);
 }
 
+void emit_data(FILE* fp, char* text) {
+    fprintf(fp, "%s\n", text);
+}
+
 void emit_move(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
     fprintf(fp, "\tmov %s, %s\n", left_reg->name, right_reg->name);
 }
@@ -35,6 +40,11 @@ void emit_immediate_load(FILE* fp, struct Register* reg, char* value) {
     fprintf(fp, "\tmov %s, %s\n", reg->name, value);
 };
 
+void emit_frame_address(FILE* fp, struct Register* reg, int offset, char* name) {
+    if (name != NULL) fprintf(fp, "\tmov %s, sp+%d ; %s\n", reg->name, offset, name);
+    else fprintf(fp, "\tmov %s, sp+%d\n", reg->name, offset);
+}
+
 void emit_indirect_load(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
     if (right_reg->size != 2) error(NULL, "indirect load must be a 16-bit register");
     fprintf(fp, "\tmov %s, [%s]\n", left_reg->name, right_reg->name);
@@ -79,41 +89,92 @@ void emit_return(FILE* fp) {
     fprintf(fp, "\tret\n");
 }
 
+// Clear every byte from start up to end, a and both pairs are used
+void emit_zero_fill(FILE* fp, char* start, char* end) {
+    fprintf(fp, "\tmov bc, %s\n", start);
+    fprintf(fp, "\tmov de, %s-%s\n", end, start);
+    fprintf(fp, "\tjmp .zero_fill_test\n");
+    fprintf(fp, ".zero_fill:\n");
+    fprintf(fp, "\tmov a, 0\n");
+    fprintf(fp, "\tmov [bc], a\n");
+    fprintf(fp, "\tinc bc\n");
+    fprintf(fp, "\tdec de\n");
+    fprintf(fp, ".zero_fill_test:\n");
+    fprintf(fp, "\tmov a, d\n");
+    fprintf(fp, "\tor e\n");
+    fprintf(fp, "\tjne .zero_fill\n");
+}
+
 void emit_cmp_zero(FILE* fp) {
     fprintf(fp, "\tcmp 0\n");
 };
 
+// High bytes first, the low bytes are only compared when the high ones are equal.
+// The flags are left as the deciding cmp set them.
+static void compare_u16(FILE* fp, struct Register* left_reg, char* right_high, char* right_low) {
+    static int label_count = 0;
+
+    fprintf(fp, "\tmov a, %s\n", left_reg->high_reg->name);
+    fprintf(fp, "\tcmp %s\n", right_high);
+    fprintf(fp, "\tjne .cmp_u16_decided_%d\n", label_count);
+    fprintf(fp, "\tmov a, %s\n", left_reg->low_reg->name);
+    fprintf(fp, "\tcmp %s\n", right_low);
+    fprintf(fp, ".cmp_u16_decided_%d:\n", label_count);
+
+    label_count++;
+}
+
+// Only sets the flags, an 8-bit left operand is already in the accumulator
+struct Register* emit_cmp(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
+    if (left_reg->size == 2) {
+        compare_u16(fp, left_reg, right_reg->high_reg->name, right_reg->low_reg->name);
+        return left_reg;
+    }
+
+    if (strcmp(left_reg->name, "a") != 0) error(NULL, "compare must be against the accumulator");
+    fprintf(fp, "\tcmp %s\n", right_reg->name);
+    return left_reg;
+}
+
+void emit_cmp_immediate(FILE* fp, struct Register* left_reg, char* value) {
+    if (left_reg->size == 2) {
+        char high[8], low[8];
+        long number = strtol(value, NULL, 0);
+        sprintf(high, "%ld", (number >> 8) & 0xff);
+        sprintf(low, "%ld", number & 0xff);
+        compare_u16(fp, left_reg, high, low);
+        return;
+    }
+
+    fprintf(fp, "\tcmp %s\n", value);
+}
+
+// Register allocation keeps nothing else in the accumulator.
+// Pairs are only stepped by ++ and --, at most the size of a pointer, one inc at a time.
 void emit_add_immediate(FILE* fp, struct Register* left_reg, int value) {
-    if (value == 1) {
-        fprintf(fp, "\tinc %s\n", left_reg->name);
+    if ((value == 1) || (left_reg->size == 2)) {
+        for (int i = 0; i < value; i++) fprintf(fp, "\tinc %s\n", left_reg->name);
     } else {
-        // Preserve accumulator if necessary
-        if ((strcmp(left_reg->name, "a") != 0) && (!registers[0].free)) emit_push(fp, &registers[REG_A]);
-        
         // Move to accumulator if necessary
         if (strcmp(left_reg->name, "a") != 0) emit_move(fp, &registers[REG_A], left_reg);
 
         fprintf(fp, "\tadd %d\n", value);
 
-        // Restore accumulator if necessary
-        if ((strcmp(left_reg->name, "a") != 0) && (!registers[0].free)) emit_pop(fp, &registers[REG_A]);
+        if (strcmp(left_reg->name, "a") != 0) emit_move(fp, left_reg, &registers[REG_A]);
     }
 };
 
+// Register allocation keeps nothing else in the accumulator
 void emit_sub_immediate(FILE* fp, struct Register* left_reg, int value) {
-    if (value == 1) {
-        fprintf(fp, "\tdec %s\n", left_reg->name);
+    if ((value == 1) || (left_reg->size == 2)) {
+        for (int i = 0; i < value; i++) fprintf(fp, "\tdec %s\n", left_reg->name);
     } else {
-        // Preserve accumulator if necessary
-        if ((strcmp(left_reg->name, "a") != 0) && (!registers[0].free)) emit_push(fp, &registers[REG_A]);
-        
         // Move to accumulator if necessary
         if (strcmp(left_reg->name, "a") != 0) emit_move(fp, &registers[REG_A], left_reg);
 
         fprintf(fp, "\tsub %d\n", value);
 
-        // Restore accumulator if necessary
-        if ((strcmp(left_reg->name, "a") != 0) && (!registers[0].free)) emit_pop(fp, &registers[REG_A]);
+        if (strcmp(left_reg->name, "a") != 0) emit_move(fp, left_reg, &registers[REG_A]);
     }
 };
 
@@ -121,13 +182,18 @@ static struct Register* add_u8(FILE* fp, struct Register* left_reg, struct Regis
     if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov a, %s\n", left_reg->name);
     fprintf(fp, "\tadd %s\n", right_reg->name);
     if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov %s, a\n", left_reg->name);
-    free_reg(right_reg);
     return left_reg;
 }
 
+// Low bytes first, their carry is loaded into the accumulator and added in with the high bytes
 static struct Register* add_u16(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
-    fprintf(fp, "add16 %s, %s\n", left_reg->name, right_reg->name);
-    free_reg(right_reg);
+    fprintf(fp, "\tmov a, %s\n", left_reg->low_reg->name);
+    fprintf(fp, "\tadd %s\n", right_reg->low_reg->name);
+    fprintf(fp, "\tmov %s, a\n", left_reg->low_reg->name);
+    fprintf(fp, "\tldc\n");
+    fprintf(fp, "\tadd %s\n", left_reg->high_reg->name);
+    fprintf(fp, "\tadd %s\n", right_reg->high_reg->name);
+    fprintf(fp, "\tmov %s, a\n", left_reg->high_reg->name);
     return left_reg;
 }
 
@@ -140,13 +206,19 @@ static struct Register* sub_u8(FILE* fp, struct Register* left_reg, struct Regis
     if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov a, %s\n", left_reg->name);
     fprintf(fp, "\tsub %s\n", right_reg->name);
     if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov %s, a\n", left_reg->name);
-    free_reg(right_reg);
     return left_reg;
 }
 
+// Carry is set when the low bytes didn't borrow, one less than it is the borrow to take off the high bytes
 static struct Register* sub_u16(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
-    fprintf(fp, "sub16 %s, %s\n", left_reg->name, right_reg->name);
-    free_reg(right_reg);
+    fprintf(fp, "\tmov a, %s\n", left_reg->low_reg->name);
+    fprintf(fp, "\tsub %s\n", right_reg->low_reg->name);
+    fprintf(fp, "\tmov %s, a\n", left_reg->low_reg->name);
+    fprintf(fp, "\tldc\n");
+    fprintf(fp, "\tdec a\n");
+    fprintf(fp, "\tadd %s\n", left_reg->high_reg->name);
+    fprintf(fp, "\tsub %s\n", right_reg->high_reg->name);
+    fprintf(fp, "\tmov %s, a\n", left_reg->high_reg->name);
     return left_reg;
 }
 
@@ -159,14 +231,12 @@ static struct Register* and_u8(FILE* fp, struct Register* left_reg, struct Regis
     if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov a, %s\n", left_reg->name);
     fprintf(fp, "\tand %s\n", right_reg->name);
     if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov %s, a\n", left_reg->name);
-    free_reg(right_reg);
     return left_reg;
 }
 
 static struct Register* and_u16(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
     and_u8(fp, left_reg->low_reg, right_reg->low_reg);
     and_u8(fp, left_reg->high_reg, right_reg->high_reg);
-    free_reg(right_reg);
     return left_reg;
 }
 
@@ -179,14 +249,12 @@ static struct Register* or_u8(FILE* fp, struct Register* left_reg, struct Regist
     if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov a, %s\n", left_reg->name);
     fprintf(fp, "\tor %s\n", right_reg->name);
     if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov %s, a\n", left_reg->name);
-    free_reg(right_reg);
     return left_reg;
 }
 
 static struct Register* or_u16(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
     or_u8(fp, left_reg->low_reg, right_reg->low_reg);
     or_u8(fp, left_reg->high_reg, right_reg->high_reg);
-    free_reg(right_reg);
     return left_reg;
 }
 
@@ -203,9 +271,18 @@ static struct Register* is_zero_u8(FILE* fp, struct Register* left_reg) {
     return left_reg;
 }
 
+// Leaves the result in the low byte, the same as the other 16-bit tests
+static struct Register* is_zero_u16(FILE* fp, struct Register* left_reg) {
+    fprintf(fp, "\tmov a, %s\n", left_reg->high_reg->name);
+    fprintf(fp, "\tor %s\n", left_reg->low_reg->name);
+    fprintf(fp, "\tlde\n");
+    fprintf(fp, "\tmov %s, a\n", left_reg->low_reg->name);
+    return left_reg->low_reg;
+}
+
 struct Register* emit_is_zero(FILE* fp, struct Register* left_reg) {
     if (left_reg->size == 1) return is_zero_u8(fp, left_reg);
-    else error(NULL, "emit is_zero_u16 not implemented");
+    else return is_zero_u16(fp, left_reg);
 }
 
 static struct Register* is_equal_u8(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
@@ -213,24 +290,19 @@ static struct Register* is_equal_u8(FILE* fp, struct Register* left_reg, struct
     fprintf(fp, "\tcmp %s\n", right_reg->name);
     fprintf(fp, "\tlde\n");
     if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov %s, a\n", left_reg->name);
-    free_reg(right_reg);
     return left_reg;
 }
 
 static struct Register* is_equal_u16(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
-    is_equal_u8(fp, left_reg->low_reg, right_reg->low_reg);
-    is_equal_u8(fp, left_reg->high_reg, right_reg->high_reg);
-    free_reg(right_reg);
-
-    and_u8(fp, left_reg->high_reg, left_reg->low_reg);
-    free_reg_no_sub(left_reg->low_reg);
-    free_reg_no_sub(left_reg);
-    return left_reg->high_reg;
+    compare_u16(fp, left_reg, right_reg->high_reg->name, right_reg->low_reg->name);
+    fprintf(fp, "\tlde\n");
+    fprintf(fp, "\tmov %s, a\n", left_reg->low_reg->name);
+    return left_reg->low_reg;
 }
 
 struct Register* emit_is_equal(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
     if (left_reg->size == 1) return is_equal_u8(fp, left_reg, right_reg);
-    else is_equal_u16(fp, left_reg, right_reg);
+    else return is_equal_u16(fp, left_reg, right_reg);
 }
 
 struct Register* emit_is_not_equal(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
@@ -246,19 +318,14 @@ static struct Register* is_more_u8(FILE* fp, struct Register* left_reg, struct R
     fprintf(fp, "\tldc\n"); // A <= right
 
     if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov %s, a\n", left_reg->name);
-    free_reg(right_reg);
 
     return left_reg;
 }
 
 static struct Register* is_more_u16(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
-    // TODO
-    error(NULL, "emit is_more_u16 not implemented");
-
-    free_reg(right_reg);
-    free_reg_no_sub(left_reg->high_reg);
-    free_reg_no_sub(left_reg);
-
+    compare_u16(fp, left_reg, right_reg->high_reg->name, right_reg->low_reg->name);
+    fprintf(fp, "\tldc\n");
+    fprintf(fp, "\tmov %s, a\n", left_reg->low_reg->name);
     return left_reg->low_reg;
 }
 
@@ -288,20 +355,23 @@ static struct Register* is_more_or_equal_u8(FILE* fp, struct Register* left_reg,
     label_count++;
 
     if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov %s, a\n", left_reg->name);
-    free_reg(right_reg);
 
     return left_reg;
 }
 
-static struct Register* is_more_or_equal_u16(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
-    // TODO
-    error(NULL, "emit is_more_or_equal_u16 not implemented");
-
-    free_reg(right_reg);
-    free_reg_no_sub(left_reg->high_reg);
-    free_reg_no_sub(left_reg);
+// Carry or zero, loading a flag into the accumulator leaves the flags alone
+static struct Register* more_or_equal_flags(FILE* fp, struct Register* reg) {
+    fprintf(fp, "\tldc\n");
+    fprintf(fp, "\tmov %s, a\n", reg->name);
+    fprintf(fp, "\tlde\n");
+    fprintf(fp, "\tor %s\n", reg->name);
+    fprintf(fp, "\tmov %s, a\n", reg->name);
+    return reg;
+}
 
-    return left_reg->low_reg;
+static struct Register* is_more_or_equal_u16(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
+    compare_u16(fp, left_reg, right_reg->high_reg->name, right_reg->low_reg->name);
+    return more_or_equal_flags(fp, left_reg->low_reg);
 }
 
 struct Register* emit_is_more_or_equal(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
@@ -330,25 +400,21 @@ static struct Register* is_less_u8(FILE* fp, struct Register* left_reg, struct R
     label_count++;
 
     if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov %s, a\n", left_reg->name);
-    free_reg(right_reg);
 
     return left_reg;
 }
 
+// Compared the other way round, right is more than left
 static struct Register* is_less_u16(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
-    // TODO
-    error(NULL, "emit is_less_u16 not implemented");
-
-    free_reg(right_reg);
-    free_reg_no_sub(left_reg->high_reg);
-    free_reg_no_sub(left_reg);
-
+    compare_u16(fp, right_reg, left_reg->high_reg->name, left_reg->low_reg->name);
+    fprintf(fp, "\tldc\n");
+    fprintf(fp, "\tmov %s, a\n", left_reg->low_reg->name);
     return left_reg->low_reg;
 }
 
 struct Register* emit_is_less(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
     if (left_reg->size == 1) return is_less_u8(fp, left_reg, right_reg);
-    else is_less_u16(fp, left_reg, right_reg);
+    else return is_less_u16(fp, left_reg, right_reg);
 }
 
 static struct Register* is_less_or_equal_u8(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
@@ -371,20 +437,13 @@ static struct Register* is_less_or_equal_u8(FILE* fp, struct Register* left_reg,
     label_count++;
 
     if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov %s, a\n", left_reg->name);
-    free_reg(right_reg);
-    
+
     return left_reg;
 }
 
 static struct Register* is_less_or_equal_u16(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
-    // TODO
-    error(NULL, "emit is_less_or_equal_u16 not implemented");
-
-    free_reg(right_reg);
-    free_reg_no_sub(left_reg->high_reg);
-    free_reg_no_sub(left_reg);
-
-    return left_reg->low_reg;
+    compare_u16(fp, right_reg, left_reg->high_reg->name, left_reg->low_reg->name);
+    return more_or_equal_flags(fp, left_reg->low_reg);
 }
 
 struct Register* emit_is_less_or_equal(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
@@ -392,67 +451,435 @@ struct Register* emit_is_less_or_equal(FILE* fp, struct Register* left_reg, stru
     else return is_less_or_equal_u16(fp, left_reg, right_reg);
 }
 
-// TODO this is a rotate instead of shift :(
-static struct Register* left_shift_u8(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
-    if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov a, %s\n", left_reg->name);
+static void rotate_left(FILE* fp, int count) {
+    for (int i = 0; i < count; i++) fprintf(fp, "\trol\n");
+}
+
+// Doubling shifts left. There is no right rotate so a right shift
+// rotates left the rest of the way round and masks off what wrapped.
+static void shift_accumulator(FILE* fp, int right, int amount) {
+    if (amount == 0) return;
+
+    if (amount >= 8) {
+        fprintf(fp, "\tmov a, 0\n");
+    } else if (right) {
+        rotate_left(fp, 8 - amount);
+        fprintf(fp, "\tand %d\n", 0xff >> amount);
+    } else {
+        for (int i = 0; i < amount; i++) fprintf(fp, "\tadd a\n");
+    }
+}
+
+// Less than a byte, the low bits of the high byte wrap round into the top of the low byte
+static void shift_pair_right(FILE* fp, struct Register* reg, int amount) {
+    int rotation = 8 - amount;
+    char* high = reg->high_reg->name;
+    char* low = reg->low_reg->name;
+
+    fprintf(fp, "\tmov a, %s\n", low);
+    rotate_left(fp, rotation);
+    fprintf(fp, "\tand %d\n", 0xff >> amount);
+    fprintf(fp, "\tmov %s, a\n", low);
+
+    fprintf(fp, "\tmov a, %s\n", high);
+    rotate_left(fp, rotation);
+    fprintf(fp, "\tmov %s, a\n", high);
+    fprintf(fp, "\tand %d\n", (0xff << rotation) & 0xff);
+    fprintf(fp, "\tor %s\n", low);
+    fprintf(fp, "\tmov %s, a\n", low);
+
+    fprintf(fp, "\tmov a, %s\n", high);
+    fprintf(fp, "\tand %d\n", 0xff >> amount);
+    fprintf(fp, "\tmov %s, a\n", high);
+}
+
+static void shift_u16(FILE* fp, struct Register* reg, int right, int amount) {
+    struct Register* from = right ? reg->high_reg : reg->low_reg;
+    struct Register* to = right ? reg->low_reg : reg->high_reg;
+
+    if (amount == 0) return;
+
+    if (amount >= 16) {
+        fprintf(fp, "\tmov %s, 0\n", reg->high_reg->name);
+        fprintf(fp, "\tmov %s, 0\n", reg->low_reg->name);
+    } else if (amount >= 8) {
+        // Whole bytes move across and the rest is an 8-bit shift
+        fprintf(fp, "\tmov a, %s\n", from->name);
+        shift_accumulator(fp, right, amount - 8);
+        fprintf(fp, "\tmov %s, a\n", to->name);
+        fprintf(fp, "\tmov %s, 0\n", from->name);
+    } else if (right) {
+        shift_pair_right(fp, reg, amount);
+    } else {
+        for (int i = 0; i < amount; i++) add_u16(fp, reg, reg);
+    }
+}
+
+// The caller saves the accumulator if it holds a value
+static void shift_immediate(FILE* fp, struct Register* left_reg, int right, int amount) {
+    if (left_reg->size == 2) {
+        shift_u16(fp, left_reg, right, amount);
+        return;
+    }
+
+    if (strcmp(left_reg->name, "a") != 0) emit_move(fp, &registers[REG_A], left_reg);
+    shift_accumulator(fp, right, amount);
+    if (strcmp(left_reg->name, "a") != 0) emit_move(fp, left_reg, &registers[REG_A]);
+}
+
+void emit_left_shift_immediate(FILE* fp, struct Register* left_reg, int amount) {
+    shift_immediate(fp, left_reg, 0, amount);
+}
+
+void emit_right_shift_immediate(FILE* fp, struct Register* left_reg, int amount) {
+    shift_immediate(fp, left_reg, 1, amount);
+}
 
+// Shifts a bit at a time while counting the amount down, which uses it up
+static struct Register* shift_loop(FILE* fp, struct Register* left_reg, struct Register* right_reg, int right) {
     static int label_count = 0;
+    char* name = right ? ".shr" : ".shl";
+    struct Register* count_reg = (right_reg->size == 2) ? right_reg->low_reg : right_reg;
+
+    // Only the low byte is counted down, any count of 256 or more shifts out all 16 bits
+    if (right_reg->size == 2) {
+        fprintf(fp, "\tmov a, %s\n", right_reg->high_reg->name);
+        fprintf(fp, "\tcmp 0\n");
+        fprintf(fp, "\tje %s_counted_%d\n", name, label_count);
+        fprintf(fp, "\tmov %s, 16\n", count_reg->name);
+        fprintf(fp, "%s_counted_%d:\n", name, label_count);
+    }
 
-    fprintf(fp, "\tpush a\n");
-    fprintf(fp, "\tmov a, %s\n", right_reg->name);
-    fprintf(fp, "\tand 0b111\n");
-    fprintf(fp, "\tmov %s, a\n", right_reg->name);
-    fprintf(fp, "\tpop a\n");
+    if ((left_reg->size == 1) && (strcmp(left_reg->name, "a") != 0)) fprintf(fp, "\tmov a, %s\n", left_reg->name);
 
-    fprintf(fp, ".shl_loop_%d:\n", label_count);
-    fprintf(fp, "\tdec %s\n", right_reg->name);
-    fprintf(fp, "\tjnc .shl_exit_%d\n", label_count);
-    fprintf(fp, "\trol\n");
-    fprintf(fp, "\tjmp .shl_loop_%d\n", label_count);
-    fprintf(fp, ".shl_exit_%d:\n", label_count);
+    fprintf(fp, "%s_loop_%d:\n", name, label_count);
+    fprintf(fp, "\tdec %s\n", count_reg->name);
+    fprintf(fp, "\tjnc %s_exit_%d\n", name, label_count);
+    if (left_reg->size == 2) shift_u16(fp, left_reg, right, 1);
+    else shift_accumulator(fp, right, 1);
+    fprintf(fp, "\tjmp %s_loop_%d\n", name, label_count);
+    fprintf(fp, "%s_exit_%d:\n", name, label_count);
 
     label_count++;
 
-    if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov %s, a\n", left_reg->name);
-    free_reg(right_reg);
+    if ((left_reg->size == 1) && (strcmp(left_reg->name, "a") != 0)) fprintf(fp, "\tmov %s, a\n", left_reg->name);
 
     return left_reg;
 }
 
 struct Register* emit_left_shift(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
-    if (left_reg->size == 1) return left_shift_u8(fp, left_reg, right_reg);
-    else error(NULL, "emit shift_left_u16 not implemented");
+    return shift_loop(fp, left_reg, right_reg, 0);
 }
 
-// TODO this is a rotate instead of shift :(
-static struct Register* right_shift_u8(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
-    if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov a, %s\n", left_reg->name);
+struct Register* emit_right_shift(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
+    return shift_loop(fp, left_reg, right_reg, 1);
+}
+
+// Doubles and adds a copy of the value for each bit of the constant below the top one.
+// Without a spare register for the copy the routine is called with the constant.
+void emit_multiply_immediate(FILE* fp, struct Register* left_reg, struct Register* copy_reg, int value) {
+    if (copy_reg == NULL) {
+        // Multiplying is commutative so the constant can take the value's place
+        if (left_reg->size == 1) {
+            emit_push(fp, &registers[REG_A]);
+            fprintf(fp, "\tmov a, %d\n", value);
+            emit_call(fp, "__mul_u8", -1);
+            emit_stack_free(fp, 1);
+        } else {
+            emit_push(fp, left_reg);
+            fprintf(fp, "\tmov %s, %d\n", left_reg->name, value);
+            emit_push(fp, left_reg);
+            emit_call(fp, "__mul_u16", -1);
+            emit_stack_free(fp, 2);
+            emit_pop(fp, left_reg);
+        }
+        return;
+    }
 
-    static int label_count = 0;
+    if (value == 0) {
+        fprintf(fp, "\tmov %s, 0\n", left_reg->name);
+        return;
+    }
 
-    fprintf(fp, "\tpush a\n");
-    fprintf(fp, "\tmov a, 8\n");
-    fprintf(fp, "\tsub %s\n", right_reg->name);
-    fprintf(fp, "\tand 0b111\n");
-    fprintf(fp, "\tmov %s, a\n", right_reg->name);
-    fprintf(fp, "\tpop a\n");
+    int top = 15;
+    while (!(value & (1 << top))) top--;
+
+    emit_move(fp, copy_reg, left_reg);
+    for (int bit = top - 1; bit >= 0; bit--) {
+        if (left_reg->size == 1) {
+            fprintf(fp, "\tadd a\n");
+            if (value & (1 << bit)) fprintf(fp, "\tadd %s\n", copy_reg->name);
+        } else {
+            add_u16(fp, left_reg, left_reg);
+            if (value & (1 << bit)) add_u16(fp, left_reg, copy_reg);
+        }
+    }
+}
 
-    fprintf(fp, ".shr_loop_%d:\n", label_count);
-    fprintf(fp, "\tdec %s\n", right_reg->name);
-    fprintf(fp, "\tjnc .shr_exit_%d\n", label_count);
-    fprintf(fp, "\trol\n");
-    fprintf(fp, "\tjmp .shr_loop_%d\n", label_count);
-    fprintf(fp, ".shr_exit_%d:\n", label_count);
+// 8-bit operations take the left operand in the accumulator and the right one on the stack,
+// 16-bit ones take both on the stack and leave the result in place of the left operand
+struct Register* emit_multiply(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
+    if (left_reg->size == 1) {
+        if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov a, %s\n", left_reg->name);
+        emit_push(fp, right_reg);
+        emit_call(fp, "__mul_u8", -1);
+        emit_stack_free(fp, 1);
+        if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov %s, a\n", left_reg->name);
+    } else {
+        emit_push(fp, left_reg);
+        emit_push(fp, right_reg);
+        emit_call(fp, "__mul_u16", -1);
+        emit_stack_free(fp, 2);
+        emit_pop(fp, left_reg);
+    }
+    return left_reg;
+}
 
-    label_count++;
+// Division leaves the quotient where the left operand was and the remainder where the right one was
+static struct Register* divide(FILE* fp, struct Register* left_reg, struct Register* right_reg, int remainder) {
+    if (left_reg->size == 1) {
+        if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov a, %s\n", left_reg->name);
+        emit_push(fp, right_reg);
+        emit_call(fp, "__divmod_u8", -1);
+        if (remainder) emit_pop(fp, &registers[REG_A]);
+        else emit_stack_free(fp, 1);
+        if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov %s, a\n", left_reg->name);
+    } else {
+        emit_push(fp, left_reg);
+        emit_push(fp, right_reg);
+        emit_call(fp, "__divmod_u16", -1);
+        if (remainder) {
+            emit_pop(fp, left_reg);
+            emit_stack_free(fp, 2);
+        } else {
+            emit_stack_free(fp, 2);
+            emit_pop(fp, left_reg);
+        }
+    }
+    return left_reg;
+}
 
-    if (strcmp(left_reg->name, "a") != 0) fprintf(fp, "\tmov %s, a\n", left_reg->name);
-    free_reg(right_reg);
+struct Register* emit_divide(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
+    return divide(fp, left_reg, right_reg, 0);
+}
 
-    return left_reg;
+struct Register* emit_modulo(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
+    return divide(fp, left_reg, right_reg, 1);
 }
 
-struct Register* emit_right_shift(FILE* fp, struct Register* left_reg, struct Register* right_reg) {
-    if (left_reg->size == 1) return right_shift_u8(fp, left_reg, right_reg);
-    else error(NULL, "emit shift_right_u16 not implemented");
-}
\ No newline at end of file
+// Shift and add from the top bit of the multiplier down, after skipping its leading zeros.
+// Everything but the accumulator is preserved.
+static void multiply_u8_routine(FILE* fp) {
+    fprintf(fp, "__mul_u8:\n");
+    fprintf(fp, "\tpush bc\n");
+    fprintf(fp, "\tpush de\n");
+    fprintf(fp, "\tmov d, a\n");
+    fprintf(fp, "\tmov bc, sp+6\n");
+    fprintf(fp, "\tmov a, [bc]\n");
+    fprintf(fp, "\tmov c, 0\n");
+    fprintf(fp, "\tmov b, 8\n");
+    fprintf(fp, "\tcmp 0\n");
+    fprintf(fp, "\tje .done\n");
+    fprintf(fp, ".align:\n");
+    fprintf(fp, "\tcmp 127\n");
+    fprintf(fp, "\tjc .aligned\n");
+    fprintf(fp, "\tadd a\n");
+    fprintf(fp, "\tdec b\n");
+    fprintf(fp, "\tjmp .align\n");
+    fprintf(fp, ".aligned:\n");
+    fprintf(fp, "\tmov e, a\n");
+    fprintf(fp, ".loop:\n");
+    fprintf(fp, "\tmov a, c\n");
+    fprintf(fp, "\tadd a\n");
+    fprintf(fp, "\tmov c, a\n");
+    fprintf(fp, "\tmov a, e\n");
+    fprintf(fp, "\tadd a\n");
+    fprintf(fp, "\tmov e, a\n");
+    fprintf(fp, "\tjnc .next\n");
+    fprintf(fp, "\tmov a, c\n");
+    fprintf(fp, "\tadd d\n");
+    fprintf(fp, "\tmov c, a\n");
+    fprintf(fp, ".next:\n");
+    fprintf(fp, "\tdec b\n");
+    fprintf(fp, "\tjne .loop\n");
+    fprintf(fp, ".done:\n");
+    fprintf(fp, "\tmov a, c\n");
+    fprintf(fp, "\tpop de\n");
+    fprintf(fp, "\tpop bc\n");
+    fprintf(fp, "\tret\n");
+}
+
+// Restoring division, the dividend shifts into the remainder a bit at a time and
+// the quotient shifts in behind it. Leading zeros of the dividend are skipped.
+// The remainder is written over the divisor, everything but the accumulator is preserved.
+static void divide_u8_routine(FILE* fp) {
+    fprintf(fp, "__divmod_u8:\n");
+    fprintf(fp, "\tpush bc\n");
+    fprintf(fp, "\tpush de\n");
+    fprintf(fp, "\tmov d, a\n");
+    fprintf(fp, "\tmov bc, sp+6\n");
+    fprintf(fp, "\tmov e, [bc]\n");
+    fprintf(fp, "\tmov c, 0\n");
+    fprintf(fp, "\tmov b, 8\n");
+    fprintf(fp, "\tcmp 0\n");
+    fprintf(fp, "\tje .done\n");
+    fprintf(fp, ".align:\n");
+    fprintf(fp, "\tcmp 127\n");
+    fprintf(fp, "\tjc .aligned\n");
+    fprintf(fp, "\tadd a\n");
+    fprintf(fp, "\tdec b\n");
+    fprintf(fp, "\tjmp .align\n");
+    fprintf(fp, ".aligned:\n");
+    fprintf(fp, "\tmov d, a\n");
+    fprintf(fp, ".loop:\n");
+    fprintf(fp, "\tmov a, d\n");
+    fprintf(fp, "\tadd a\n");
+    fprintf(fp, "\tmov d, a\n");
+    // The remainder is below the divisor so adding the bit first can't overflow, doubling can
+    fprintf(fp, "\tldc\n");
+    fprintf(fp, "\tadd c\n");
+    fprintf(fp, "\tadd c\n");
+    fprintf(fp, "\tjc .subtract\n");
+    fprintf(fp, "\tcmp e\n");
+    fprintf(fp, "\tjc .subtract\n");
+    fprintf(fp, "\tje .subtract\n");
+    fprintf(fp, "\tmov c, a\n");
+    fprintf(fp, "\tjmp .next\n");
+    fprintf(fp, ".subtract:\n");
+    fprintf(fp, "\tsub e\n");
+    fprintf(fp, "\tmov c, a\n");
+    fprintf(fp, "\tinc d\n");
+    fprintf(fp, ".next:\n");
+    fprintf(fp, "\tdec b\n");
+    fprintf(fp, "\tjne .loop\n");
+    fprintf(fp, ".done:\n");
+    fprintf(fp, "\tmov a, c\n");
+    fprintf(fp, "\tmov bc, sp+6\n");
+    fprintf(fp, "\tmov [bc], a\n");
+    fprintf(fp, "\tmov a, d\n");
+    fprintf(fp, "\tpop de\n");
+    fprintf(fp, "\tpop bc\n");
+    fprintf(fp, "\tret\n");
+}
+
+// Shift and add over the multiplier a byte at a time, the product is kept in de
+// and the multiplicand read from the stack when a bit is set. A zero high byte is skipped.
+static void multiply_u16_routine(FILE* fp) {
+    fprintf(fp, "__mul_u16:\n");
+    fprintf(fp, "\tpush bc\n");
+    fprintf(fp, "\tpush de\n");
+    fprintf(fp, "\tmov de, 0\n");
+    fprintf(fp, "\tmov bc, sp+6\n");
+    fprintf(fp, "\tmov a, [bc]\n");
+    fprintf(fp, "\tcmp 0\n");
+    fprintf(fp, "\tjne .high\n");
+    fprintf(fp, "\tmov bc, sp+7\n");
+    fprintf(fp, "\tmov a, [bc]\n");
+    fprintf(fp, "\tmov c, a\n");
+    fprintf(fp, "\tmov b, 8\n");
+    fprintf(fp, "\tjmp .loop\n");
+    fprintf(fp, ".high:\n");
+    fprintf(fp, "\tmov c, a\n");
+    fprintf(fp, "\tmov b, 16\n");
+    fprintf(fp, ".loop:\n");
+    add_u16(fp, &registers[REG_DE], &registers[REG_DE]);
+    fprintf(fp, "\tmov a, c\n");
+    fprintf(fp, "\tadd a\n");
+    fprintf(fp, "\tmov c, a\n");
+    fprintf(fp, "\tjnc .next\n");
+    fprintf(fp, "\tpush bc\n");
+    fprintf(fp, "\tmov bc, sp+10\n");
+    fprintf(fp, "\tmov bc, [bc]\n");
+    add_u16(fp, &registers[REG_DE], &registers[REG_BC]);
+    fprintf(fp, "\tpop bc\n");
+    fprintf(fp, ".next:\n");
+    fprintf(fp, "\tdec b\n");
+    fprintf(fp, "\tje .done\n");
+    fprintf(fp, "\tmov a, b\n");
+    fprintf(fp, "\tcmp 8\n");
+    fprintf(fp, "\tjne .loop\n");
+    fprintf(fp, "\tpush bc\n");
+    fprintf(fp, "\tmov bc, sp+9\n");
+    fprintf(fp, "\tmov a, [bc]\n");
+    fprintf(fp, "\tpop bc\n");
+    fprintf(fp, "\tmov c, a\n");
+    fprintf(fp, "\tjmp .loop\n");
+    fprintf(fp, ".done:\n");
+    fprintf(fp, "\tmov bc, sp+8\n");
+    fprintf(fp, "\tmov [bc], de\n");
+    fprintf(fp, "\tpop de\n");
+    fprintf(fp, "\tpop bc\n");
+    fprintf(fp, "\tret\n");
+}
+
+// Restoring division with the quotient in bc and the remainder in de, the counter
+// and divisor stay on the stack. A remainder with its top bit set is always subtracted
+// from once doubled, as doing so carries out of 16 bits.
+static void divide_u16_routine(FILE* fp) {
+    fprintf(fp, "__divmod_u16:\n");
+    fprintf(fp, "\tpush bc\n");
+    fprintf(fp, "\tpush de\n");
+    fprintf(fp, "\tmov bc, sp+8\n");
+    fprintf(fp, "\tmov bc, [bc]\n");
+    fprintf(fp, "\tmov de, 0\n");
+    fprintf(fp, "\tmov a, 16\n");
+    fprintf(fp, "\tpush a\n");
+    fprintf(fp, ".loop:\n");
+    fprintf(fp, "\tmov a, d\n");
+    fprintf(fp, "\tcmp 127\n");
+    fprintf(fp, "\tldc\n");
+    fprintf(fp, "\tpush a\n");
+    fprintf(fp, "\tmov a, b\n");
+    fprintf(fp, "\tcmp 127\n");
+    fprintf(fp, "\tldc\n");
+    fprintf(fp, "\tpush a\n");
+    add_u16(fp, &registers[REG_BC], &registers[REG_BC]);
+    add_u16(fp, &registers[REG_DE], &registers[REG_DE]);
+    fprintf(fp, "\tpop a\n");
+    fprintf(fp, "\tor e\n");
+    fprintf(fp, "\tmov e, a\n");
+    fprintf(fp, "\tpop a\n");
+    fprintf(fp, "\tcmp 0\n");
+    fprintf(fp, "\tjne .subtract\n");
+    fprintf(fp, "\tpush bc\n");
+    fprintf(fp, "\tmov bc, sp+9\n");
+    fprintf(fp, "\tmov bc, [bc]\n");
+    compare_u16(fp, &registers[REG_DE], "b", "c");
+    fprintf(fp, "\tpop bc\n");
+    fprintf(fp, "\tjc .subtract\n");
+    fprintf(fp, "\tje .subtract\n");
+    fprintf(fp, "\tjmp .next\n");
+    fprintf(fp, ".subtract:\n");
+    fprintf(fp, "\tpush bc\n");
+    fprintf(fp, "\tmov bc, sp+9\n");
+    fprintf(fp, "\tmov bc, [bc]\n");
+    sub_u16(fp, &registers[REG_DE], &registers[REG_BC]);
+    fprintf(fp, "\tpop bc\n");
+    fprintf(fp, "\tinc c\n");
+    fprintf(fp, ".next:\n");
+    fprintf(fp, "\tpop a\n");
+    fprintf(fp, "\tdec a\n");
+    fprintf(fp, "\tpush a\n");
+    fprintf(fp, "\tjne .loop\n");
+    fprintf(fp, "\tpop a\n");
+    fprintf(fp, "\tpush de\n");
+    fprintf(fp, "\tmov de, sp+10\n");
+    fprintf(fp, "\tmov [de], bc\n");
+    fprintf(fp, "\tpop de\n");
+    fprintf(fp, "\tmov bc, sp+6\n");
+    fprintf(fp, "\tmov [bc], de\n");
+    fprintf(fp, "\tpop de\n");
+    fprintf(fp, "\tpop bc\n");
+    fprintf(fp, "\tret\n");
+}
+
+void emit_routine(FILE* fp, enum Routine routine) {
+    switch (routine) {
+        case ROUTINE_MULTIPLY_U8: multiply_u8_routine(fp); break;
+        case ROUTINE_DIVIDE_U8: divide_u8_routine(fp); break;
+        case ROUTINE_MULTIPLY_U16: multiply_u16_routine(fp); break;
+        case ROUTINE_DIVIDE_U16: divide_u16_routine(fp); break;
+        default: error(NULL, "invalid routine");
+    }
+    fprintf(fp, "\n");
+}
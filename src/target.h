@@ -6,7 +6,17 @@ typedef struct _IO_FILE FILE;
 
 struct Register;
 
+// Runtime routines for operations there's no instruction for
+enum Routine {
+    ROUTINE_MULTIPLY_U8,
+    ROUTINE_DIVIDE_U8,
+    ROUTINE_MULTIPLY_U16,
+    ROUTINE_DIVIDE_U16,
+    ROUTINE_COUNT
+};
+
 void emit_label(FILE* fp, char*, int);
+void emit_data(FILE*, char*);
 void emit_move(FILE*, struct Register*, struct Register*);
 void emit_push(FILE*, struct Register*);
 void emit_pop(FILE*, struct Register*);
@@ -14,6 +24,7 @@ void emit_stack_reserve(FILE*, unsigned int);
 void emit_stack_free(FILE*, unsigned int);
 
 void emit_immediate_load(FILE*, struct Register*, char*);
+void emit_frame_address(FILE*, struct Register*, int, char*);
 // void emit_absolute_load(FILE*, struct Register*, char*);
 // void emit_absolute_store(FILE*, char*, struct Register*);
 void emit_indirect_load(FILE*, struct Register*, struct Register*);
@@ -27,10 +38,14 @@ void emit_jump_if_carry(FILE*, char*, int);
 void emit_jump_if_not_carry(FILE*, char*, int);
 
 void emit_return(FILE*);
+void emit_zero_fill(FILE*, char*, char*);
 void emit_cmp_zero(FILE*);
+void emit_cmp_immediate(FILE*, struct Register*, char*);
 
 void emit_add_immediate(FILE*, struct Register*, int);
 void emit_sub_immediate(FILE*, struct Register*, int);
+void emit_left_shift_immediate(FILE*, struct Register*, int);
+void emit_right_shift_immediate(FILE*, struct Register*, int);
 
 struct Register* emit_add(FILE*, struct Register*, struct Register*);
 struct Register* emit_sub(FILE*, struct Register*, struct Register*);
@@ -44,6 +59,11 @@ struct Register* emit_is_more(FILE*, struct Register*, struct Register*);
 struct Register* emit_is_more_or_equal(FILE*, struct Register*, struct Register*);
 struct Register* emit_is_less(FILE*, struct Register*, struct Register*);
 struct Register* emit_is_less_or_equal(FILE*, struct Register*, struct Register*);
+struct Register* emit_multiply(FILE*, struct Register*, struct Register*);
+struct Register* emit_divide(FILE*, struct Register*, struct Register*);
+struct Register* emit_modulo(FILE*, struct Register*, struct Register*);
+void emit_multiply_immediate(FILE*, struct Register*, struct Register*, int);
+void emit_routine(FILE*, enum Routine);
 struct Register* emit_left_shift(FILE*, struct Register*, struct Register*);
 struct Register* emit_right_shift(FILE*, struct Register*, struct Register*);
 
@@ -34,6 +34,12 @@ void add_parameter(struct Type* base, struct Type* new_parameter) {
     list_add(&base->parameters, new_parameter);
 }
 
+// How far ++ and -- move a value, pointers step over what they point at
+int step_size(struct Type* type) {
+    if ((type->kind == TY_POINTER) && (type->base->size != 0)) return type->base->size;
+    return 1;
+}
+
 // Get lowest common denominator type
 // These are essentially automatic casts
 struct Type* get_common_type(struct Token* token, struct Type* left, struct Type* right) {
@@ -22,6 +22,7 @@ static struct Type* base_types[] = {&type_void, &type_char, &type_int};
 struct Type* pointer_to(struct Type*);
 struct Type* function_of(struct Type*);
 void add_parameter(struct Type*, struct Type*);
+int step_size(struct Type*);
 struct Type* get_common_type(struct Token*, struct Type*, struct Type*);
 
 #endif
\ No newline at end of file
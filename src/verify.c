@@ -0,0 +1,48 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "verify.h"
+#include "lexer.h"
+#include "messages.h"
+#include "parser.h"
+
+// Sanity checks the AST after parsing and after each transform that runs,
+// so a broken transform is named where it happens rather than found in the
+// generated code
+
+static void verify_node(struct Node** slot, void* data) {
+    struct Node* node = *slot;
+    char* after = (char*)data;
+
+    if (node == NULL) error(NULL, "internal error: missing node in AST after '%s'", after);
+    if (node->token == NULL) error(NULL, "internal error: node without a token in AST after '%s'", after);
+    if (node->type == NULL) error(node->token, "internal error: node without a type in AST after '%s'", after);
+
+    switch (node->kind) {
+        case N_ASSIGNMENT:
+        case N_BINOP:
+            if ((node->BinOp.left == NULL) || (node->BinOp.right == NULL)) error(node->token, "internal error: operator missing an operand after '%s'", after);
+            break;
+        case N_UNARY:
+            if (node->UnaryOp.left == NULL) error(node->token, "internal error: operator missing an operand after '%s'", after);
+            break;
+        case N_INC_DEC:
+            if ((node->IncDec.variable == NULL) || (node->IncDec.variable->kind != N_VARIABLE)) error(node->token, "internal error: '%s' of something other than a variable after '%s'", node->token->value, after);
+            break;
+        case N_VARIABLE:
+            if (node->Variable.symbol == NULL) error(node->token, "internal error: variable without a symbol after '%s'", after);
+            break;
+        case N_FUNC_CALL:
+            if (node->FuncCall.symbol == NULL) error(node->token, "internal error: call without a symbol after '%s'", after);
+            break;
+        default:
+            break;
+    }
+
+    for_each_child(node, verify_node, data);
+}
+
+// Names the pass that last changed the tree in any error
+int verify_ast(struct Node* root_node, char* after) {
+    verify_node(&root_node, after);
+    return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef _VERIFY_H
+#define _VERIFY_H
+
+struct Node;
+
+int verify_ast(struct Node*, char*);
+
+#endif
@@ -4,6 +4,13 @@ char test(char depth) {
     else return test(depth - 1) - 1;
 }
 
+// Deep enough that only the size of the stack limits it
+int count(int depth) {
+    if (depth == 0) return 0;
+    return count(depth - 1) + 1;
+}
+
 char main() {
+    if (count(2000) != 2000) return 1;
     return test(50);
-}
\ No newline at end of file
+}
@@ -0,0 +1,28 @@
+// Test constant folding with 8 and 16-bit wraparound
+char main() {
+    char c = 200 + 100;
+    if (c != 44) return 1;
+
+    int x = 0x1234 + 0x4321 - 0x1111;
+    if (x != 0x4444) return 2;
+
+    int y = 0xfff0 + 0x20;
+    if (y != 0x10) return 3;
+
+    x = x + 1 + 2 - 3 + 0x100;
+    if (x != 0x4544) return 4;
+
+    c = (c & 0xff) | 0;
+    if (c != 44) return 5;
+
+    c = ((c | 0x0f) & 0xfc) & 0x3f;
+    if (c != 0x2c) return 6;
+
+    c = 3 - 5;
+    if (c != 254) return 7;
+
+    c = -c + 0;
+    if (c != 2) return 8;
+
+    return 0;
+}
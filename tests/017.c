@@ -0,0 +1,50 @@
+// Test expression evaluation order and register pressure
+
+char g;
+
+char add3(char x, char y, char z) {
+    return x + y + z;
+}
+
+char bump() {
+    g = g + 1;
+    return g;
+}
+
+char main() {
+    char a = 3;
+    char b = 5;
+    char c = 7;
+    char* p = &b;
+
+    // Heavier right operand, non-commutative
+    if (a - (b + (c - a)) != 250) return 1;
+
+    // Nested on both sides
+    if ((a + b) - (c - a) != 4) return 2;
+
+    // Values held in registers across a call
+    g = 10;
+    if (a + (b + bump()) != 19) return 3;
+
+    // Arguments addressed relative to earlier pushes
+    if (add3(a, b, c) != 15) return 4;
+    if (add3(c - a, *p, add3(a, a, a)) != 18) return 5;
+
+    // Pointer writes with a computed value
+    *p = (a + c) - (b - a);
+    if (b != 8) return 6;
+
+    // 16-bit values and truncation back to char
+    int x = 0x1234;
+    int y = 0x0102;
+    char low = x + y;
+    if (low != 0x36) return 7;
+    if ((x - y) + (y + x) != 0x2468) return 8;
+
+    // Calls on both sides keep their order
+    g = 0;
+    if (bump() - bump() != 255) return 9;
+
+    return 0;
+}
@@ -0,0 +1,63 @@
+// Test locals and parameters kept in registers
+
+char sum_to(char n) {
+    char total = 0;
+    while (n != 0) {
+        total = total + n;
+        n--;
+    }
+    return total;
+}
+
+char identity(char x) {
+    return x;
+}
+
+void fill(char* p, char count, char value) {
+    while (count != 0) {
+        *p = value;
+        p++;
+        value++;
+        count--;
+    }
+}
+
+char main() {
+    if (sum_to(10) != 55) return 1;
+
+    // Live across calls
+    char a = 4;
+    char b = 9;
+    char c = identity(a) + identity(b);
+    if (c != 13) return 2;
+    if (a + b != c) return 3;
+
+    // More variables than registers
+    char d = 1;
+    char e = 2;
+    char f = 3;
+    char g = 4;
+    if (a + b + c + d + e + f + g != 36) return 4;
+
+    // Address taken stays in memory
+    char h = 7;
+    char* q = &h;
+    *q = 8;
+    if (h != 8) return 5;
+
+    // Pointer walking a buffer
+    extern char heap_start;
+    char* start = &heap_start;
+    fill(start, 5, 'a');
+    char* p = start;
+    char i = 0;
+    char sum = 0;
+    while (i < 5) {
+        sum = sum + *p;
+        p++;
+        i++;
+    }
+    if (sum != 'a' + 'b' + 'c' + 'd' + 'e') return 6;
+
+    return 0;
+}
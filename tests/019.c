@@ -0,0 +1,36 @@
+// Test code the peephole optimizer rewrites, character literals the comment and operand parsing must not split
+char pick(char a, char b) {
+    if (a == b) return ';';
+    if (a > b) return a;
+    return b;
+}
+
+char count_commas(char* s) {
+    char count = 0;
+    while (*s != 0) {
+        if (*s == ',') count++;
+        s++;
+    }
+    return count;
+}
+
+char main() {
+    char x = 5;
+    char y = x;
+    if (x == 5) y = y + 1;
+    if (y != 6) return 1;
+
+    if (pick(3, 3) != ';') return 2;
+    if (pick(7, 2) != 7) return 3;
+    if (pick(pick(1, 4), 9) != 9) return 4;
+
+    if (count_commas("a,b;c,d") != 2) return 5;
+
+    char z = 0;
+    if (z != 0) return 6;
+    z = 0;
+    if (z == 0) z = x;
+    if (z != 5) return 7;
+
+    return 0;
+}
@@ -0,0 +1,24 @@
+// Test unused functions and globals are removed without losing what is reachable
+char calls = 0;
+char unused_counter = 7;
+char* message = "unused";
+
+char never_called() {
+    unused_counter = unused_counter + 1;
+    return never_called();
+}
+
+char helper(char x) {
+    calls = calls + 1;
+    return x + 1;
+}
+
+char through_helper(char x) {
+    return helper(x) + helper(x);
+}
+
+char main() {
+    if (through_helper(4) != 10) return 1;
+    if (calls != 2) return 2;
+    return 0;
+}
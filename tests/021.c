@@ -0,0 +1,65 @@
+// Test conditions that branch on a comparison directly, constants on either side and at the edges
+char count_below(char limit) {
+    char n = 0;
+    while (n < limit) n++;
+    return n;
+}
+
+char count_through(char limit) {
+    char n = 1;
+    char steps = 0;
+    while (n <= limit) {
+        steps++;
+        n++;
+    }
+    return steps;
+}
+
+char classify(char x, char y) {
+    char flags = 0;
+    if (x == y) flags = flags | 1;
+    if (x != y) flags = flags | 2;
+    if (x > y) flags = flags | 4;
+    if (x < y) flags = flags | 8;
+    if (x >= y) flags = flags | 16;
+    if (x <= y) flags = flags | 32;
+    return flags;
+}
+
+char classify_constant(char x) {
+    char flags = 0;
+    if (x == 100) flags = flags | 1;
+    if (100 != x) flags = flags | 2;
+    if (x > 100) flags = flags | 4;
+    if (100 > x) flags = flags | 8;
+    if (x >= 100) flags = flags | 16;
+    if (100 >= x) flags = flags | 32;
+    return flags;
+}
+
+char main() {
+    if (classify(3, 3) != 49) return 1;
+    if (classify(4, 3) != 22) return 2;
+    if (classify(3, 4) != 42) return 3;
+    if (classify(0, 255) != 42) return 4;
+    if (classify(255, 0) != 22) return 5;
+
+    if (classify_constant(100) != 49) return 6;
+    if (classify_constant(101) != 22) return 7;
+    if (classify_constant(99) != 42) return 8;
+    if (classify_constant(0) != 42) return 9;
+
+    if (count_below(0) != 0) return 10;
+    if (count_below(7) != 7) return 11;
+    if (count_through(0) != 0) return 12;
+    if (count_through(1) != 1) return 13;
+    if (count_through(9) != 9) return 14;
+
+    char x = 5;
+    if (x + 1 < x) return 15;
+    if (x <= 4) return 16;
+    if (x < 5) return 17;
+    if (x >= 6) return 18;
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+// Test logical shifts of chars and ints by constant and variable amounts
+char shift_left(char value, char amount) {
+    return value << amount;
+}
+
+char shift_right(char value, char amount) {
+    return value >> amount;
+}
+
+char shifts_left_to(int value, char amount, int expected) {
+    return (value << amount) == expected;
+}
+
+char shifts_right_to(int value, char amount, int expected) {
+    return (value >> amount) == expected;
+}
+
+char high_nibble(char value) {
+    return value >> 4;
+}
+
+char main() {
+    char x = 0xb5;
+
+    // Constant amounts, bits shifted out are gone rather than rotated back in
+    if ((x << 1) != 0x6a) return 1;
+    if ((x << 3) != 0xa8) return 2;
+    if ((x >> 1) != 0x5a) return 3;
+    if ((x >> 4) != 0x0b) return 4;
+    if ((x >> 7) != 1) return 5;
+    if ((x << 0) != 0xb5) return 6;
+    if (high_nibble(0xc3) != 0x0c) return 7;
+
+    // Variable amounts
+    if (shift_left(0xb5, 2) != 0xd4) return 8;
+    if (shift_right(0xb5, 2) != 0x2d) return 9;
+    if (shift_left(0xb5, 0) != 0xb5) return 10;
+    if (shift_right(0xb5, 0) != 0xb5) return 11;
+    if (shift_left(0xff, 8) != 0) return 12;
+    if (shift_right(0xff, 9) != 0) return 13;
+
+    // Ints by constant amounts, within and across bytes
+    int y = 0x9ab5;
+    if ((y << 1) != 0x356a) return 14;
+    if ((y >> 1) != 0x4d5a) return 15;
+    if ((y >> 5) != 0x04d5) return 16;
+    if ((y << 4) != 0xab50) return 17;
+    if ((y << 8) != 0xb500) return 18;
+    if ((y >> 12) != 0x0009) return 19;
+    if ((y << 16) != 0) return 20;
+
+    // Ints by variable amounts
+    if (shifts_left_to(0x9ab5, 3, 0xd5a8) != 1) return 21;
+    if (shifts_right_to(0x9ab5, 3, 0x1356) != 1) return 22;
+    if (shifts_right_to(0x9ab5, 11, 0x0013) != 1) return 23;
+    if (shifts_left_to(0x0001, 7, 0x0080) != 1) return 24;
+
+    return 0;
+}
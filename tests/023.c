@@ -0,0 +1,93 @@
+// Test 16-bit arithmetic and comparisons, carries between bytes and decisions on either byte
+#include "io.h"
+
+char compare(int x, int y) {
+    char flags = 0;
+    if (x == y) flags = flags | 1;
+    if (x != y) flags = flags | 2;
+    if (x > y) flags = flags | 4;
+    if (x < y) flags = flags | 8;
+    if (x >= y) flags = flags | 16;
+    if (x <= y) flags = flags | 32;
+    return flags;
+}
+
+char materialize(int x, int y) {
+    char flags = (x == y) | ((x != y) << 1) | ((x > y) << 2);
+    flags = flags | ((x < y) << 3) | ((x >= y) << 4) | ((x <= y) << 5);
+    return flags;
+}
+
+char sums_to(int x, int y, int expected) {
+    return (x + y) == expected;
+}
+
+char differs_by(int x, int y, int expected) {
+    return (x - y) == expected;
+}
+
+char count_chars(char* start, char* end) {
+    char count = 0;
+    char* p = start;
+    while (p < end) {
+        count++;
+        p++;
+    }
+    return count;
+}
+
+char main() {
+    // Carry and borrow between the bytes
+    if (sums_to(0x00ff, 0x0001, 0x0100) != 1) return 1;
+    if (sums_to(0x12f0, 0x3420, 0x4710) != 1) return 2;
+    if (sums_to(0xffff, 0x0002, 0x0001) != 1) return 3;
+    if (differs_by(0x0100, 0x0001, 0x00ff) != 1) return 4;
+    if (differs_by(0x4710, 0x12f0, 0x3420) != 1) return 5;
+    if (differs_by(0x0001, 0x0002, 0xffff) != 1) return 6;
+
+    // Deciding on the high byte, then on the low byte
+    if (compare(0x1234, 0x1234) != 49) return 7;
+    if (compare(0x1300, 0x12ff) != 22) return 8;
+    if (compare(0x12ff, 0x1300) != 42) return 9;
+    if (compare(0x1235, 0x1234) != 22) return 10;
+    if (compare(0x1234, 0x1235) != 42) return 11;
+    if (compare(0x0000, 0xffff) != 42) return 12;
+
+    if (materialize(0x1234, 0x1234) != 49) return 13;
+    if (materialize(0x1300, 0x12ff) != 22) return 14;
+    if (materialize(0x1234, 0x1235) != 42) return 15;
+
+    // Counters that go past a byte, compared against constants
+    int i = 0;
+    char steps = 0;
+    while (i < 0x0300) {
+        i = i + 0x40;
+        steps++;
+    }
+    if (steps != 12) return 16;
+    if (i != 0x0300) return 17;
+    if (0x02ff >= i) return 18;
+    if (i > 768) return 19;
+
+    // Testing an int against zero
+    int left = 0x0100;
+    steps = 0;
+    while (left) {
+        left = left - 0x80;
+        steps++;
+    }
+    if (steps != 2) return 20;
+
+    // Pointer comparisons
+    char* text = "abcdef";
+    char* end = text;
+    while (*end != 0) end++;
+    if (count_chars(text, end) != 6) return 21;
+    if (count_chars(end, end) != 0) return 22;
+    if (count_chars(end, text) != 0) return 23;
+
+    print_hex_u16(0xbeef);
+    print("\n");
+
+    return 0;
+}
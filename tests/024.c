@@ -0,0 +1,80 @@
+// Test multiply, divide and modulo in both sizes, by variables and by constants
+char mul8(char x, char y, char expected) {
+    return (x * y) == expected;
+}
+
+char div8(char x, char y, char quotient, char remainder) {
+    return ((x / y) == quotient) + ((x % y) == remainder);
+}
+
+char mul16(int x, int y, int expected) {
+    return (x * y) == expected;
+}
+
+char div16(int x, int y, int quotient, int remainder) {
+    char checks = 0;
+    if ((x / y) == quotient) checks++;
+    if ((x % y) == remainder) checks++;
+    return checks;
+}
+
+char by_constants8(char x) {
+    char checks = 0;
+    if ((x * 10) == 120) checks++;
+    if ((3 * x) == 36) checks++;
+    if ((x * 8) == 96) checks++;
+    if ((x / 4) == 3) checks++;
+    if ((x % 8) == 4) checks++;
+    if ((x / 5) == 2) checks++;
+    if ((x % 5) == 2) checks++;
+    if ((x * 0) == 0) checks++;
+    return checks;
+}
+
+char by_constants16(int x) {
+    char checks = 0;
+    if ((x * 10) == 12340) checks++;
+    if ((x * 100) == 57864) checks++;
+    if ((x * 16) == 19744) checks++;
+    if ((x / 16) == 77) checks++;
+    if ((x % 16) == 2) checks++;
+    if ((x / 10) == 123) checks++;
+    if ((x % 1000) == 234) checks++;
+    return checks;
+}
+
+char main() {
+    if (mul8(7, 6, 42) != 1) return 1;
+    if (mul8(0, 200, 0) != 1) return 2;
+    if (mul8(16, 17, 16) != 1) return 3;
+    if (mul8(255, 255, 1) != 1) return 4;
+
+    if (div8(200, 7, 28, 4) != 2) return 5;
+    if (div8(5, 9, 0, 5) != 2) return 6;
+    if (div8(0, 3, 0, 0) != 2) return 7;
+    if (div8(255, 1, 255, 0) != 2) return 8;
+    if (div8(255, 255, 1, 0) != 2) return 9;
+    if (div8(254, 128, 1, 126) != 2) return 10;
+
+    if (mul16(300, 200, 60000) != 1) return 11;
+    if (mul16(0x0101, 0x00ff, 0xffff) != 1) return 12;
+    if (mul16(1000, 1000, 16960) != 1) return 13;
+    if (mul16(0, 1234, 0) != 1) return 14;
+
+    if (div16(60000, 7, 8571, 3) != 2) return 15;
+    if (div16(0xffff, 0x8000, 1, 0x7fff) != 2) return 16;
+    if (div16(0xffff, 0xffff, 1, 0) != 2) return 17;
+    if (div16(12, 1000, 0, 12) != 2) return 18;
+    if (div16(0x8000, 3, 10922, 2) != 2) return 19;
+
+    if (by_constants8(12) != 8) return 20;
+    if (by_constants16(1234) != 7) return 21;
+
+    // Left to right
+    char a = 100;
+    char b = 7;
+    char c = 3;
+    if ((a / b * c) != 42) return 22;
+    if ((a % b % c) != 2) return 23;
+    return 0;
+}
@@ -0,0 +1,60 @@
+// Test string literals placed after the code, shared when identical and merged when one ends another
+char counter;
+char* last = "world";
+
+char length(char* text) {
+    char count = 0;
+    while (*text != 0) {
+        count++;
+        text++;
+    }
+    return count;
+}
+
+char same(char* left, char* right) {
+    while (*left == *right) {
+        if (*left == 0) return 1;
+        left++;
+        right++;
+    }
+    return 0;
+}
+
+char last_char(char* text) {
+    char previous = 0;
+    while (*text != 0) {
+        previous = *text;
+        text++;
+    }
+    return previous;
+}
+
+char main() {
+    char* greeting = "hello world";
+    char* again = "hello world";
+    char* end = "world";
+    char* line = "line\n";
+    char* escaped = "n";
+    char* empty = "";
+
+    if (length(greeting) != 11) return 1;
+    if (same(greeting, again) != 1) return 2;
+    if (same(end, last) != 1) return 3;
+    if (greeting == end) return 4;
+    if (length(line) != 5) return 5;
+    if (last_char(line) != 10) return 6;
+    if (length(escaped) != 1) return 7;
+    if (*escaped != 'n') return 8;
+    if (length(empty) != 0) return 9;
+
+    // A literal used in a loop is the same address every time
+    char* first = empty;
+    counter = 0;
+    while (counter < 3) {
+        char* each = "world";
+        if (counter == 0) first = each;
+        if (each != first) return 10;
+        counter++;
+    }
+    return 0;
+}
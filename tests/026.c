@@ -0,0 +1,36 @@
+// Test globals start with their initial values without startup code, and the rest start as zero
+char first = 5;
+int wide = 0x1234;
+char* greeting = "hi";
+int address = 0x7000;
+char* device = 0x7000;
+char letter = 'q';
+char zero = 0;
+char unset;
+int unset_wide;
+int sum = 1 + 2;
+
+char bump() {
+    first = first + 1;
+    unset = unset + 1;
+    return first;
+}
+
+char main() {
+    if (first != 5) return 1;
+    if (wide != 0x1234) return 2;
+    if (*greeting != 'h') return 3;
+    char* expected = address;
+    if (device != expected) return 4;
+    if (letter != 'q') return 5;
+    if (zero != 0) return 6;
+    if (unset != 0) return 7;
+    if (unset_wide != 0) return 8;
+    if (sum != 3) return 9;
+
+    // Data is written like any other variable
+    bump();
+    if (bump() != 7) return 10;
+    if (unset != 2) return 11;
+    return 0;
+}
@@ -0,0 +1,60 @@
+// Test one stack frame per function, returning from nested blocks and blocks side by side
+char find(char* text, char wanted) {
+    char index = 0;
+    while (*text != 0) {
+        char current = *text;
+        if (current == wanted) {
+            char found = index;
+            return found;
+        }
+        index++;
+        text++;
+    }
+    return 255;
+}
+
+char siblings(char x) {
+    char total = 0;
+    if (x > 2) {
+        char doubled = x + x;
+        total = total + doubled;
+    }
+    if (x > 1) {
+        char tripled = x + x + x;
+        char extra = 1;
+        total = total + tripled + extra;
+    }
+    return total;
+}
+
+char depth(char n) {
+    char here = n;
+    if (n == 0) return 0;
+    char below = depth(n - 1);
+    if (below != n - 1) return 100;
+    return here;
+}
+
+char no_locals(char x) {
+    return x + 1;
+}
+
+char main() {
+    if (find("hello", 'l') != 2) return 1;
+    if (find("hello", 'z') != 255) return 2;
+    if (siblings(3) != 16) return 3;
+    if (siblings(2) != 7) return 4;
+    if (depth(5) != 5) return 5;
+    if (no_locals(4) != 5) return 6;
+
+    // Returning from a loop frees the whole frame, so the caller's locals are intact
+    char before = 7;
+    char i = 0;
+    while (i < 3) {
+        char inner = find("abc", 'c');
+        if (inner != 2) return 7;
+        i++;
+    }
+    if (before != 7) return 8;
+    return 0;
+}
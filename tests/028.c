@@ -0,0 +1,61 @@
+// Test arguments passed in registers with the rest on the stack, and 16-bit results
+char bytes(char x, char y, char z) {
+    return x - y - z;
+}
+
+int words(int x, int y) {
+    return x - y;
+}
+
+int mixed(char x, int y, char z, int w) {
+    return y + w - x - z;
+}
+
+char overflow(char p, char q, char r, char s, int t, char u) {
+    if (p != 1) return 1;
+    if (q != 2) return 2;
+    if (r != 3) return 3;
+    if (s != 4) return 4;
+    if (t != 0x1234) return 5;
+    if (u != 6) return 6;
+    return 0;
+}
+
+char* skip(char* text, char count) {
+    while (count != 0) {
+        text++;
+        count--;
+    }
+    return text;
+}
+
+int widen(char x) {
+    return x;
+}
+
+int sum_to(int n) {
+    if (n == 0) return 0;
+    return n + sum_to(n - 1);
+}
+
+char main() {
+    if (bytes(100, 30, 20) != 50) return 1;
+    if (words(0x1234, 0x0234) != 0x1000) return 2;
+    if (mixed(1, 0x1000, 2, 0x0203) != 0x1200) return 3;
+    if (overflow(1, 2, 3, 4, 0x1234, 6) != 0) return 4;
+    if (*skip("abcdef", 3) != 'd') return 5;
+    if (widen(200) != 200) return 6;
+    if (sum_to(300) != 45150) return 7;
+
+    // Calls as arguments, each one's result held while the next is made
+    if (words(words(0x5000, 0x1000), words(0x2000, 0x1000)) != 0x3000) return 8;
+    if (bytes(bytes(90, 5, 5), bytes(30, 10, 10), 20) != 50) return 9;
+
+    // Values live across a call survive it
+    int kept = 0x4321;
+    char small = 9;
+    if (words(kept, 0x0021) != 0x4300) return 10;
+    if (kept != 0x4321) return 11;
+    if (small != 9) return 12;
+    return 0;
+}
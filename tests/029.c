@@ -0,0 +1,84 @@
+// Test inlined functions behave the same as calling them
+char counter = 0;
+char* cursor = 0x7100;
+char stored = 0;
+
+char twice(char x) {
+    return x + x;
+}
+
+int scale(int value, char shift) {
+    return value << shift;
+}
+
+void bump(char amount) {
+    counter = counter + amount;
+}
+
+inline void store(char value) {
+    char copy = value;
+    if (copy > 10) {
+        char extra = 1;
+        copy = copy + extra;
+    }
+    *cursor = copy;
+    ++cursor;
+    stored = stored + 1;
+}
+
+inline char next() {
+    counter = counter + 1;
+    return counter;
+}
+
+__attribute__((noinline)) char noinline_add(char x, char y) {
+    return x + y;
+}
+
+void fill(char* at, char count, char value) {
+    while (count != 0) {
+        *at = value;
+        at++;
+        count--;
+    }
+}
+
+char down(char n) {
+    if (n == 0) return 0;
+    return down(n - 1);
+}
+
+char main() {
+    char a = 7;
+    if (twice(a) != 14) return 1;
+    if (twice(a + 1) != 16) return 2;
+    if (scale(0x0101, 4) != 0x1010) return 3;
+
+    bump(3);
+    // The argument is read before the function changes the global
+    bump(counter);
+    if (counter != 6) return 4;
+
+    counter = 5;
+    if (next() != 6) return 5;
+    if (next() != 7) return 6;
+
+    char* start = cursor;
+    store(4);
+    store(20);
+    if (*start != 4) return 7;
+    ++start;
+    if (*start != 21) return 8;
+    if (stored != 2) return 9;
+
+    // Parameters of an inlined block don't clash with the caller's names
+    char value = 9;
+    char count = 2;
+    fill(start, count, value);
+    if (*start != 9) return 10;
+    if (count != 2) return 11;
+
+    if (noinline_add(a, 3) != 10) return 12;
+    if (down(3) != 0) return 13;
+    return 0;
+}
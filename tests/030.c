@@ -0,0 +1,69 @@
+// Test calls in tail position, made into jumps, give the same results as calls
+int sum(int n, int total) {
+    if (n == 0) return total;
+    return sum(n - 1, total + n);
+}
+
+char count_down(char n) {
+    if (n == 0) return 42;
+    return count_down(n - 1);
+}
+
+__attribute__((noinline)) char add_local(char x) {
+    return x + 1;
+}
+
+// Has a frame to free before jumping
+char framed(char x) {
+    char a = x;
+    char b = x + 1;
+    char c = x + 2;
+    char d = x + 3;
+    return add_local(a + b + c + d);
+}
+
+// The callee reads a local through its address so the frame has to stay
+__attribute__((noinline)) char read(char* p) {
+    char filler = 7;
+    char other = 9;
+    *p = *p + filler + other - 16;
+    return *p + 1;
+}
+
+char address_passed(char v) {
+    char x = v;
+    return read(&x);
+}
+
+__attribute__((noinline)) int read_int(int* p) {
+    int a = 1;
+    int b = 2;
+    return *p + a + b - 3;
+}
+
+int int_address_passed(int v) {
+    int x = v;
+    return read_int(&x);
+}
+
+// Arguments on the stack keep the call
+char many(char a1, char a2, char a3, char a4) {
+    if (a4 == 0) return a1 + a2 + a3;
+    return many(a1, a2, a3, a4 - 1);
+}
+
+// Results of a different size need converting after the call
+int widen(char x) {
+    return count_down(x);
+}
+
+char main() {
+    if (sum(200, 0) != 20100) return 1;
+    if (count_down(250) != 42) return 2;
+    if (framed(5) != 27) return 3;
+    if (many(1, 2, 3, 20) != 6) return 4;
+    if (widen(3) != 42) return 5;
+    if (address_passed(41) != 42) return 6;
+    if (int_address_passed(1234) != 1234) return 7;
+    return 0;
+}
@@ -0,0 +1,102 @@
+// Test values moved out of loops and counters strength reduced keep their results
+char* device = 0x7100;
+char drained = 0;
+char limit = 5;
+char extra = 3;
+char total = 0;
+char target = 0;
+int wide_total = 0;
+
+__attribute__((noinline)) void raise_limit() {
+    limit = limit + 1;
+}
+
+// The pointer to the device doesn't change so is only loaded once
+void drain() {
+    *device = 4;
+    while (*device != 0) {
+        *device = *device - 1;
+        drained = drained + 1;
+    }
+}
+
+// Arithmetic on globals nothing in the loop writes
+void add_invariant(char count) {
+    while (count != 0) {
+        total = total + (limit + extra);
+        count--;
+    }
+}
+
+// A call may change a global so it is read every time
+char sum_with_call() {
+    char sum = 0;
+    char i = 0;
+    while (i != 3) {
+        sum = sum + limit;
+        raise_limit();
+        i++;
+    }
+    return sum;
+}
+
+// A store through a pointer may change a global whose address is taken
+char sum_with_alias() {
+    char* alias = &target;
+    char sum = 0;
+    while (target != 3) {
+        sum = sum + target;
+        *alias = *alias + 1;
+    }
+    return sum;
+}
+
+void multiples() {
+    char i = 0;
+    while (i != 4) {
+        total = total + i * 3;
+        i++;
+    }
+}
+
+void wide_multiples() {
+    int j = 0;
+    while (j != 5) {
+        wide_total = wide_total + j * 300;
+        ++j;
+    }
+}
+
+void falling_multiples() {
+    char k = 10;
+    while (k != 0) {
+        total = total + k * 5;
+        k = k - 2;
+    }
+}
+
+char main() {
+    drain();
+    if (drained != 4) return 1;
+    if (*device != 0) return 2;
+
+    add_invariant(3);
+    if (total != 24) return 3;
+
+    if (sum_with_call() != 18) return 4;
+    if (limit != 8) return 5;
+
+    if (sum_with_alias() != 3) return 6;
+
+    total = 0;
+    multiples();
+    if (total != 18) return 7;
+
+    wide_multiples();
+    if (wide_total != 3000) return 8;
+
+    total = 0;
+    falling_multiples();
+    if (total != 150) return 9;
+    return 0;
+}
@@ -0,0 +1,102 @@
+// Test loops tested at the bottom run the same number of times for every comparison
+char limit = 0;
+
+char set_limit() {
+    limit = 4;
+    return 1;
+}
+
+char count_less(char from, char to) {
+    char n = 0;
+    while (from < to) {
+        from++;
+        n++;
+    }
+    return n;
+}
+
+char count_more_equal(char from, char to) {
+    char n = 0;
+    while (from >= to) {
+        from--;
+        n++;
+    }
+    return n;
+}
+
+char count_more(int from, int to) {
+    char n = 0;
+    while (from > to) {
+        from--;
+        n++;
+    }
+    return n;
+}
+
+char count_less_equal(int from, int to) {
+    char n = 0;
+    while (from <= to) {
+        from++;
+        n++;
+    }
+    return n;
+}
+
+char count_value(char value) {
+    char n = 0;
+    while (value) {
+        value = value >> 1;
+        n++;
+    }
+    return n;
+}
+
+// The condition holds on entry so there is no test before the first iteration
+char count_known() {
+    char n = 0;
+    char i = 3;
+    while (i != 0) {
+        i--;
+        n++;
+    }
+    return n;
+}
+
+char until_return() {
+    char i = 0;
+    while (1) {
+        i++;
+        if (i == 6) return i;
+    }
+    return 0;
+}
+
+// The call between the assignment and the loop changes the global it tests
+char count_after_call() {
+    char n = 0;
+    limit = 0;
+    if (set_limit()) {
+        while (limit != 0) {
+            limit--;
+            n++;
+        }
+    }
+    return n;
+}
+
+char main() {
+    if (count_less(2, 7) != 5) return 1;
+    if (count_less(7, 2) != 0) return 2;
+    if (count_more_equal(5, 2) != 4) return 3;
+    if (count_more_equal(1, 2) != 0) return 4;
+    if (count_more(300, 297) != 3) return 5;
+    if (count_more(297, 300) != 0) return 6;
+    if (count_less_equal(510, 512) != 3) return 7;
+    if (count_less_equal(513, 512) != 0) return 8;
+    if (count_value(0) != 0) return 9;
+    if (count_value(0x50) != 7) return 10;
+    if (count_known() != 3) return 11;
+    if (until_return() != 6) return 12;
+    if (count_after_call() != 4) return 13;
+    return 0;
+}
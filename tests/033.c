@@ -0,0 +1,60 @@
+// Test increments and decrements give the right value before or after and carry into the high byte
+int wide = 0x00ff;
+char narrow = 0;
+int* words = 0x7100;
+
+char count_down(char n) {
+    char loops = 0;
+    while (n--) loops++;
+    return loops;
+}
+
+// Taking the address keeps the variable in memory
+char in_memory() {
+    char value = 5;
+    char* p = &value;
+    char before = value++;
+    if (before != 5) return 1;
+    if (++value != 7) return 2;
+    if (value-- != 7) return 3;
+    if (*p != 6) return 4;
+    return 0;
+}
+
+char main() {
+    if (wide++ != 0x00ff) return 1;
+    if (wide != 0x0100) return 2;
+    if (--wide != 0x00ff) return 3;
+    wide = 0xffff;
+    wide++;
+    if (wide != 0) return 4;
+    wide--;
+    if (wide != 0xffff) return 5;
+
+    narrow--;
+    if (narrow != 255) return 6;
+    if (++narrow != 0) return 7;
+
+    if (count_down(4) != 4) return 8;
+    if (count_down(0) != 0) return 9;
+    if (in_memory() != 0) return 10;
+
+    // Pointers step over what they point at
+    *words = 300;
+    words++;
+    *words = 500;
+    if (*--words != 300) return 11;
+    int* at = words;
+    if (*++at != 500) return 12;
+    if (at-- == words) return 13;
+    if (at != words) return 14;
+
+    char text = 0;
+    char* letters = "abc";
+    letters++;
+    if (*letters != 'b') return 15;
+    if (text == 0) letters++;
+    if (*letters-- != 'c') return 16;
+    if (*letters != 'b') return 17;
+    return 0;
+}
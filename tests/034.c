@@ -0,0 +1,50 @@
+// Test statements whose value is thrown away still have their effect, and values still used are kept
+char calls = 0;
+char last = 0;
+
+char record(char c) {
+    calls++;
+    last = c;
+    return c + 1;
+}
+
+int widen(char c) {
+    int wide = c;
+    wide = 300;
+    wide = wide + c;
+    return wide;
+}
+
+char copy_around(char x, char y) {
+    char a = x;
+    char b = a;
+    a = y;
+    b = a;
+    a = 9;
+    return a + b;
+}
+
+char main() {
+    record(4);
+    if (calls != 1) return 1;
+    if (last != 4) return 2;
+    if (record(6) != 7) return 3;
+
+    char a = 0;
+    char b = 0;
+    a = b = 3;
+    if (a != 3) return 4;
+    if (b != 3) return 5;
+
+    if ((a = record(1)) != 2) return 6;
+    if (a != 2) return 7;
+
+    if (widen(5) != 305) return 8;
+    if (copy_around(1, 2) != 11) return 9;
+
+    char count = 0;
+    count++;
+    ++count;
+    if (count != 2) return 10;
+    return 0;
+}
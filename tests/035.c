@@ -0,0 +1,17 @@
+// Test bytes widened to match the other operand count the pair they need
+int wide = 1000;
+
+int sum_widened(int x, int y) {
+    int z = (x + 3) + (y + 1);
+    return z;
+}
+
+char main() {
+    int x = 300;
+    int y = 7;
+    int z = (x + 3) + (y + 1);
+    if (z != 311) return 1;
+    if (sum_widened(300, 7) != 311) return 2;
+    if (((wide + 5) + (wide - 2)) != 2003) return 3;
+    return 0;
+}
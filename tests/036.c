@@ -0,0 +1,24 @@
+// Test 16-bit comparisons used as values give an int of 0 or 1 at every level
+int g1 = 65280;
+int g2 = 5;
+
+int negated(int x) {
+    return -(32768 < x);
+}
+
+char main() {
+    int a = -(32768 < g1);
+    if (a != 0xffff) return 1;
+    int b = -(32768 < 65280);
+    if (b != 0xffff) return 2;
+    if (negated(g2) != 0) return 3;
+    if (negated(g1) != 0xffff) return 4;
+
+    int equal = (g1 == 65280) + 0x0100;
+    if (equal != 0x0101) return 5;
+    int different = (g1 != g2) + 0x0200;
+    if (different != 0x0201) return 6;
+    char wide_flag = g2 >= 5;
+    if (wide_flag != 1) return 7;
+    return 0;
+}
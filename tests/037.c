@@ -0,0 +1,20 @@
+// Test shifting by the width of the value or more gives zero, whatever the count
+int value = 0xff3f;
+int far = 258;
+int further = 266;
+int beyond = 40;
+char byte_count = 8;
+
+char main() {
+    if ((value << far) != 0) return 1;
+    if ((value >> further) != 0) return 2;
+    if ((value << beyond) != 0) return 3;
+    if ((value >> beyond) != 0) return 4;
+    if ((value << 16) != 0) return 5;
+
+    char small = 0x81;
+    if ((small << byte_count) != 0) return 6;
+    if ((small >> byte_count) != 0) return 7;
+    if ((value >> 4) != 0x0ff3) return 8;
+    return 0;
+}
@@ -0,0 +1,70 @@
+// Test variables kept in registers hold their value through every path that joins again after a branch
+char calls = 0;
+
+char touch(char c) {
+    calls++;
+    return c;
+}
+
+// Only one arm reads kept but it is still needed after the two arms join
+char one_arm(char flag, char x) {
+    char kept = x + 1;
+    char result = 0;
+    if (flag) {
+        result = kept * 2;
+    } else {
+        char fresh = touch(3);
+        char more = fresh + 2;
+        result = more;
+    }
+    return result + kept;
+}
+
+// Only one arm assigns, the other path keeps the value from before the branch
+int assigned_in_one_arm(char flag) {
+    int value = 300;
+    char other = 7;
+    if (flag) value = 1000;
+    else other = touch(other) + 1;
+    return value + other;
+}
+
+// Each arm has its own variable, they may share a register as only one is live
+char separate_arms(char flag, char x) {
+    char before = x * 3;
+    if (flag) {
+        char left = before + 1;
+        before = left + touch(1);
+    } else {
+        char right = before + 2;
+        before = right * 2;
+    }
+    return before;
+}
+
+// Set late in the loop body and read at the top of the next iteration
+char carried(char n) {
+    char previous = 0;
+    char total = 0;
+    char i = 0;
+    while (i < n) {
+        total = total + previous;
+        if (i & 1) previous = i;
+        else total++;
+        i++;
+    }
+    return total;
+}
+
+char main() {
+    if (one_arm(1, 4) != 15) return 1;
+    if (one_arm(0, 4) != 10) return 2;
+    if (calls != 1) return 3;
+    if (assigned_in_one_arm(1) != 1007) return 4;
+    if (assigned_in_one_arm(0) != 308) return 5;
+    if (separate_arms(1, 2) != 8) return 6;
+    if (separate_arms(0, 2) != 16) return 7;
+    if (carried(6) != 11) return 8;
+    if (carried(0) != 0) return 9;
+    return 0;
+}
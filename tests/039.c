@@ -0,0 +1,62 @@
+// Test divides stay in loops that may end before reaching them, and invariants leave loops nested anywhere
+char zero = 0;
+char seven = 7;
+char hundred = 100;
+
+// Never runs, so never divides by zero
+char divide_unreached(char n) {
+    char result = 0;
+    while (n != 0) {
+        result = result + hundred / zero;
+        n--;
+    }
+    return result;
+}
+
+// Runs at least once past its guard
+char divide_reached(char n) {
+    char result = 0;
+    while (n != 0) {
+        result = result + hundred % seven;
+        n--;
+    }
+    return result;
+}
+
+// The last time round leaves before the divide
+char divide_after_test(char n) {
+    char result = 0;
+    char running = 1;
+    while (running) {
+        if (n == 0) running = 0;
+        else {
+            result = result + hundred / seven;
+            n--;
+        }
+    }
+    return result;
+}
+
+// The inner loop is the whole of an if, not a statement in a block
+char nested(char rows) {
+    char total = 0;
+    char left;
+    while (rows != 0) {
+        left = 3;
+        if (rows != 0)
+            while (left != 0) {
+                total = total + hundred / seven;
+                left--;
+            }
+        rows--;
+    }
+    return total;
+}
+
+char main() {
+    if (divide_unreached(0) != 0) return 1;
+    if (divide_reached(3) != 6) return 2;
+    if (divide_after_test(2) != 28) return 3;
+    if (nested(2) != 84) return 4;
+    return 0;
+}
@@ -29,11 +29,9 @@ void print_hex_u8(char value) {
     putc(low);
 }
 
-// temporary hacky implementation because 
-// 16-bit operations don't work yet :(
 void print_hex_u16(int value) {
-    char* p = &value;
-    print_hex_u8(*p);
-    p++;
-    print_hex_u8(*p);
+    char high = value >> 8;
+    char low = value;
+    print_hex_u8(high);
+    print_hex_u8(low);
 }
\ No newline at end of file
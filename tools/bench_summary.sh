@@ -0,0 +1,26 @@
+#!/bin/bash
+
+BOLD="\033[1m"
+RESET="\033[0m"
+
+TOTAL_CYCLES=0
+
+printf "$BOLD*** CYCLE SUMMARY ***$RESET\n"
+printf "%-32s %12s %12s %8s\n" "test" "cycles" "instructions" "stack"
+
+FILES="../tests/build/*.stats"
+for fullfile in $FILES; do
+    filename=$(basename -- "$fullfile")
+    filename="${filename%.*}"
+    cycles=$(grep "^cycles:" "$fullfile" | cut -d' ' -f2)
+    instructions=$(grep "^instructions:" "$fullfile" | cut -d' ' -f2)
+    stack=$(grep "^peak stack:" "$fullfile" | cut -d' ' -f3)
+    if [[ -z "$cycles" ]]; then
+        printf "%-32s %12s\n" $filename "-"
+        continue
+    fi
+    printf "%-32s %12s %12s %8s\n" $filename $cycles $instructions $stack
+    TOTAL_CYCLES=$((TOTAL_CYCLES + cycles))
+done
+
+printf "$BOLD%-32s %12s$RESET\n" "total" $TOTAL_CYCLES
@@ -0,0 +1,10 @@
+#!/bin/bash
+
+# Rank optimization remarks by how often they occur
+# usage: remark_summary.sh file.opt.yaml...
+
+BOLD="\033[1m"
+RESET="\033[0m"
+
+printf "$BOLD*** REMARK SUMMARY ***$RESET\n"
+awk '/^--- !/ {kind=substr($2, 2)} /^Pass:/ {pass=$2} /^Name:/ {print kind, pass, $2}' "$@" | sort | uniq -c | sort -rn